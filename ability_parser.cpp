@@ -1,11 +1,12 @@
 #include "ability_parser.h"
+#include "mem_stats.h"
 
 #include <algorithm>
 #include <cctype>
-#include <functional>
+#include <cstdint>
 #include <optional>
-#include <regex>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
@@ -16,24 +17,51 @@ namespace {
 enum class AbilityTokenType { WORD, NUMBER, COMMA, END };
 
 struct AbilityToken {
+  // text is a view into the rules text (original case); compare with sameWord()
   AbilityTokenType type = AbilityTokenType::END;
-  string text;
+  string_view text;
   int value = 0;
 };
 
+auto isDigit(char c) -> bool { return c >= '0' && c <= '9'; }
+
+auto sameWord(string_view word, string_view upper) -> bool {
+  // Case-insensitive compare against an upper-case literal (no copies)
+
+  if (word.size() != upper.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < word.size(); i++) {
+    if (toupper(static_cast<unsigned char>(word[i])) != upper[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto containsNoCase(string_view text, string_view lower) -> bool {
+  // Case-insensitive substring search against a lower-case literal
+
+  if (lower.size() > text.size()) {
+    return false;
+  }
+  for (size_t i = 0; i + lower.size() <= text.size(); i++) {
+    size_t j = 0;
+    while (j < lower.size() && tolower(static_cast<unsigned char>(text[i + j])) == lower[j]) {
+      j++;
+    }
+    if (j == lower.size()) {
+      return true;
+    }
+  }
+  return false;
+}
+
 class AbilityTokenizer {
-  string input;
+  string_view input;
   size_t pos = 0;
   optional<AbilityToken> cached;
 
-  static auto toUpper(string inputStr) -> string {
-    transform(inputStr.begin(), inputStr.end(), inputStr.begin(),
-              [](unsigned char inChar) -> char {
-                return static_cast<char>(toupper(inChar));
-              });
-    return inputStr;
-  }
-
   void skipWhitespace() {
     while (pos < input.size() &&
            isspace(static_cast<unsigned char>(input[pos])) != 0) {
@@ -45,24 +73,31 @@ class AbilityTokenizer {
     return (pos < input.size()) ? input[pos] : '\0';
   }
 
-  auto readWhile(const function<bool(char)> &predicate) -> string {
-    string out;
+  template <typename Predicate> auto readWhile(Predicate predicate) -> string_view {
+    size_t start = pos;
     while (pos < input.size() && predicate(input[pos])) {
-      out.push_back(input[pos]);
       pos++;
     }
-    return out;
+    return input.substr(start, pos - start);
   }
 
   auto readNumber() -> AbilityToken {
-    string numStr = readWhile([](char digitChar) -> bool {
-      return isdigit(static_cast<unsigned char>(digitChar)) != 0;
-    });
-    return {AbilityTokenType::NUMBER, numStr, stoi(numStr)};
+    // "3" is a number; "2/2" (a token's power / toughness) stays one word
+    size_t start = pos;
+    string_view digits = readWhile(isDigit);
+    if (current() == '/') {
+      pos = start;
+      return readWord();
+    }
+    int value = 0;
+    for (char digit : digits) {
+      value = value * 10 + (digit - '0');
+    }
+    return {AbilityTokenType::NUMBER, digits, value};
   }
 
   auto readWord() -> AbilityToken {
-    string word = readWhile([](char letter) -> bool {
+    string_view word = readWhile([](char letter) -> bool {
       if (isspace(static_cast<unsigned char>(letter)) != 0) {
         return false;
       }
@@ -72,11 +107,11 @@ class AbilityTokenizer {
       }
       return true;
     });
-    return {AbilityTokenType::WORD, toUpper(word), 0};
+    return {AbilityTokenType::WORD, word, 0};
   }
 
 public:
-  explicit AbilityTokenizer(string src) : input(src) {}
+  explicit AbilityTokenizer(string_view src) : input(src) {}
 
   auto next() -> AbilityToken {
     if (cached.has_value()) {
@@ -88,18 +123,18 @@ public:
     skipWhitespace();
     char currentChar = current();
     if (currentChar == '\0') {
-      return {AbilityTokenType::END, "", 0};
+      return {AbilityTokenType::END, {}, 0};
     }
 
     if (currentChar == ',' || currentChar == ';') {
       pos++;
-      return {AbilityTokenType::COMMA, string(1, currentChar), 0};
+      return {AbilityTokenType::COMMA, input.substr(pos - 1, 1), 0};
     }
     if (currentChar == '.' || currentChar == '(' || currentChar == ')') {
       pos++;
       return next();
     }
-    if (isdigit(static_cast<unsigned char>(currentChar)) != 0) {
+    if (isDigit(currentChar)) {
       return readNumber();
     }
     return readWord();
@@ -111,21 +146,186 @@ public:
     }
     return *cached;
   }
+
+  // True if the next token is the given word (case-insensitive)
+  auto peekWord(string_view upper) -> bool {
+    AbilityToken tok = peek();
+    return tok.type == AbilityTokenType::WORD && sameWord(tok.text, upper);
+  }
 };
 
-// ----------------------------- Helpers ----------------------------- //
+// ----------------------------- Phrase Vocabulary ----------------------------- //
+
+// Every word the effect, target and trigger rules care about. A phrase is reduced to a bitmask of
+// these in one pass; the rule tables below then classify it with a few mask tests.
+enum class Word : uint8_t {
+  NONE,
+  // Effects
+  DESTROY, COUNTER, RETURN, DEAL, DEALS, DRAW, GAIN, LOSE, LOSES, LIFE, SEARCH, LAND, CREATE,
+  SACRIFICE, SACRIFICES,
+  // Targets / scopes
+  EACH, ALL, ANY, TARGET, OPPONENT, PLAYER, CREATURE, CREATURES, PERMANENT, PERMANENTS, SPELL, ANOTHER, YOU,
+  CONTROL, CONTROLS,
+  // Card types a wipe can name (LAND is above)
+  ARTIFACT, ARTIFACTS, ENCHANTMENT, ENCHANTMENTS, LANDS,
+  // Trigger events
+  ENTERS, ENTER, ETB, ETBS, DIES, DIE, ATTACKS, ATTACK, BLOCKS, BLOCK, CASTS, CAST, BECOMES,
+  BEGINNING, END,
+  // Not a word: set when the phrase contains a "+P/+T" token
+  BUFF_PATTERN,
+  COUNT
+};
 
-auto hasWord(const vector<AbilityToken> &tokens, const string &word) -> bool {
-  return any_of(tokens.begin(), tokens.end(),
-                [&](const AbilityToken &tok) -> bool {
-                  return tok.type == AbilityTokenType::WORD && tok.text == word;
-                });
+static_assert(static_cast<size_t>(Word::COUNT) <= 64, "word mask is a uint64_t");
+
+constexpr auto bit(Word word) -> uint64_t { return uint64_t(1) << static_cast<unsigned>(word); }
+
+struct VocabularyEntry {
+  const char *upper;
+  Word word;
+};
+
+const VocabularyEntry kVocabulary[] = {
+    {"DESTROY", Word::DESTROY},     {"COUNTER", Word::COUNTER},     {"RETURN", Word::RETURN},
+    {"DEAL", Word::DEAL},           {"DEALS", Word::DEALS},         {"DRAW", Word::DRAW},
+    {"GAIN", Word::GAIN},           {"LOSE", Word::LOSE},           {"LOSES", Word::LOSES},
+    {"LIFE", Word::LIFE},           {"SEARCH", Word::SEARCH},       {"LAND", Word::LAND},
+    {"CREATE", Word::CREATE},       {"SACRIFICE", Word::SACRIFICE}, {"SACRIFICES", Word::SACRIFICES},
+    {"EACH", Word::EACH},           {"ALL", Word::ALL},             {"ANY", Word::ANY},
+    {"TARGET", Word::TARGET},       {"OPPONENT", Word::OPPONENT},   {"PLAYER", Word::PLAYER},
+    {"CREATURE", Word::CREATURE},   {"CREATURES", Word::CREATURES},
+    {"PERMANENT", Word::PERMANENT}, {"PERMANENTS", Word::PERMANENTS}, {"SPELL", Word::SPELL},
+    {"ANOTHER", Word::ANOTHER},     {"ARTIFACT", Word::ARTIFACT},   {"ARTIFACTS", Word::ARTIFACTS},
+    {"ENCHANTMENT", Word::ENCHANTMENT}, {"ENCHANTMENTS", Word::ENCHANTMENTS}, {"LANDS", Word::LANDS},
+    {"YOU", Word::YOU},             {"CONTROL", Word::CONTROL},     {"CONTROLS", Word::CONTROLS},
+    {"ENTERS", Word::ENTERS},       {"ENTER", Word::ENTER},         {"ETB", Word::ETB},
+    {"ETBS", Word::ETBS},           {"DIES", Word::DIES},           {"DIE", Word::DIE},
+    {"ATTACKS", Word::ATTACKS},     {"ATTACK", Word::ATTACK},       {"BLOCKS", Word::BLOCKS},
+    {"BLOCK", Word::BLOCK},         {"CASTS", Word::CASTS},         {"CAST", Word::CAST},
+    {"BECOMES", Word::BECOMES},     {"BEGINNING", Word::BEGINNING}, {"END", Word::END},
+};
+
+class VocabularyTrie {
+  // Case-insensitive letter trie; a lookup costs one step per character whatever the vocabulary size
+
+  struct Node {
+    int16_t next[26];
+    Word word = Word::NONE;
+    Node() { fill(begin(next), end(next), int16_t(-1)); }
+  };
+  vector<Node> nodes;
+
+public:
+  VocabularyTrie() {
+    nodes.emplace_back();
+    for (const auto &entry : kVocabulary) {
+      size_t node = 0;
+      for (const char *c = entry.upper; *c != '\0'; c++) {
+        int edge = *c - 'A';
+        if (nodes[node].next[edge] < 0) {
+          nodes[node].next[edge] = static_cast<int16_t>(nodes.size());
+          nodes.emplace_back();
+        }
+        node = static_cast<size_t>(nodes[node].next[edge]);
+      }
+      nodes[node].word = entry.word;
+    }
+  }
+
+  auto lookup(string_view text) const -> Word {
+    size_t node = 0;
+    for (char c : text) {
+      int edge = toupper(static_cast<unsigned char>(c)) - 'A';
+      if (edge < 0 || edge >= 26 || nodes[node].next[edge] < 0) {
+        return Word::NONE;
+      }
+      node = static_cast<size_t>(nodes[node].next[edge]);
+    }
+    return nodes[node].word;
+  }
+};
+
+auto lookupWord(string_view text) -> Word {
+  static const VocabularyTrie trie;
+  return trie.lookup(text);
 }
 
-auto hasWord(const vector<string> &words, const string &word) -> bool {
-  return any_of(
-      words.begin(), words.end(),
-      [&](const string &candidate) -> bool { return candidate == word; });
+// ----------------------------- Rule Tables ----------------------------- //
+
+struct WordRule {
+  // Matches when every word in `all`, (if non-empty) at least one word in `any`, and none of
+  // `none` are present
+  uint64_t all;
+  uint64_t any;
+  uint64_t none = 0;
+
+  auto matches(uint64_t mask) const -> bool {
+    return (mask & all) == all && (any == 0 || (mask & any) != 0) && (mask & none) == 0;
+  }
+};
+
+struct EffectRule {
+  WordRule when;
+  EffectType type;
+  TargetType target;                        // Fixed target, or the fallback when detectTarget is set
+  bool detectTarget;
+  bool usesNumber;
+};
+
+// First match wins, so order is priority. BUFF_PATTERN is expanded by buffEffects().
+const EffectRule kEffectRules[] = {
+    {{bit(Word::DESTROY), bit(Word::ALL) | bit(Word::EACH), bit(Word::TARGET)}, EffectType::DESTROY_ALL, TargetType::NONE,
+     false, false},
+    {{bit(Word::DESTROY), 0}, EffectType::DESTROY, TargetType::CREATURE, true, false},
+    {{0, bit(Word::SACRIFICE) | bit(Word::SACRIFICES)}, EffectType::SACRIFICE, TargetType::CONTROLLER, true, true},
+    {{bit(Word::COUNTER), 0}, EffectType::COUNTERSPELL, TargetType::SPELL, false, false},
+    {{bit(Word::RETURN), 0}, EffectType::BOUNCE, TargetType::PERMANENT, true, false},
+    {{0, bit(Word::DEAL) | bit(Word::DEALS)}, EffectType::DEAL_DAMAGE, TargetType::ANY_TARGET, true, true},
+    {{bit(Word::DRAW), 0}, EffectType::DRAW_CARDS, TargetType::NONE, false, true},
+    {{bit(Word::GAIN) | bit(Word::LIFE), 0}, EffectType::GAIN_LIFE, TargetType::NONE, false, true},
+    {{bit(Word::LIFE), bit(Word::LOSE) | bit(Word::LOSES)}, EffectType::LOSE_LIFE, TargetType::OPPONENT, true, true},
+    {{bit(Word::CREATE), 0}, EffectType::CREATE_TOKEN, TargetType::NONE, false, false},
+    {{bit(Word::BUFF_PATTERN), 0}, EffectType::ADD_COUNTERS, TargetType::CREATURE, false, false},
+    {{bit(Word::SEARCH) | bit(Word::LAND), 0}, EffectType::SEARCH_LAND, TargetType::NONE, false, false},
+};
+
+struct TargetRule {
+  WordRule when;
+  TargetType target;
+};
+
+const TargetRule kTargetRules[] = {
+    {{bit(Word::EACH) | bit(Word::OPPONENT), 0}, TargetType::EACH_OPPONENT},
+    {{bit(Word::ANY) | bit(Word::TARGET), 0}, TargetType::ANY_TARGET},
+    {{bit(Word::TARGET) | bit(Word::CREATURE), 0}, TargetType::CREATURE},
+    {{bit(Word::TARGET) | bit(Word::PLAYER), 0}, TargetType::PLAYER},
+    {{bit(Word::TARGET) | bit(Word::OPPONENT), 0}, TargetType::OPPONENT},
+    {{bit(Word::TARGET) | bit(Word::PERMANENT), 0}, TargetType::PERMANENT},
+    {{bit(Word::TARGET) | bit(Word::SPELL), 0}, TargetType::SPELL},
+    {{bit(Word::OPPONENT), 0}, TargetType::OPPONENT},
+    {{bit(Word::PLAYER), 0}, TargetType::PLAYER},
+    {{bit(Word::CREATURE), 0}, TargetType::CREATURE},
+    {{bit(Word::SPELL), 0}, TargetType::SPELL},
+};
+
+struct ScopeRule {
+  WordRule when;
+  TriggerScope scope;
+};
+
+const ScopeRule kScopeRules[] = {
+    {{bit(Word::ANOTHER) | bit(Word::CREATURE), 0}, TriggerScope::ANOTHER_CREATURE},
+    {{bit(Word::CREATURE) | bit(Word::YOU), bit(Word::CONTROL) | bit(Word::CONTROLS)},
+     TriggerScope::CREATURE_YOU_CONTROL},
+    {{bit(Word::CREATURE) | bit(Word::OPPONENT), 0}, TriggerScope::CREATURE_OPPONENT_CONTROLS},
+    {{bit(Word::CREATURE), 0}, TriggerScope::ANY_CREATURE},
+    {{0, bit(Word::PLAYER) | bit(Word::OPPONENT)}, TriggerScope::ANY_PLAYER},
+};
+
+// ----------------------------- Helpers ----------------------------- //
+
+auto isWord(const AbilityToken &tok, string_view upper) -> bool {
+  return tok.type == AbilityTokenType::WORD && sameWord(tok.text, upper);
 }
 
 auto firstNumber(const vector<AbilityToken> &tokens, int defaultVal = 1)
@@ -134,90 +334,147 @@ auto firstNumber(const vector<AbilityToken> &tokens, int defaultVal = 1)
     if (tok.type == AbilityTokenType::NUMBER) {
       return tok.value;
     }
-    if (tok.type == AbilityTokenType::WORD) {
-      if (all_of(tok.text.begin(), tok.text.end(), [](char digit) -> bool {
-            return isdigit(static_cast<unsigned char>(digit)) != 0;
-          })) {
-        return stoi(tok.text);
+    if (tok.type == AbilityTokenType::WORD && !tok.text.empty() &&
+        all_of(tok.text.begin(), tok.text.end(), isDigit)) {
+      int value = 0;
+      for (char digit : tok.text) {
+        value = value * 10 + (digit - '0');
       }
+      return value;
     }
   }
   return defaultVal;
 }
 
-auto parseBuffWord(const string &word) -> optional<pair<int, int>> {
-  static const regex buffRe(R"(^\+?(-?\d+)\s*/\s*\+?(-?\d+)$)");
-  smatch match;
-  if (regex_match(word, match, buffRe)) {
-    int powerDelta = stoi(match[1]);
-    int toughnessDelta = stoi(match[2]);
-    return make_pair(powerDelta, toughnessDelta);
+auto parseSignedDelta(string_view word, size_t &pos, int &out) -> bool {
+  // [+][-]digits, e.g. "+3", "-1", "2"
+
+  if (pos < word.size() && word[pos] == '+') {
+    pos++;
   }
-  return nullopt;
+  bool negative = false;
+  if (pos < word.size() && word[pos] == '-') {
+    negative = true;
+    pos++;
+  }
+  size_t digitsStart = pos;
+  int value = 0;
+  while (pos < word.size() && isDigit(word[pos])) {
+    value = value * 10 + (word[pos] - '0');
+    pos++;
+  }
+  out = negative ? -value : value;
+  return pos > digitsStart;
 }
 
-auto detectTarget(const vector<string> &words, TargetType fallback)
-    -> TargetType {
-  if (hasWord(words, "EACH") && hasWord(words, "OPPONENT")) {
-    return TargetType::EACH_OPPONENT;
+auto parseBuffWord(string_view word) -> optional<pair<int, int>> {
+  // Hand-coded "+P/+T" matcher (e.g. "+3/+3", "-1/-1", "+2/-0")
+
+  size_t pos = 0;
+  int powerDelta = 0;
+  int toughnessDelta = 0;
+  if (!parseSignedDelta(word, pos, powerDelta)) {
+    return nullopt;
   }
-  if (hasWord(words, "ANY") && hasWord(words, "TARGET")) {
-    return TargetType::ANY_TARGET;
+  if (pos >= word.size() || word[pos] != '/') {
+    return nullopt;
   }
+  pos++;
+  if (!parseSignedDelta(word, pos, toughnessDelta) || pos != word.size()) {
+    return nullopt;
+  }
+  return make_pair(powerDelta, toughnessDelta);
+}
 
-  if (hasWord(words, "TARGET")) {
-    if (hasWord(words, "CREATURE")) {
-      return TargetType::CREATURE;
-    }
-    if (hasWord(words, "PLAYER")) {
-      return TargetType::PLAYER;
-    }
-    if (hasWord(words, "OPPONENT")) {
-      return TargetType::OPPONENT;
-    }
-    if (hasWord(words, "PERMANENT")) {
-      return TargetType::PERMANENT;
-    }
-    if (hasWord(words, "SPELL")) {
-      return TargetType::SPELL;
+auto countWord(const AbilityToken &tok) -> optional<int> {
+  // "a" / "an" / "two" / 3: how many of something
+  static const char *const kCounts[] = {"ONE", "TWO",   "THREE", "FOUR", "FIVE",
+                                        "SIX", "SEVEN", "EIGHT", "NINE", "TEN"};
+
+  if (tok.type == AbilityTokenType::NUMBER) {
+    return tok.value;
+  }
+  if (isWord(tok, "A") || isWord(tok, "AN")) {
+    return 1;
+  }
+  for (int i = 0; i < 10; i++) {
+    if (isWord(tok, kCounts[i])) {
+      return i + 1;
     }
   }
+  return nullopt;
+}
+
+void readTokenPhrase(const vector<AbilityToken> &phrase, Effect &eff) {
+  // "Create two 2/2 black Zombie creature tokens": the count is the word right after CREATE,
+  // the first unsigned "P/T" after it is the tokens' size
 
-  if (hasWord(words, "OPPONENT")) {
-    return TargetType::OPPONENT;
+  eff.value = 1;
+  auto create = find_if(phrase.begin(), phrase.end(), [](const AbilityToken &tok) { return isWord(tok, "CREATE"); });
+  if (create == phrase.end()) {
+    return;
   }
-  if (hasWord(words, "PLAYER")) {
-    return TargetType::PLAYER;
+  if (create + 1 != phrase.end()) {
+    eff.value = countWord(*(create + 1)).value_or(1);
   }
-  if (hasWord(words, "CREATURE")) {
-    return TargetType::CREATURE;
+  for (auto it = create + 1; it != phrase.end(); ++it) {
+    if (it->type != AbilityTokenType::WORD || it->text.empty() || !isDigit(it->text.front())) {
+      continue;
+    }
+    if (auto size = parseBuffWord(it->text)) {
+      eff.tokenPower = size->first;
+      eff.tokenToughness = size->second;
+      return;
+    }
   }
-  if (hasWord(words, "SPELL")) {
-    return TargetType::SPELL;
+}
+
+struct PhraseSummary {
+  uint64_t mask = 0;                        // bit(Word) for every vocabulary word present
+  optional<pair<int, int>> buff;            // First "+P/+T" token, if any
+};
+
+auto summarizePhrase(const vector<AbilityToken> &tokens) -> PhraseSummary {
+  // Single pass over the phrase: vocabulary bits plus the first buff pattern
+
+  PhraseSummary summary;
+  for (const auto &tok : tokens) {
+    if (tok.type != AbilityTokenType::WORD) {
+      continue;
+    }
+    Word word = lookupWord(tok.text);
+    if (word != Word::NONE) {
+      summary.mask |= bit(word);
+      continue;
+    }
+    // Only signed sizes are buffs: an unsigned "2/2" is a token's size
+    bool isSigned = !tok.text.empty() && (tok.text.front() == '+' || tok.text.front() == '-');
+    if (isSigned && !summary.buff.has_value()) {
+      summary.buff = parseBuffWord(tok.text);
+      if (summary.buff.has_value()) {
+        summary.mask |= bit(Word::BUFF_PATTERN);
+      }
+    }
   }
+  return summary;
+}
 
+auto detectTarget(uint64_t mask, TargetType fallback) -> TargetType {
+  for (const auto &rule : kTargetRules) {
+    if (rule.when.matches(mask)) {
+      return rule.target;
+    }
+  }
   return fallback;
 }
 
 auto parseTriggerScope(const vector<AbilityToken> &subjectTokens)
     -> TriggerScope {
-  if (hasWord(subjectTokens, "ANOTHER") && hasWord(subjectTokens, "CREATURE")) {
-    return TriggerScope::ANOTHER_CREATURE;
-  }
-  if (hasWord(subjectTokens, "CREATURE") && hasWord(subjectTokens, "YOU") &&
-      (hasWord(subjectTokens, "CONTROL") ||
-       hasWord(subjectTokens, "CONTROLS"))) {
-    return TriggerScope::CREATURE_YOU_CONTROL;
-  }
-  if (hasWord(subjectTokens, "CREATURE") &&
-      hasWord(subjectTokens, "OPPONENT")) {
-    return TriggerScope::CREATURE_OPPONENT_CONTROLS;
-  }
-  if (hasWord(subjectTokens, "CREATURE")) {
-    return TriggerScope::ANY_CREATURE;
-  }
-  if (hasWord(subjectTokens, "PLAYER") || hasWord(subjectTokens, "OPPONENT")) {
-    return TriggerScope::ANY_PLAYER;
+  uint64_t mask = summarizePhrase(subjectTokens).mask;
+  for (const auto &rule : kScopeRules) {
+    if (rule.when.matches(mask)) {
+      return rule.scope;
+    }
   }
   return TriggerScope::SELF;
 }
@@ -228,78 +485,78 @@ auto eventFromToken(const AbilityToken &token, AbilityTokenizer &tok)
     return nullopt;
   }
 
-  const string &word = token.text;
-  if (word == "ENTERS" || word == "ENTER" || word == "ETB" || word == "ETBS") {
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        tok.peek().text == "BATTLEFIELD") {
+  switch (lookupWord(token.text)) {
+  case Word::ENTERS:
+  case Word::ENTER:
+  case Word::ETB:
+  case Word::ETBS:
+    if (tok.peekWord("BATTLEFIELD")) {
       tok.next();
     }
     return TriggerEvent::ENTERS_BATTLEFIELD;
-  }
-  if (word == "DIES" || word == "DIE") {
+
+  case Word::DIES:
+  case Word::DIE:
     return TriggerEvent::DIES;
-  }
-  if (word == "ATTACKS" || word == "ATTACK") {
+
+  case Word::ATTACKS:
+  case Word::ATTACK:
     return TriggerEvent::ATTACKS;
-  }
-  if (word == "BLOCKS" || word == "BLOCK") {
+
+  case Word::BLOCKS:
+  case Word::BLOCK:
     return TriggerEvent::BLOCKS;
-  }
-  if (word == "CASTS" || word == "CAST") {
+
+  case Word::CASTS:
+  case Word::CAST:
     return TriggerEvent::SPELL_CAST;
-  }
 
-  if (word == "DEALS") {
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        tok.peek().text == "COMBAT") {
+  case Word::DEALS:
+    if (tok.peekWord("COMBAT")) {
       tok.next();
-      if (tok.peek().type == AbilityTokenType::WORD &&
-          tok.peek().text == "DAMAGE") {
+      if (tok.peekWord("DAMAGE")) {
         tok.next();
       }
       return TriggerEvent::DEALS_COMBAT_DAMAGE;
     }
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        tok.peek().text == "DAMAGE") {
+    if (tok.peekWord("DAMAGE")) {
       tok.next();
     }
     return TriggerEvent::DEALS_DAMAGE;
-  }
 
-  if (word == "BECOMES") {
-    if (tok.peek().type == AbilityTokenType::WORD && tok.peek().text == "THE") {
+  case Word::BECOMES:
+    if (tok.peekWord("THE")) {
       tok.next();
     }
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        tok.peek().text == "TARGET") {
+    if (tok.peekWord("TARGET")) {
       tok.next();
       return TriggerEvent::BECOMES_TARGET;
     }
-  }
+    return nullopt;
 
-  if (word == "BEGINNING") {
-    if (tok.peek().type == AbilityTokenType::WORD && tok.peek().text == "OF") {
+  case Word::BEGINNING:
+    if (tok.peekWord("OF")) {
       tok.next();
     }
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        tok.peek().text == "UPKEEP") {
+    if (tok.peekWord("UPKEEP")) {
       tok.next();
       return TriggerEvent::BEGINNING_OF_UPKEEP;
     }
-  }
+    return nullopt;
 
-  if (word == "END") {
-    if (tok.peek().type == AbilityTokenType::WORD && tok.peek().text == "OF") {
+  case Word::END:
+    if (tok.peekWord("OF")) {
       tok.next();
     }
-    if (tok.peek().type == AbilityTokenType::WORD &&
-        (tok.peek().text == "TURN" || tok.peek().text == "STEP")) {
+    if (tok.peekWord("TURN") || tok.peekWord("STEP")) {
       tok.next();
       return TriggerEvent::END_OF_TURN;
     }
-  }
+    return nullopt;
 
-  return nullopt;
+  default:
+    return nullopt;
+  }
 }
 
 auto parseTriggerClause(AbilityTokenizer &tok) -> optional<TriggerCondition> {
@@ -327,200 +584,115 @@ auto parseTriggerClause(AbilityTokenizer &tok) -> optional<TriggerCondition> {
   return cond;
 }
 
-auto extractWords(const vector<AbilityToken> &phrase) -> vector<string> {
-  vector<string> words;
-  for (const auto &tok : phrase) {
-    if (tok.type == AbilityTokenType::WORD) {
-      words.push_back(tok.text);
+void buffEffects(pair<int, int> buff, vector<Effect> &out) {
+  // Symmetric buffs become counters; anything else splits into power/toughness changes
+
+  auto [powerDelta, toughnessDelta] = buff;
+
+  if (powerDelta == toughnessDelta) {
+    Effect eff;
+    if (powerDelta >= 0) {
+      eff.type = EffectType::ADD_COUNTERS;
+      eff.value = powerDelta;
+    } else {
+      eff.type = EffectType::REMOVE_COUNTERS;
+      eff.value = -powerDelta;
     }
+    eff.target = TargetType::CREATURE;
+    out.push_back(eff);
+    return;
   }
-  return words;
-}
 
-auto maybeDestroyEffect(const vector<string> &words) -> optional<Effect> {
-  if (!hasWord(words, "DESTROY")) {
-    return nullopt;
+  if (powerDelta != 0) {
+    Effect powerEff;
+    powerEff.type = EffectType::CHANGE_POWER;
+    powerEff.value = powerDelta;
+    powerEff.target = TargetType::CREATURE;
+    out.push_back(powerEff);
   }
-  Effect eff;
-  eff.type = EffectType::DESTROY;
-  eff.target = detectTarget(words, TargetType::CREATURE);
-  return eff;
-}
-
-auto maybeCounterEffect(const vector<string> &words) -> optional<Effect> {
-  if (!hasWord(words, "COUNTER")) {
-    return nullopt;
+  if (toughnessDelta != 0) {
+    Effect toughEff;
+    toughEff.type = EffectType::CHANGE_TOUGHNESS;
+    toughEff.value = toughnessDelta;
+    toughEff.target = TargetType::CREATURE;
+    out.push_back(toughEff);
   }
-  Effect eff;
-  eff.type = EffectType::COUNTERSPELL;
-  eff.target = TargetType::SPELL;
-  return eff;
 }
 
-auto maybeBounceEffect(const vector<string> &words) -> optional<Effect> {
-  if (!hasWord(words, "RETURN")) {
-    return nullopt;
+auto readWipeNoun(uint64_t mask, Effect &eff) -> bool {
+  // "Destroy all creatures / permanents / artifacts / artifact creatures": creatures or everything,
+  // optionally narrowed to one card type. False when the phrase names nothing we know.
+
+  struct TypeNoun {
+    uint64_t words;
+    const char *type;
+  };
+  static const TypeNoun kTypeNouns[] = {
+      {bit(Word::ARTIFACT) | bit(Word::ARTIFACTS), "ARTIFACT"},
+      {bit(Word::ENCHANTMENT) | bit(Word::ENCHANTMENTS), "ENCHANTMENT"},
+      {bit(Word::LAND) | bit(Word::LANDS), "LAND"},
+  };
+
+  for (const auto &noun : kTypeNouns) {
+    if ((mask & noun.words) != 0) {
+      eff.cardType = noun.type;
+      break;
+    }
   }
-  Effect eff;
-  eff.type = EffectType::BOUNCE;
-  eff.target = detectTarget(words, TargetType::PERMANENT);
-  return eff;
-}
-
-auto maybeDamageEffect(const vector<string> &words, int num)
-    -> optional<Effect> {
-  if (!hasWord(words, "DEAL") && !hasWord(words, "DEALS")) {
-    return nullopt;
+  if ((mask & (bit(Word::CREATURE) | bit(Word::CREATURES))) != 0) {
+    eff.target = TargetType::CREATURE;
+    return true;
   }
-  Effect eff;
-  eff.type = EffectType::DEAL_DAMAGE;
-  eff.value = num;
-  eff.target = detectTarget(words, TargetType::ANY_TARGET);
-  return eff;
-}
-
-auto maybeDrawEffect(const vector<string> &words, int num)
-    -> optional<Effect> {
-  if (!hasWord(words, "DRAW")) {
-    return nullopt;
+  if ((mask & (bit(Word::PERMANENT) | bit(Word::PERMANENTS))) != 0 || !eff.cardType.empty()) {
+    eff.target = TargetType::PERMANENT;
+    return true;
   }
-  Effect eff;
-  eff.type = EffectType::DRAW_CARDS;
-  eff.value = num;
-  eff.target = TargetType::NONE;
-  return eff;
+  return false;
 }
 
-auto maybeGainLifeEffect(const vector<string> &words, int num)
-    -> optional<Effect> {
-  if (!hasWord(words, "GAIN") || !hasWord(words, "LIFE")) {
-    return nullopt;
-  }
-  Effect eff;
-  eff.type = EffectType::GAIN_LIFE;
-  eff.value = num;
-  eff.target = TargetType::NONE;
-  return eff;
-}
+void parseEffectPhrase(const vector<AbilityToken> &phrase, vector<Effect> &out) {
+  // Append the effects of one phrase (first matching rule wins)
 
-auto maybeLoseLifeEffect(const vector<string> &words, int num)
-    -> optional<Effect> {
-  if ((!hasWord(words, "LOSE") && !hasWord(words, "LOSES")) ||
-      !hasWord(words, "LIFE")) {
-    return nullopt;
+  PhraseSummary summary = summarizePhrase(phrase);
+  if (summary.mask == 0) {
+    return;
   }
-  Effect eff;
-  eff.type = EffectType::LOSE_LIFE;
-  eff.value = num;
-  eff.target = detectTarget(words, TargetType::OPPONENT);
-  return eff;
-}
 
-auto maybeBuffEffects(const vector<string> &words)
-    -> optional<vector<Effect>> {
-  for (const auto &word : words) {
-    auto buff = parseBuffWord(word);
-    if (!buff.has_value()) {
+  for (const auto &rule : kEffectRules) {
+    if (!rule.when.matches(summary.mask)) {
       continue;
     }
-
-    int powerDelta = buff->first;
-    int toughnessDelta = buff->second;
-
-    if (powerDelta == toughnessDelta) {
-      Effect eff;
-      if (powerDelta >= 0) {
-        eff.type = EffectType::ADD_COUNTERS;
-        eff.value = powerDelta;
-      } else {
-        eff.type = EffectType::REMOVE_COUNTERS;
-        eff.value = -powerDelta;
-      }
-      eff.target = TargetType::CREATURE;
-      return vector<Effect>{eff};
+    if (rule.when.all == bit(Word::BUFF_PATTERN)) {
+      buffEffects(*summary.buff, out);
+      return;
     }
 
-    Effect powerEff;
-    powerEff.type = EffectType::CHANGE_POWER;
-    powerEff.value = powerDelta;
-    powerEff.target = TargetType::CREATURE;
-
-    Effect toughEff;
-    toughEff.type = EffectType::CHANGE_TOUGHNESS;
-    toughEff.value = toughnessDelta;
-    toughEff.target = TargetType::CREATURE;
-
-    vector<Effect> out;
-    if (powerEff.value != 0) {
-      out.push_back(powerEff);
+    Effect eff;
+    eff.type = rule.type;
+    eff.value = rule.usesNumber ? firstNumber(phrase, 1) : 0;
+    eff.target = rule.detectTarget ? detectTarget(summary.mask, rule.target) : rule.target;
+    if (rule.type == EffectType::CREATE_TOKEN) {
+      readTokenPhrase(phrase, eff);
     }
-    if (toughEff.value != 0) {
-      out.push_back(toughEff);
+    if (rule.type == EffectType::DESTROY_ALL && !readWipeNoun(summary.mask, eff)) {
+      return;
     }
-    return out;
-  }
-  return nullopt;
-}
-
-auto maybeSearchLandEffect(const vector<string> &words)
-    -> optional<Effect> {
-  if (!hasWord(words, "SEARCH") || !hasWord(words, "LAND")) {
-    return nullopt;
+    out.push_back(eff);
+    return;
   }
-  Effect eff;
-  eff.type = EffectType::SEARCH_LAND;
-  eff.target = TargetType::NONE;
-  return eff;
 }
 
-auto parseEffectPhrase(const vector<AbilityToken> &phrase) -> vector<Effect> {
-  vector<string> words = extractWords(phrase);
-  if (words.empty()) {
-    return {};
-  }
-
-  int num = firstNumber(phrase, 1);
+void collectEffectPhrase(AbilityTokenizer &tok, vector<AbilityToken> &phrase) {
+  // Fill phrase with the tokens up to the next comma / "and" (phrase is reused by the caller)
 
-  if (auto eff = maybeDestroyEffect(words)) {
-    return {*eff};
-  }
-  if (auto eff = maybeCounterEffect(words)) {
-    return {*eff};
-  }
-  if (auto eff = maybeBounceEffect(words)) {
-    return {*eff};
-  }
-  if (auto eff = maybeDamageEffect(words, num)) {
-    return {*eff};
-  }
-  if (auto eff = maybeDrawEffect(words, num)) {
-    return {*eff};
-  }
-  if (auto eff = maybeGainLifeEffect(words, num)) {
-    return {*eff};
-  }
-  if (auto eff = maybeLoseLifeEffect(words, num)) {
-    return {*eff};
-  }
-  if (auto buffEffects = maybeBuffEffects(words)) {
-    return *buffEffects;
-  }
-  if (auto eff = maybeSearchLandEffect(words)) {
-    return {*eff};
-  }
-
-  return {};
-}
-
-auto collectEffectPhrase(AbilityTokenizer &tok) -> vector<AbilityToken> {
-  vector<AbilityToken> phrase;
+  phrase.clear();
   AbilityToken start = tok.peek();
   while (start.type == AbilityTokenType::COMMA) {
     tok.next();
     start = tok.peek();
   }
   if (start.type == AbilityTokenType::END) {
-    return phrase;
+    return;
   }
 
   phrase.push_back(tok.next());
@@ -529,13 +701,12 @@ auto collectEffectPhrase(AbilityTokenizer &tok) -> vector<AbilityToken> {
       tok.next();
       break;
     }
-    if (tok.peek().type == AbilityTokenType::WORD && tok.peek().text == "AND") {
+    if (tok.peekWord("AND")) {
       tok.next();
       break;
     }
     phrase.push_back(tok.next());
   }
-  return phrase;
 }
 
 }
@@ -543,35 +714,29 @@ auto collectEffectPhrase(AbilityTokenizer &tok) -> vector<AbilityToken> {
 // ----------------------------- Entry Point ----------------------------- //
 
 auto parseAbilityText(const string &text) -> AbilityParseResult {
+  MemPhaseScope phase(MemPhase::ABILITY_PARSE);
   AbilityParseResult result;
 
-  string lowerText = text;
-  transform(lowerText.begin(), lowerText.end(), lowerText.begin(),
-            [](unsigned char lowerChar) -> char {
-              return static_cast<char>(tolower(lowerChar));
-            });
-  if (lowerText.find("may") != string::npos) {
+  if (containsNoCase(text, "may")) {
     result.isMay = true;
   }
 
   AbilityTokenizer tok(text);
   AbilityToken first = tok.peek();
-  if (first.type == AbilityTokenType::WORD &&
-      (first.text == "WHEN" || first.text == "WHENEVER" ||
-       first.text == "AT")) {
+  if (isWord(first, "WHEN") || isWord(first, "WHENEVER") || isWord(first, "AT")) {
     result.trigger = parseTriggerClause(tok);
     if (tok.peek().type == AbilityTokenType::COMMA) {
       tok.next();
     }
   }
 
+  vector<AbilityToken> phrase;
   while (tok.peek().type != AbilityTokenType::END) {
-    vector<AbilityToken> phrase = collectEffectPhrase(tok);
+    collectEffectPhrase(tok, phrase);
     if (phrase.empty()) {
       break;
     }
-    auto effs = parseEffectPhrase(phrase);
-    result.effects.insert(result.effects.end(), effs.begin(), effs.end());
+    parseEffectPhrase(phrase, result.effects);
   }
 
   return result;
@@ -0,0 +1,412 @@
+#include "batch.h"
+#include "card_database.h"
+#include "json_writer.h"
+#include "parser.h"
+#include "result_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <new>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+
+auto readScenario(const string &path, string &contents) -> bool {
+  ifstream file(path, ios::binary);
+  if (!file) {
+    return false;
+  }
+  stringstream buf;
+  buf << file.rdbuf();
+  contents = buf.str();
+  return true;
+}
+
+void printText(ostream &out, const string &file, const CachedRun &run) {
+  // One line: how it stopped, life totals in player order, what was destroyed
+
+  const Output &result = run.output;
+  out << file << ": " << stopReasonName(result.stopReason) << ", " << result.steps.size() << " step(s);";
+
+  vector<pair<PlayerID, int>> lives(result.finalLife.begin(), result.finalLife.end());
+  sort(lives.begin(), lives.end());
+  for (size_t i = 0; i < lives.size(); i++) {
+    out << (i > 0 ? ", " : " ") << lives[i].first << ' ' << lives[i].second << " life";
+  }
+  out << "; " << result.destroyedPermanents.size() << " destroyed";
+  if (!result.errors.empty()) {
+    out << "; " << result.errors.size() << " error(s)";
+  }
+  out << (run.hit ? " [cached]" : "") << '\n';
+}
+
+void printJson(ostream &out, const string &file, const CachedRun &run) {
+  JsonWriter json;
+  json.beginObject();
+  json.key("file");
+  json.value(file);
+  json.key("cached");
+  json.value(run.hit);
+  json.key("output");
+  writeOutputObject(json, run.output);
+  json.endObject();
+  out << json.str() << '\n';
+}
+
+void printFailure(ostream &out, const string &file, const string &message, bool asJson) {
+  if (!asJson) {
+    out << file << ": error: " << message << '\n';
+    return;
+  }
+  JsonWriter json;
+  json.beginObject();
+  json.key("file");
+  json.value(file);
+  json.key("error");
+  json.value(message);
+  json.endObject();
+  out << json.str() << '\n';
+}
+
+void printSummary(ostream &out, const BatchSummary &summary, bool asJson) {
+  if (!asJson) {
+    out << fixed << setprecision(1) << "BATCH: " << summary.files << " file(s), " << summary.failed
+        << " failed, " << summary.cacheHits << " cache hit(s), " << summary.cacheMisses << " miss(es) in "
+        << summary.elapsedMs << " ms\n";
+    return;
+  }
+  JsonWriter json;
+  json.beginObject();
+  json.key("files");
+  json.value(summary.files);
+  json.key("failed");
+  json.value(summary.failed);
+  json.key("cacheHits");
+  json.value(static_cast<int>(summary.cacheHits));
+  json.key("cacheMisses");
+  json.value(static_cast<int>(summary.cacheMisses));
+  json.key("elapsedMs");
+  json.value(static_cast<int>(summary.elapsedMs));
+  json.endObject();
+  out << json.str() << '\n';
+}
+
+// ----------------------------- One File ----------------------------- //
+
+struct FileResult {
+  bool failed = false;
+  string text;                              // The file's line(s), ready to print
+};
+
+class BatchWorker {
+  // Resolves files one at a time against its own cache (one per process when sharded)
+
+  const BatchOptions &options;
+  Context &context;
+  OutputCache cache;
+  shared_ptr<const CardDatabase> cardPool;
+  bool carryPool;                           // Cardless files take the previous file's pool
+
+public:
+  BatchWorker(const BatchOptions &options, Context &context)
+      : options(options), context(context), cache(options.cacheSize), cardPool(options.cards),
+        carryPool(!options.cards && options.workers <= 1) {}
+
+  auto resolve(const string &file) -> FileResult {
+    // A file that throws fails on its own; the rest of the batch carries on
+
+    try {
+      return resolveFile(file);
+    } catch (const exception &e) {
+      ostringstream text;
+      printFailure(text, file, e.what(), options.json);
+      return {true, text.str()};
+    }
+  }
+
+  auto resolveFile(const string &file) -> FileResult {
+    FileResult result;
+    ostringstream text;
+    context.filename = file;
+
+    string contents;
+    if (!readScenario(file, contents)) {
+      result.failed = true;
+      printFailure(text, file, "could not read " + file, options.json);
+      result.text = text.str();
+      return result;
+    }
+
+    int errorsBefore = context.syntaxErrors;
+    Parser parser(std::move(contents), context, options.lazyCards);
+    GameInput input = parser.parse();
+    if (context.syntaxErrors != errorsBefore) {
+      result.failed = true;
+      printFailure(text, file, "syntax error in game input (details on stderr)", options.json);
+      result.text = text.str();
+      return result;
+    }
+
+    // A scenario without cards uses the shared pool (or, in one process, the one we already have)
+    if (cardPool && input.cards->parsedCount() == 0 && input.cards->deferredCount() == 0) {
+      input.cards = cardPool;
+    }
+    if (carryPool) {
+      cardPool = input.cards;
+    }
+
+    RunOptions budgets = options.run;
+    if (options.timeoutMs > 0) {
+      budgets.deadline = chrono::steady_clock::now() + chrono::milliseconds(options.timeoutMs);
+    }
+    CachedRun run = resolveCached(input, context, budgets, cache);
+
+    // Cards a lazy parse skipped are parsed during the run; their syntax errors fail the file
+    vector<string> deferredErrors = input.cards->deferredErrors(run.deferredCards);
+    if (!deferredErrors.empty()) {
+      for (const auto &error : deferredErrors) {
+        *context.diagnostics << error << '\n';
+        context.syntaxErrors++;
+      }
+      result.failed = true;
+      printFailure(text, file, "syntax error in a deferred card (details on stderr)", options.json);
+      result.text = text.str();
+      return result;
+    }
+
+    if (options.json) {
+      printJson(text, file, run);
+    } else {
+      printText(text, file, run);
+    }
+    result.text = text.str();
+    return result;
+  }
+
+  auto cacheHits() const -> size_t { return cache.hits(); }
+  auto cacheMisses() const -> size_t { return cache.misses(); }
+};
+
+// ----------------------------- Worker Processes ----------------------------- //
+
+struct RecordHeader {
+  // One result on a worker's pipe; kStatsRecord carries the worker's cache counters instead
+  uint32_t index = 0;
+  uint32_t failed = 0;
+  uint64_t length = 0;
+};
+
+constexpr uint32_t kStatsRecord = UINT32_MAX;
+
+void writeAll(int fd, const void *data, size_t size) {
+  const char *bytes = static_cast<const char *>(data);
+  while (size > 0) {
+    ssize_t written = write(fd, bytes, size);
+    if (written < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      _exit(2);
+    }
+    bytes += written;
+    size -= static_cast<size_t>(written);
+  }
+}
+
+void writeRecord(int fd, uint32_t index, bool failed, const string &payload) {
+  RecordHeader header;
+  header.index = index;
+  header.failed = failed ? 1 : 0;
+  header.length = payload.size();
+  writeAll(fd, &header, sizeof(header));
+  writeAll(fd, payload.data(), payload.size());
+}
+
+[[noreturn]] void runWorker(const vector<string> &files, const BatchOptions &options, Context &context,
+                            atomic<size_t> &cursor, int fd) {
+  // Claim the next unstarted file until none are left, then report cache counters and leave
+
+  BatchWorker worker(options, context);
+  for (;;) {
+    size_t index = cursor.fetch_add(1, memory_order_relaxed);
+    if (index >= files.size()) {
+      break;
+    }
+    FileResult result = worker.resolve(files[index]);
+    writeRecord(fd, static_cast<uint32_t>(index), result.failed, result.text);
+  }
+
+  uint64_t counters[2] = {worker.cacheHits(), worker.cacheMisses()};
+  writeRecord(fd, kStatsRecord, false, string(reinterpret_cast<const char *>(counters), sizeof(counters)));
+  close(fd);
+
+  // Skip static destructors and stdio flushing: those belong to the parent
+  _exit(0);
+}
+
+void runSharded(const vector<string> &files, const BatchOptions &options, Context &context, ostream &out,
+                BatchSummary &summary) {
+  // fork() after the card pool is parsed: every worker reads the parent's pages copy-on-write, and
+  // the pool is never written again, so they stay shared. Workers pull files off one shared cursor
+  // (a busy worker never holds up the rest) and the parent prints results back in file order.
+
+  void *shared = mmap(nullptr, sizeof(atomic<size_t>), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    throw runtime_error("batch: could not map the shared work queue");
+  }
+  auto *cursor = new (shared) atomic<size_t>(0);
+
+  out.flush();
+  int workerCount = static_cast<int>(min(files.size(), static_cast<size_t>(options.workers)));
+  vector<pid_t> workers;
+  vector<pollfd> pipes;
+  for (int i = 0; i < workerCount; i++) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+      break;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+      close(fds[0]);
+      close(fds[1]);
+      break;
+    }
+    if (pid == 0) {
+      close(fds[0]);
+      for (const auto &earlier : pipes) {
+        close(earlier.fd);
+      }
+      runWorker(files, options, context, *cursor, fds[1]);
+    }
+    close(fds[1]);
+    workers.push_back(pid);
+    pipes.push_back({fds[0], POLLIN, 0});
+  }
+  if (workers.empty()) {
+    munmap(shared, sizeof(atomic<size_t>));
+    throw runtime_error("batch: could not start any worker process");
+  }
+
+  // Collect records as they arrive; print each file once everything before it is in
+  vector<optional<FileResult>> results(files.size());
+  vector<string> buffers(pipes.size());
+  size_t nextToPrint = 0;
+  size_t open = pipes.size();
+  char chunk[65536];
+
+  auto takeRecords = [&](string &buffer) {
+    size_t used = 0;
+    while (buffer.size() - used >= sizeof(RecordHeader)) {
+      RecordHeader header;
+      memcpy(&header, buffer.data() + used, sizeof(header));
+      if (buffer.size() - used - sizeof(header) < header.length) {
+        break;
+      }
+      string payload = buffer.substr(used + sizeof(header), header.length);
+      used += sizeof(header) + header.length;
+
+      if (header.index == kStatsRecord) {
+        uint64_t counters[2] = {0, 0};
+        memcpy(counters, payload.data(), min(payload.size(), sizeof(counters)));
+        summary.cacheHits += counters[0];
+        summary.cacheMisses += counters[1];
+      } else if (header.index < results.size()) {
+        results[header.index] = FileResult{header.failed != 0, std::move(payload)};
+      }
+    }
+    buffer.erase(0, used);
+  };
+
+  auto printReady = [&]() {
+    while (nextToPrint < results.size() && results[nextToPrint]) {
+      summary.failed += results[nextToPrint]->failed ? 1 : 0;
+      out << results[nextToPrint]->text;
+      results[nextToPrint].reset();
+      nextToPrint++;
+    }
+    out.flush();
+  };
+
+  while (open > 0) {
+    if (poll(pipes.data(), pipes.size(), -1) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    for (size_t i = 0; i < pipes.size(); i++) {
+      if (pipes[i].fd < 0 || (pipes[i].revents & (POLLIN | POLLHUP | POLLERR)) == 0) {
+        continue;
+      }
+      ssize_t got = read(pipes[i].fd, chunk, sizeof(chunk));
+      if (got < 0 && errno == EINTR) {
+        continue;
+      }
+      if (got <= 0) {
+        close(pipes[i].fd);
+        pipes[i].fd = -1;
+        open--;
+        continue;
+      }
+      buffers[i].append(chunk, static_cast<size_t>(got));
+      takeRecords(buffers[i]);
+    }
+    printReady();
+  }
+
+  for (pid_t pid : workers) {
+    waitpid(pid, nullptr, 0);
+  }
+  munmap(shared, sizeof(atomic<size_t>));
+
+  // Files a crashed worker had claimed but never reported
+  for (size_t i = nextToPrint; i < results.size(); i++) {
+    if (!results[i]) {
+      ostringstream text;
+      printFailure(text, files[i], "worker process exited before finishing this file", options.json);
+      results[i] = FileResult{true, text.str()};
+    }
+  }
+  printReady();
+}
+
+}
+
+auto runBatch(const vector<string> &files, const BatchOptions &options, Context &context, ostream &out)
+    -> BatchSummary {
+  auto start = chrono::steady_clock::now();
+  BatchSummary summary;
+  summary.files = static_cast<int>(files.size());
+
+  if (options.workers > 1 && files.size() > 1) {
+    runSharded(files, options, context, out, summary);
+  } else {
+    BatchWorker worker(options, context);
+    for (const auto &file : files) {
+      FileResult result = worker.resolve(file);
+      summary.failed += result.failed ? 1 : 0;
+      out << result.text;
+    }
+    summary.cacheHits = worker.cacheHits();
+    summary.cacheMisses = worker.cacheMisses();
+  }
+
+  summary.elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  printSummary(out, summary, options.json);
+  return summary;
+}
@@ -0,0 +1,58 @@
+/*
+  Batch mode (--batch a.json b.json ...): resolve many scenario files in one process, in order,
+  one result per file. Resolutions go through an OutputCache (see result_cache.h), so a scenario
+  that repeats an earlier one up to id renaming is answered without running the engine. As in
+  session mode, a file without "cards" keeps the card pool of the file before it (unless --cards
+  or --workers is given, below).
+
+    text   a.json: COMPLETED, 4 step(s); p1 20 life, p2 14 life; 2 destroyed [cached]
+    json   {"file":"a.json","cached":true,"output":{...}} per line ({"file":...,"error":...} on failure)
+
+  Either format ends with one summary line (files, failures, cache hits and misses, time).
+
+  With --workers N the files are sharded over N forked processes instead of threads (nothing in the
+  engine has to be thread-safe). --cards pool.json is parsed once, in full, before the fork, so the
+  workers share its pages copy-on-write and RSS stays near one copy of the pool however many run;
+  cardless files then use that pool. Workers claim files one at a time from a cursor in shared
+  memory, so a slow scenario doesn't hold up the rest of its shard, and the parent prints the
+  results in file order as they become available. Each worker has its own cache.
+*/
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "card_database.h"
+#include "context.h"
+#include "engine.h"
+
+#include <cstddef>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct BatchOptions {
+  size_t cacheSize = 1024;                  // Outputs the LRU keeps (0 turns the cache off)
+  int workers = 1;                          // Processes (1: resolve in this one)
+  shared_ptr<const CardDatabase> cards;     // Pool for files without "cards" (--cards)
+  bool lazyCards = false;
+  bool json = false;                        // JSON Lines instead of the text summary
+  RunOptions run;                           // Budgets for every file
+  int timeoutMs = 0;                        // Per file, counted from that file's run (0: none)
+};
+
+struct BatchSummary {
+  int files = 0;
+  int failed = 0;                           // Unreadable, with syntax errors, or the run threw
+  size_t cacheHits = 0;
+  size_t cacheMisses = 0;
+  double elapsedMs = 0;
+};
+
+// Resolve every file, printing results in file order as they finish
+auto runBatch(const vector<string> &files, const BatchOptions &options, Context &context, ostream &out)
+    -> BatchSummary;
+
+#endif
@@ -0,0 +1,98 @@
+#include "card_database.h"
+#include "parser.h"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace std;
+
+auto keywordMask(const vector<string> &keywords) -> KeywordSet {
+  static const unordered_map<string, Keyword> names = {
+      {"INDESTRUCTIBLE", Keyword::INDESTRUCTIBLE}, {"DEATHTOUCH", Keyword::DEATHTOUCH},
+      {"HEXPROOF", Keyword::HEXPROOF},             {"SHROUD", Keyword::SHROUD},
+      {"FLYING", Keyword::FLYING},                 {"REACH", Keyword::REACH},
+      {"TRAMPLE", Keyword::TRAMPLE},               {"LIFELINK", Keyword::LIFELINK},
+      {"HASTE", Keyword::HASTE},                   {"VIGILANCE", Keyword::VIGILANCE},
+      {"DEFENDER", Keyword::DEFENDER},             {"MENACE", Keyword::MENACE},
+      {"FIRST_STRIKE", Keyword::FIRST_STRIKE},     {"DOUBLE_STRIKE", Keyword::DOUBLE_STRIKE},
+  };
+
+  KeywordSet mask = 0;
+  string normalized;
+  for (const auto &keyword : keywords) {
+    normalized.clear();
+    for (char c : keyword) {
+      normalized.push_back(c == ' ' ? '_' : static_cast<char>(toupper(static_cast<unsigned char>(c))));
+    }
+    auto it = names.find(normalized);
+    if (it != names.end()) {
+      mask |= static_cast<uint32_t>(it->second);
+    }
+  }
+  return mask;
+}
+
+CardDatabase::CardDatabase(unordered_map<string, CardDef> parsed, DeferredCards deferredCards)
+    : cards(std::move(parsed)), deferred(std::move(deferredCards)) {}
+
+auto CardDatabase::find(const string &name, unordered_set<string> *lookedUp) const -> const CardDef * {
+  // Eager cards need no lock; only the lazy cache is shared mutable state
+
+  auto it = cards.find(name);
+  if (it != cards.end()) {
+    return &it->second;
+  }
+  if (deferred.spans.count(name) == 0) {
+    return nullptr;
+  }
+  if (lookedUp != nullptr) {
+    lookedUp->insert(name);
+  }
+
+  lock_guard<mutex> lock(lazyMutex);
+  auto cached = lazyParsed.find(name);
+  if (cached == lazyParsed.end()) {
+    // Parse once; a failure is cached too, so its errors stay attached to the card
+    LazyEntry entry;
+    string errors;
+    entry.card = Parser::parseDeferredCard(deferred, name, errors);
+    size_t start = 0;
+    while (start < errors.size()) {
+      size_t end = errors.find('\n', start);
+      end = (end == string::npos) ? errors.size() : end;
+      entry.errors.push_back(errors.substr(start, end - start));
+      start = end + 1;
+    }
+    cached = lazyParsed.emplace(name, std::move(entry)).first;
+  }
+  return cached->second.card ? &*cached->second.card : nullptr;
+}
+
+auto CardDatabase::deferredErrors(const unordered_set<string> &names) const -> vector<string> {
+  // Sorted by name so the report doesn't depend on lookup order
+
+  vector<string> sorted(names.begin(), names.end());
+  sort(sorted.begin(), sorted.end());
+
+  lock_guard<mutex> lock(lazyMutex);
+  vector<string> errors;
+  for (const auto &name : sorted) {
+    auto it = lazyParsed.find(name);
+    if (it != lazyParsed.end()) {
+      errors.insert(errors.end(), it->second.errors.begin(), it->second.errors.end());
+    }
+  }
+  return errors;
+}
+
+auto CardDatabase::names() const -> vector<string> {
+  vector<string> out;
+  out.reserve(cards.size() + deferred.spans.size());
+  for (const auto &[name, card] : cards) {
+    out.push_back(name);
+  }
+  for (const auto &[name, span] : deferred.spans) {
+    out.push_back(name);
+  }
+  return out;
+}
@@ -0,0 +1,58 @@
+/*
+  The card pool, split out of GameInput so it can be parsed once and shared. It's immutable after
+  construction apart from the lazy cache (deferred cards parsed on first lookup, under a mutex), so
+  any number of engines on any number of threads can borrow the same shared_ptr.
+*/
+
+#ifndef CARD_DATABASE_H
+#define CARD_DATABASE_H
+
+#include "types.h"
+
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+// Bits for the keyword names we know (case and '_' vs ' ' don't matter); others are ignored
+auto keywordMask(const vector<string> &keywords) -> KeywordSet;
+
+class CardDatabase {
+  unordered_map<string, CardDef> cards;     // Parsed up front
+  DeferredCards deferred;                   // Skipped by a lazy parse (--lazy-cards)
+
+  // A deferred card's one parse: the card if it parsed, and its syntax errors either way
+  struct LazyEntry {
+    optional<CardDef> card;
+    vector<string> errors;                  // "file:line message"
+  };
+
+  mutable mutex lazyMutex;
+  mutable unordered_map<string, LazyEntry> lazyParsed;  // Node-based, so pointers stay valid
+
+public:
+  CardDatabase() = default;
+  explicit CardDatabase(unordered_map<string, CardDef> parsed, DeferredCards deferredCards = {});
+
+  // Card by name, parsing a deferred one on first use (nullptr if unknown or if it didn't parse).
+  // Deferred names go into *lookedUp, so a run can report the errors of the cards it used.
+  auto find(const string &name, unordered_set<string> *lookedUp = nullptr) const -> const CardDef *;
+
+  // Parsed up front / still waiting to be parsed
+  auto parsedCount() const -> size_t { return cards.size(); }
+  auto deferredCount() const -> size_t { return deferred.spans.size(); }
+
+  // Every card name, parsed or deferred (for serialisers that need the whole pool)
+  auto names() const -> vector<string>;
+
+  // Syntax errors of the named deferred cards' parses, by card name (eager and not yet parsed cards
+  // have none). The same names always give the same list, whoever else shares the pool.
+  auto deferredErrors(const unordered_set<string> &names) const -> vector<string>;
+};
+
+#endif
@@ -0,0 +1,119 @@
+#include "combat.h"
+
+#include <algorithm>
+
+using namespace std;
+
+namespace {
+
+auto strikesIn(KeywordSet keywords, CombatPass pass) -> bool {
+  bool first = hasKeywordBit(keywords, Keyword::FIRST_STRIKE);
+  bool twice = hasKeywordBit(keywords, Keyword::DOUBLE_STRIKE);
+  switch (pass) {
+  case CombatPass::ALL:
+    return true;
+  case CombatPass::FIRST_STRIKE:
+    return first || twice;
+  case CombatPass::REGULAR:
+    return !first || twice;
+  }
+  return true;
+}
+
+}
+
+auto CombatTable::add(int rowPower, int rowToughness, int rowMarked, KeywordSet rowKeywords, int rowTarget) -> int {
+  power.push_back(rowPower);
+  toughness.push_back(rowToughness);
+  marked.push_back(rowMarked);
+  keywords.push_back(rowKeywords);
+  target.push_back(rowTarget);
+  blocked.push_back(0);
+  return static_cast<int>(power.size()) - 1;
+}
+
+auto hasFirstStrike(const CombatTable &table) -> bool {
+  return any_of(table.keywords.begin(), table.keywords.end(), [](KeywordSet keywords) {
+    return hasKeywordBit(keywords, Keyword::FIRST_STRIKE) || hasKeywordBit(keywords, Keyword::DOUBLE_STRIKE);
+  });
+}
+
+void assignCombatDamage(CombatTable &table, CombatPass pass) {
+  // Damage is worked out against the state before the pass, then everything lands at once
+
+  size_t rows = table.rows();
+  table.taken.assign(rows, 0);
+  table.dealt.assign(rows, 0);
+  table.deathtouched.assign(rows, 0);
+  table.lethal.assign(rows, 0);
+  table.playerDamage.assign(table.players, 0);
+
+  // Blockers grouped by the attacker they block, in declaration order (counting sort)
+  vector<int> firstBlocker(table.attackers + 1, 0);
+  for (size_t row = table.attackers; row < rows; row++) {
+    firstBlocker[static_cast<size_t>(table.target[row]) + 1]++;
+  }
+  for (size_t a = 0; a < table.attackers; a++) {
+    firstBlocker[a + 1] += firstBlocker[a];
+  }
+  vector<int> blockers(rows - table.attackers);
+  vector<int> fill(firstBlocker.begin(), firstBlocker.end() - 1);
+  for (size_t row = table.attackers; row < rows; row++) {
+    blockers[static_cast<size_t>(fill[static_cast<size_t>(table.target[row])]++)] = static_cast<int>(row);
+  }
+
+  auto hit = [&](size_t source, size_t row, int amount) {
+    table.taken[row] += amount;
+    table.dealt[source] += amount;
+    if (amount > 0 && hasKeywordBit(table.keywords[source], Keyword::DEATHTOUCH)) {
+      table.deathtouched[row] = 1;
+    }
+  };
+
+  // Attackers: unblocked ones hit the player; blocked ones assign lethal damage down the block
+  // order (1 is lethal with deathtouch), the rest to the last blocker or, with trample, the player
+  for (size_t a = 0; a < table.attackers; a++) {
+    int remaining = max(0, table.power[a]);
+    if (!strikesIn(table.keywords[a], pass) || remaining == 0) {
+      continue;
+    }
+    auto defender = static_cast<size_t>(table.target[a]);
+    if (table.blocked[a] == 0) {
+      table.playerDamage[defender] += remaining;
+      table.dealt[a] += remaining;
+      continue;
+    }
+
+    bool deathtouch = hasKeywordBit(table.keywords[a], Keyword::DEATHTOUCH);
+    bool trample = hasKeywordBit(table.keywords[a], Keyword::TRAMPLE);
+    int begin = firstBlocker[a];
+    int end = firstBlocker[a + 1];
+    for (int i = begin; i < end && remaining > 0; i++) {
+      auto row = static_cast<size_t>(blockers[static_cast<size_t>(i)]);
+      int needed = deathtouch ? 1 : max(0, table.toughness[row] - table.marked[row] - table.taken[row]);
+      int amount = (i == end - 1 && !trample) ? remaining : min(remaining, needed);
+      hit(a, row, amount);
+      remaining -= amount;
+    }
+    if (remaining > 0 && trample) {
+      table.playerDamage[defender] += remaining;
+      table.dealt[a] += remaining;
+    }
+  }
+
+  // Blockers hit the attacker they block
+  for (size_t row = table.attackers; row < rows; row++) {
+    if (strikesIn(table.keywords[row], pass) && table.power[row] > 0) {
+      hit(row, static_cast<size_t>(table.target[row]), table.power[row]);
+    }
+  }
+
+  // Lethal check for every row at once
+  for (size_t row = 0; row < rows; row++) {
+    KeywordSet keywords = table.keywords[row];
+    uint8_t indestructible = (keywords & static_cast<KeywordSet>(Keyword::INDESTRUCTIBLE)) != 0 ? 1 : 0;
+    uint8_t lethalDamage = (table.taken[row] > 0 && table.marked[row] + table.taken[row] >= table.toughness[row]) ? 1 : 0;
+    uint8_t deadly = (table.deathtouched[row] != 0 && table.taken[row] > 0) ? 1 : 0;
+    table.lethal[row] = static_cast<uint8_t>((lethalDamage | deadly) & (indestructible ^ 1));
+  }
+}
@@ -0,0 +1,56 @@
+/*
+  Combat damage as plain arrays. The engine loads every creature still in combat into a
+  CombatTable (attackers first, then blockers), assignCombatDamage works out who deals what to
+  whom for one damage pass all at once, and the engine applies the result in a single batch.
+
+  Nothing here touches the game state, so the whole pass is a few straight loops over contiguous
+  ints; the lethal check in particular is branch-free so the compiler can vectorize it.
+*/
+
+#ifndef COMBAT_H
+#define COMBAT_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <vector>
+
+using namespace std;
+
+enum class CombatPass {
+  ALL,                                      // No first strikers: everyone deals damage together
+  FIRST_STRIKE,                             // First strike and double strike
+  REGULAR                                   // Everyone else, plus double strike again
+};
+
+struct CombatTable {
+  // Inputs, one entry per row (rows [0, attackers) are attackers, the rest blockers)
+  size_t attackers = 0;
+  vector<int> power;
+  vector<int> toughness;
+  vector<int> marked;                       // Damage already on the creature
+  vector<KeywordSet> keywords;
+  vector<int> target;                       // Attacker: defending player index. Blocker: attacker row
+  vector<uint8_t> blocked;                  // Attacker was blocked (stays blocked if its blockers are gone)
+  size_t players = 0;
+
+  // Outputs of assignCombatDamage
+  vector<int> taken;                        // Damage dealt to this row
+  vector<int> dealt;                        // Damage this row dealt (creatures and players)
+  vector<uint8_t> deathtouched;             // Took damage from a deathtouch source
+  vector<uint8_t> lethal;                   // Dies (lethal or deathtouch damage, not indestructible)
+  vector<int> playerDamage;                 // Per defending player index
+
+  auto rows() const -> size_t { return power.size(); }
+
+  // Append a row; returns its index
+  auto add(int rowPower, int rowToughness, int rowMarked, KeywordSet rowKeywords, int rowTarget) -> int;
+};
+
+// True if any row has first strike or double strike (then the engine runs two passes)
+auto hasFirstStrike(const CombatTable &table) -> bool;
+
+// Fill the output arrays for one damage pass
+void assignCombatDamage(CombatTable &table, CombatPass pass);
+
+#endif
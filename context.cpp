@@ -0,0 +1,13 @@
+#include "context.h"
+
+using namespace std;
+
+void Context::syntaxError(int line, const string &msg) {
+  *diagnostics << filename << ':' << line << ' ' << msg << '\n';
+  syntaxErrors++;
+}
+
+auto Context::defaults() -> const Context & {
+  static const Context context;
+  return context;
+}
@@ -0,0 +1,30 @@
+/*
+  Per-caller settings and diagnostics, in place of what used to be process-wide globals (the debug
+  flag, the tokenizer's filename / line / error count). Parsers and engines read the Context they
+  are handed and nothing else, so any number of parses and runs can go on at once in one process:
+  give each thread its own Context (engines only read theirs, so those may be shared).
+*/
+
+#ifndef CONTEXT_H
+#define CONTEXT_H
+
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+struct Context {
+  string filename = "<input>";              // Shown in front of syntax errors
+  bool debug = false;                       // [PARSER] / [ENGINE] traces
+  ostream *diagnostics = &cerr;             // Syntax errors, one "file:line message" per line
+  ostream *trace = &cout;                   // Debug traces
+  int syntaxErrors = 0;                     // Reported through this context so far
+
+  // Report one syntax error (parsing carries on; callers compare syntaxErrors before/after)
+  void syntaxError(int line, const string &msg);
+
+  // Shared read-only default (no debug, errors to stderr) for engines built without one
+  static auto defaults() -> const Context &;
+};
+
+#endif
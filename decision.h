@@ -0,0 +1,53 @@
+/*
+  Choices players make while the stack resolves. Engine::run takes the engine's own answer to each
+  (every "may" trigger is used, simultaneous triggers keep board order within APNAP, triggers go on
+  the stack without a chosen target). Engine::start / Engine::answer instead stop at each one and
+  hand back a DecisionRequest; the run stays suspended inside the engine until it is answered, so a
+  server, UI or search tool can answer without re-running anything.
+
+  All three come up while the triggers a step caused are put on the stack, in this order:
+
+    USE_MAY_TRIGGER   one per optional trigger, APNAP order           answer.accept
+    ORDER_TRIGGERS    one per player with two or more triggers        answer.order
+    CHOOSE_TARGET     one per trigger whose ability targets something answer.choice
+*/
+
+#ifndef DECISION_H
+#define DECISION_H
+
+#include "types.h"
+
+#include <cstddef>
+#include <optional>
+#include <vector>
+
+using namespace std;
+
+enum class DecisionKind {
+  USE_MAY_TRIGGER,                          // Put this optional trigger on the stack?
+  ORDER_TRIGGERS,                           // In what order do this player's triggers go on the stack?
+  CHOOSE_TARGET                             // What does this trigger target?
+};
+
+struct DecisionRequest {
+  DecisionKind kind = DecisionKind::USE_MAY_TRIGGER;
+  PlayerID player;                          // Who decides (the triggers' controller)
+
+  // USE_MAY_TRIGGER / CHOOSE_TARGET: the one trigger; ORDER_TRIGGERS: all of them, first on the stack first
+  vector<PendingTrigger> triggers;
+
+  // CHOOSE_TARGET: the trigger as it would go on the stack, once per legal target (ids are given out
+  // when it's put there)
+  vector<StackItem> options;
+};
+
+struct DecisionAnswer {
+  bool accept = true;                       // USE_MAY_TRIGGER
+  vector<size_t> order;                     // ORDER_TRIGGERS: permutation of indices into triggers
+  optional<size_t> choice;                  // CHOOSE_TARGET: index into options (nullopt: no target, as run does)
+};
+
+// Engine::start / Engine::answer: stopped at a decision, or done (Engine::result has the Output)
+enum class RunState { DECISION, FINISHED };
+
+#endif
@@ -1,13 +1,29 @@
 #include "engine.h"
 #include <algorithm>
+#include <array>
+#include <cctype>
 #include <iostream>
+#include <map>
+#include <stdexcept>
 
 using namespace std;
 
-Engine::Engine(GameInput input) : state(input) {
+Engine::Engine(GameInput input, const Context &context)
+    : cards(input.cards ? std::move(input.cards) : make_shared<const CardDatabase>()), context(&context),
+      state(std::move(input)), stack(std::move(state.stack)) {
   // Record starting life totals
   for (const auto &[playerId, board] : state.boards) {
     output.finalLife[playerId] = board.life;
+    playerOrder.push_back(playerId);
+    for (const auto &perm : board.permanents) {
+      fingerprintAdd(perm);
+      givenIds.insert(perm.id);
+    }
+  }
+  sort(playerOrder.begin(), playerOrder.end());
+
+  if (!state.combat.attacks.empty()) {
+    combatStage = CombatStage::DECLARE_ATTACKERS;
   }
 }
 
@@ -16,13 +32,24 @@ Engine::Engine(GameInput input) : state(input) {
 auto Engine::getCardDef(const string &name) const -> const CardDef * {
   // Look up a card definition by name
 
-  auto it = state.cards.find(name);
-  if (it != state.cards.end()) {
+  if (const CardDef *card = cards->find(name, &deferredLookups)) {
+    return card;
+  }
+  auto it = tokenDefs.find(name);
+  if (it != tokenDefs.end()) {
     return &it->second;
   }
   return nullptr;
 }
 
+auto Engine::takeDeferredLookups() -> unordered_set<string> {
+  // Hand the names over and start a fresh list
+
+  unordered_set<string> names;
+  names.swap(deferredLookups);
+  return names;
+}
+
 auto Engine::findPermanent(const ObjectID &objectId) -> Permanent * {
   // Find a permanent on any player's battlefield
 
@@ -36,6 +63,107 @@ auto Engine::findPermanent(const ObjectID &objectId) -> Permanent * {
   return nullptr;
 }
 
+auto Engine::findSingle(const ObjectID &objectId) -> Permanent * {
+  // Like findPermanent, but split a token record first so a change only hits one copy.
+  // The copy keeps the id that was targeted; the rest of the record gets a fresh one.
+
+  for (auto &[playerId, board] : state.boards) {
+    for (size_t i = 0; i < board.permanents.size(); i++) {
+      Permanent &perm = board.permanents[i];
+      if (perm.id != objectId) {
+        continue;
+      }
+      if (perm.count <= 1) {
+        return &perm;
+      }
+
+      Permanent rest = perm;
+      rest.id = nextTokenId();
+      rest.count = perm.count - 1;
+      fingerprintRemove(perm);
+      perm.count = 1;
+      fingerprintAdd(perm);
+      fingerprintAdd(rest);
+      board.permanents.push_back(std::move(rest));
+      return &board.permanents[i];
+    }
+  }
+  return nullptr;
+}
+
+auto Engine::indexPermanents() -> unordered_map<ObjectID, Permanent *> {
+  // One scan instead of a findPermanent per lookup when a step touches many permanents
+
+  unordered_map<ObjectID, Permanent *> index;
+  for (auto &[playerId, board] : state.boards) {
+    for (auto &perm : board.permanents) {
+      index.emplace(perm.id, &perm);
+    }
+  }
+  return index;
+}
+
+auto Engine::nextTokenId() -> ObjectID {
+  // token_N, skipping any N an input permanent already uses
+
+  ObjectID id;
+  do {
+    id = string(kTokenIdPrefix) + to_string(++tokenCount);
+  } while (givenIds.count(id) != 0);
+  return id;
+}
+
+auto Engine::tokenDef(const Effect &effect) -> const CardDef & {
+  // Tokens copying a pooled card use its definition; anything else is a vanilla creature of the
+  // effect's size ("Creature Token" for a 1/1, "2/2 Creature Token" otherwise)
+
+  string defName = effect.tokenName;
+  if (defName.empty()) {
+    bool oneOne = (effect.tokenPower == 1 && effect.tokenToughness == 1);
+    defName = oneOne ? "Creature Token"
+                     : to_string(effect.tokenPower) + "/" + to_string(effect.tokenToughness) + " Creature Token";
+  }
+  if (const CardDef *card = getCardDef(defName)) {
+    return *card;
+  }
+  CardDef &def = tokenDefs[defName];
+  def.name = defName;
+  def.types = {"Creature", "Token"};
+  def.power = effect.tokenName.empty() ? effect.tokenPower : 1;
+  def.toughness = effect.tokenName.empty() ? effect.tokenToughness : 1;
+  return def;
+}
+
+auto Engine::hasCardType(const Permanent &perm, const string &upper) const -> bool {
+  // Type lines come in either case ("CREATURE", "Creature")
+
+  const CardDef *card = getCardDef(perm.cardName);
+  if (card == nullptr) {
+    return false;
+  }
+  return any_of(card->types.begin(), card->types.end(), [&](const string &type) {
+    return type.size() == upper.size() && equal(type.begin(), type.end(), upper.begin(), [](char a, char b) {
+             return toupper(static_cast<unsigned char>(a)) == b;
+           });
+  });
+}
+
+auto Engine::isCreature(const Permanent &perm) const -> bool {
+  static const string kCreature = "CREATURE";
+  return hasCardType(perm, kCreature);
+}
+
+auto Engine::targetingBlockedBy(Permanent &target, const PlayerID &caster) const -> const char * {
+  KeywordSet keywords = characteristics(target).keywords;
+  if (hasKeywordBit(keywords, Keyword::HEXPROOF) && target.controller != caster) {
+    return "hexproof";
+  }
+  if (hasKeywordBit(keywords, Keyword::SHROUD)) {
+    return "shroud";
+  }
+  return nullptr;
+}
+
 auto Engine::getTurnOrder(const PlayerID &player) const -> int {
   // Active player gets 0, everyone else 1 (for APNAP)
 
@@ -45,21 +173,40 @@ auto Engine::getTurnOrder(const PlayerID &player) const -> int {
   return 1;
 }
 
-auto Engine::hasKeyword(const string &cardName, const string &keyword) const -> bool {
-  // Check if a card has a specific keyword ability
+auto Engine::hasKeyword(const string &cardName, Keyword keyword) const -> bool {
+  // Printed keyword check for cards that aren't permanents (e.g. a spell's source)
 
   const CardDef *card = getCardDef(cardName);
-  if (card == nullptr) {
-    return false;
+  return card != nullptr && hasKeywordBit(card->keywordMask, keyword);
+}
+
+auto Engine::characteristics(Permanent &perm) const -> const Characteristics & {
+  // Apply the layers in order; the result is kept on the permanent until invalidate()
+
+  if (!perm.characteristicsDirty) {
+    return perm.effective;
   }
 
-  // Search through the card's keywords
-  for (const string &kw : card->keywords) {
-    if (kw == keyword) {
-      return true;
-    }
+  Characteristics result;
+
+  // Printed values
+  if (const CardDef *card = getCardDef(perm.cardName)) {
+    result.power = card->power;
+    result.toughness = card->toughness;
+    result.keywords = card->keywordMask;
   }
-  return false;
+
+  // +1/+1 counters (negative for -1/-1)
+  result.power += perm.counters;
+  result.toughness += perm.counters;
+
+  // Modifiers from resolved effects
+  result.power += perm.powerModifier;
+  result.toughness += perm.toughnessModifier;
+
+  perm.effective = result;
+  perm.characteristicsDirty = false;
+  return perm.effective;
 }
 
 // ----------------------------- Priority + Validation ----------------------------- //
@@ -74,70 +221,169 @@ auto Engine::validatePriority(const StackItem &item) -> bool {
   return true;
 }
 
+// ----------------------------- Loop Detection ----------------------------- //
+
+void Engine::fingerprintRemove(const Permanent &perm) {
+  boardFingerprint -= hashPermanent(perm);
+  if (trackDeltas) {
+    touchedPermanents.insert(perm.id);
+  }
+}
+
+void Engine::fingerprintAdd(const Permanent &perm) {
+  boardFingerprint += hashPermanent(perm);
+  if (trackDeltas) {
+    touchedPermanents.insert(perm.id);
+  }
+}
+
+auto Engine::checkForLoop() -> bool {
+  // Feed this step's state to the detector; fill output.loop and return true on a repeat.
+
+  vector<int> counters;
+  counters.reserve(playerOrder.size() * 2 + 1);
+  for (const auto &player : playerOrder) {
+    counters.push_back(state.boards[player].life);
+  }
+  for (const auto &player : playerOrder) {
+    auto drawn = output.cardsDrawn.find(player);
+    counters.push_back(drawn != output.cardsDrawn.end() ? drawn->second : 0);
+  }
+  counters.push_back(static_cast<int>(output.destroyedPermanents.size()));
+
+  uint64_t phase = editCount ^ (static_cast<uint64_t>(combatStage) << 56);
+  uint64_t fingerprint = mixHash(boardFingerprint) ^ stack.fingerprint() ^ mixHash(phase);
+  auto match = loopDetector.observe(fingerprint, std::move(counters));
+  if (!match.has_value()) {
+    return false;
+  }
+
+  LoopReport &loop = output.loop;
+  loop.detected = true;
+  loop.period = match->period;
+  loop.firstStep = match->firstStep + 1;
+  for (size_t i = 0; i < playerOrder.size(); i++) {
+    loop.lifeDelta[playerOrder[i]] = match->delta[i];
+    loop.cardsDrawnDelta[playerOrder[i]] = match->delta[playerOrder.size() + i];
+  }
+  loop.destroyedPerLap = match->delta.back();
+
+  if (context->debug) {
+    *context->trace << "[ENGINE] Loop detected: period " << loop.period << " from step " << loop.firstStep << '\n';
+  }
+  return true;
+}
+
+auto Engine::checkBudget(const RunOptions &options, int stepsTaken) -> StopReason {
+  // Cheapest checks first; the clock is only read if a deadline was set
+
+  if (options.cancel != nullptr && options.cancel->cancelled()) {
+    return StopReason::CANCELLED;
+  }
+  if (options.maxSteps > 0 && stepsTaken >= options.maxSteps) {
+    return StopReason::STEP_LIMIT;
+  }
+  if (options.maxStackDepth > 0 && stack.size() > options.maxStackDepth) {
+    return StopReason::STACK_DEPTH_LIMIT;
+  }
+  if (options.deadline != chrono::steady_clock::time_point::max() && chrono::steady_clock::now() >= options.deadline) {
+    return StopReason::DEADLINE;
+  }
+  return StopReason::COMPLETED;
+}
+
 // ----------------------------- Trigger System ----------------------------- //
-auto Engine::triggerMatches(const TriggerCondition &trig, const GameEvent &event, const Permanent &source) -> bool {
-  // Decide whether a trigger should fire for an event.
+auto Engine::triggerCopies(const TriggerCondition &trig, const GameEvent &event, const Permanent &source) -> int {
+  // How many times a trigger fires for an event. Plain permanents give 0 or 1; a token record
+  // (source.count copies) seeing an event that covers event.count copies is counted in one go.
 
   if (trig.event != event.type) {                     // Event type must match
-    return false;
+    return 0;
   }
 
+  bool sameRecord = (source.id == event.objectId);
+  int pairs = source.count * event.count;
+
   switch (trig.scope) {
-  case TriggerScope::SELF:                            // Only triggers for THIS permanent
-    return source.id == event.objectId;
+  case TriggerScope::SELF:                            // Only triggers for THIS permanent (each copy for itself)
+    return sameRecord ? event.count : 0;
 
   case TriggerScope::ANY_CREATURE:                    // Triggers for any creature
-    return true;
+    return pairs;
 
   case TriggerScope::ANOTHER_CREATURE:                // Triggers for any creature EXCEPT this one
-    return source.id != event.objectId;
+    return sameRecord ? pairs - event.count : pairs;
 
   case TriggerScope::CREATURE_YOU_CONTROL:            // Triggers for creatures controlled by the same player
-    return event.controller == source.controller;
+    return (event.controller == source.controller) ? pairs : 0;
 
   case TriggerScope::CREATURE_OPPONENT_CONTROLS:      // Triggers for creatures controlled by opponents
-    return event.controller != source.controller;
+    return (event.controller != source.controller) ? pairs : 0;
 
   case TriggerScope::ANY_PLAYER:                      // Always triggers
-    return true;
+    return pairs;
   }
-  return false;
+  return 0;
 }
 
-auto Engine::findTriggersForEvent(const GameEvent &event) -> vector<PendingTrigger> {
-  // Find all triggers that fire from an event across all boards.
-
-  if (g_debug) {
-    cout << "[ENGINE] Checking triggers for event type "
-         << static_cast<int>(event.type) << " on " << event.objectId << '\n';
-  }
+auto Engine::findTriggersForEvents(const vector<GameEvent> &events) -> vector<PendingTrigger> {
+  // Find all triggers the events cause across all boards. The listening abilities are collected
+  // once and bucketed by the event they wait for, so each event only meets the abilities that
+  // can fire on it: a wrath's thousand DIES events skip every ETB / attack listener.
 
   vector<PendingTrigger> triggers;
+  if (events.empty()) {
+    return triggers;
+  }
 
-  // Check every permanent on every battlefield
+  struct Listener {
+    const Permanent *perm;
+    int abilityIndex;
+    const TriggeredAbility *ability;
+  };
+  array<vector<Listener>, kTriggerEventCount> listeners;
+  auto listen = [&](const Permanent &perm, bool leftBattlefield) {
+    const CardDef *card = getCardDef(perm.cardName);
+    if (card == nullptr) {
+      return;
+    }
+    for (size_t i = 0; i < card->triggeredAbilities.size(); i++) {
+      const auto &ability = card->triggeredAbilities[i];
+      if (!leftBattlefield || ability.trigger.event == TriggerEvent::DIES) {
+        listeners[static_cast<size_t>(ability.trigger.event)].push_back({&perm, static_cast<int>(i), &ability});
+      }
+    }
+  };
   for (const auto &[pid, board] : state.boards) {
     for (const auto &perm : board.permanents) {
-      const CardDef *card = getCardDef(perm.cardName);
-      if (card == nullptr) {
-        continue;
-      }
+      listen(perm, false);
+    }
+  }
 
-      // Check each triggered ability on this card
-      for (size_t i = 0; i < card->triggeredAbilities.size(); i++) {
-        const auto &ability = card->triggeredAbilities[i];
-
-        if (triggerMatches(ability.trigger, event, perm)) {
-          // This ability triggers + creates a pending one
-          PendingTrigger pt;
-          pt.sourceId = perm.id;
-          pt.sourceName = perm.cardName;
-          pt.abilityIndex = static_cast<int>(i);
-          pt.controller = perm.controller;
-          pt.text = ability.text;
-          pt.isActivePlayer = (perm.controller == state.activePlayer);
-          pt.turnOrder = getTurnOrder(perm.controller);
-          triggers.push_back(pt);
-        }
+  // Permanents that died alongside the others still see those deaths
+  for (const auto &perm : departed) {
+    listen(perm, true);
+  }
+
+  for (const auto &event : events) {
+    if (context->debug) {
+      *context->trace << "[ENGINE] Checking triggers for event type "
+           << static_cast<int>(event.type) << " on " << event.objectId << '\n';
+    }
+
+    for (const auto &[perm, abilityIndex, ability] : listeners[static_cast<size_t>(event.type)]) {
+      int copies = triggerCopies(ability->trigger, event, *perm);
+      if (copies > 0) {
+        // This ability triggers + creates a pending one per copy
+        PendingTrigger pt;
+        pt.sourceId = perm->id;
+        pt.sourceName = perm->cardName;
+        pt.abilityIndex = abilityIndex;
+        pt.controller = perm->controller;
+        pt.text = ability->text;
+        pt.isActivePlayer = (perm->controller == state.activePlayer);
+        pt.turnOrder = getTurnOrder(perm->controller);
+        triggers.insert(triggers.end(), static_cast<size_t>(copies), pt);
       }
     }
   }
@@ -156,22 +402,26 @@ auto Engine::orderAPNAP(vector<PendingTrigger> triggers) -> vector<PendingTrigge
 void Engine::addTriggersToStack(const vector<PendingTrigger> &triggers) {
   // Put triggered abilities onto the stack.
 
-  if (g_debug) {
-    cout << "[ENGINE] Adding " << triggers.size() << " triggers to stack.\n";
+  if (context->debug) {
+    *context->trace << "[ENGINE] Adding " << triggers.size() << " triggers to stack.\n";
   }
 
   for (const auto &trig : triggers) {
-    StackItem item;
-    item.id = "trig_" + to_string(++triggerCount);
-    item.kind = "TRIGGERED_ABILITY";
-    item.sourceName = trig.sourceName;
-    item.sourceId = trig.sourceId;
-    item.abilityIndex = trig.abilityIndex;
-    item.controller = trig.controller;
-    state.stack.push_back(item);
+    pushItem(triggerItem(trig));
   }
 }
 
+auto Engine::triggerItem(const PendingTrigger &trig) -> StackItem {
+  StackItem item;
+  item.id = "trig_" + to_string(++triggerCount);
+  item.kind = "TRIGGERED_ABILITY";
+  item.sourceName = trig.sourceName;
+  item.sourceId = trig.sourceId;
+  item.abilityIndex = trig.abilityIndex;
+  item.controller = trig.controller;
+  return item;
+}
+
 // ----------------------------- Destruction Handling ----------------------------- //
 void Engine::destroyPermanent(const ObjectID &objectId, vector<GameEvent> &events) {
   // Remove a permanent from the battlefield and emit a DIES event.
@@ -180,7 +430,7 @@ void Engine::destroyPermanent(const ObjectID &objectId, vector<GameEvent> &event
     for (auto it = board.permanents.begin(); it != board.permanents.end(); ++it) {
       if (it->id == objectId) {
         // Check for indestructible
-        if (hasKeyword(it->cardName, "INDESTRUCTIBLE")) {
+        if (hasKeywordBit(characteristics(*it).keywords, Keyword::INDESTRUCTIBLE)) {
           return;
         }
 
@@ -190,10 +440,13 @@ void Engine::destroyPermanent(const ObjectID &objectId, vector<GameEvent> &event
         dieEvent.objectId = it->id;
         dieEvent.cardName = it->cardName;
         dieEvent.controller = it->controller;
+        dieEvent.count = it->count;
         events.push_back(dieEvent);
 
         // Record the destruction and remove from battlefield
         output.destroyedPermanents.push_back(objectId);
+        fingerprintRemove(*it);
+        rememberDeparted(*it);
         board.permanents.erase(it);
         return;
       }
@@ -201,6 +454,64 @@ void Engine::destroyPermanent(const ObjectID &objectId, vector<GameEvent> &event
   }
 }
 
+void Engine::destroyPermanents(const vector<ObjectID> &objectIds, vector<GameEvent> &events, bool sacrifice) {
+  // destroyPermanent for many ids at once: each board is compacted in a single pass, and the
+  // DIES events / destroyed list come out in the order the ids were given. Sacrificed permanents
+  // ignore indestructible and aren't counted as destroyed.
+
+  unordered_map<ObjectID, size_t> wanted;
+  wanted.reserve(objectIds.size());
+  for (size_t i = 0; i < objectIds.size(); i++) {
+    wanted.emplace(objectIds[i], i);
+  }
+  vector<optional<GameEvent>> died(objectIds.size());
+
+  for (auto &[playerId, board] : state.boards) {
+    auto kept = remove_if(board.permanents.begin(), board.permanents.end(), [&](Permanent &perm) {
+      auto it = wanted.find(perm.id);
+      if (it == wanted.end() ||
+          (!sacrifice && hasKeywordBit(characteristics(perm).keywords, Keyword::INDESTRUCTIBLE))) {
+        return false;
+      }
+      GameEvent dieEvent;
+      dieEvent.type = TriggerEvent::DIES;
+      dieEvent.objectId = perm.id;
+      dieEvent.cardName = perm.cardName;
+      dieEvent.controller = perm.controller;
+      dieEvent.count = perm.count;
+      died[it->second] = std::move(dieEvent);
+      fingerprintRemove(perm);
+      rememberDeparted(perm);
+      return true;
+    });
+    board.permanents.erase(kept, board.permanents.end());
+  }
+
+  for (auto &event : died) {
+    if (event.has_value()) {
+      if (!sacrifice) {
+        output.destroyedPermanents.push_back(event->objectId);
+      }
+      events.push_back(std::move(*event));
+    }
+  }
+}
+
+void Engine::rememberDeparted(const Permanent &perm) {
+  // Only permanents with a dies trigger can look back; the rest aren't worth the copy
+
+  const CardDef *card = getCardDef(perm.cardName);
+  if (card == nullptr) {
+    return;
+  }
+  for (const auto &ability : card->triggeredAbilities) {
+    if (ability.trigger.event == TriggerEvent::DIES) {
+      departed.push_back(perm);
+      return;
+    }
+  }
+}
+
 // ----------------------------- Effect Handling ----------------------------- //
 
 // Handle DEAL_DAMAGE
@@ -215,21 +526,20 @@ void Engine::resolveDealDamageEffect(const StackItem &item, const Effect &effect
 
   // Damage to a creature
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target == nullptr) {
       return;  // Target no longer exists
     }
 
-    // Calculate current toughness
-    const CardDef *card = getCardDef(target->cardName);
-    int toughness = (card != nullptr) ? card->toughness : 0;
-    toughness += target->toughnessModifier;
+    int toughness = characteristics(*target).toughness;
 
     // Check for deathtouch
-    bool deathtouch = hasKeyword(item.sourceName, "DEATHTOUCH");
+    bool deathtouch = hasKeyword(item.sourceName, Keyword::DEATHTOUCH);
 
     // Mark damage on the creature
+    fingerprintRemove(*target);
     target->damage += effect.value;
+    fingerprintAdd(*target);
     step.description += item.sourceName + " deals " + to_string(effect.value) +
                         " damage to " + target->cardName + ". ";
 
@@ -248,12 +558,11 @@ void Engine::resolveCounterEffect(const StackItem &item, ResolutionStep &step) {
     return;
   }
 
-  // Find and remove the target spell from the stack
-  auto it = find_if(state.stack.begin(), state.stack.end(), [&](const StackItem &si) { return si.id == item.targetStackId; });
-
-  bool removed = (it != state.stack.end());
+  // Remove the target spell from the stack (tombstoned, no shifting)
+  bool removed = stack.remove(item.targetStackId);
   if (removed) {
-    state.stack.erase(it);
+    journalPopped(item.targetStackId);
+    output.counteredSpells.push_back(item.targetStackId);
   }
 
   step.description += item.sourceName + (removed ? " counters " : " fails to find ") + item.targetStackId + ". ";
@@ -262,7 +571,7 @@ void Engine::resolveCounterEffect(const StackItem &item, ResolutionStep &step) {
 // Handle DESTROY
 void Engine::resolveDestroyEffect(const StackItem &item, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
       step.description += item.sourceName + " destroys " + target->cardName + ". ";
       destroyPermanent(item.targetId, step.triggeredEvents);
@@ -270,13 +579,122 @@ void Engine::resolveDestroyEffect(const StackItem &item, ResolutionStep &step) {
   }
 }
 
+// Handle DESTROY_ALL
+void Engine::resolveDestroyAllEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
+  // Everything goes at once: one compaction pass per board, and the DIES events reach the
+  // trigger pass as a single batch
+
+  bool everything = (effect.target == TargetType::PERMANENT);
+  vector<ObjectID> doomed;
+  for (const auto &player : playerOrder) {
+    for (const auto &perm : state.boards[player].permanents) {
+      if ((everything || isCreature(perm)) && (effect.cardType.empty() || hasCardType(perm, effect.cardType))) {
+        doomed.push_back(perm.id);
+      }
+    }
+  }
+
+  size_t firstEvent = step.triggeredEvents.size();
+  destroyPermanents(doomed, step.triggeredEvents);
+  int destroyed = 0;
+  for (size_t i = firstEvent; i < step.triggeredEvents.size(); i++) {
+    destroyed += step.triggeredEvents[i].count;
+  }
+  string noun = effect.cardType;
+  transform(noun.begin(), noun.end(), noun.begin(), [](char c) { return static_cast<char>(tolower(static_cast<unsigned char>(c))); });
+  if (!everything) {
+    noun += noun.empty() ? "creature" : " creature";
+  } else if (noun.empty()) {
+    noun = "permanent";
+  }
+  step.description += item.sourceName + " destroys " + to_string(destroyed) + " " + noun + "(s). ";
+}
+
+// Handle SACRIFICE
+void Engine::resolveSacrificeEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
+  // Each affected player sacrifices their weakest creatures (lowest power, then toughness);
+  // the sacrifices of all players happen together
+
+  vector<PlayerID> players;
+  for (const auto &player : playerOrder) {
+    bool opponent = (player != item.controller);
+    bool affected = false;
+    switch (effect.target) {
+    case TargetType::EACH_OPPONENT:
+      affected = opponent;
+      break;
+    case TargetType::OPPONENT:
+    case TargetType::PLAYER:
+      // The targeted player, or else the first opponent
+      affected = item.targetPlayer.empty() ? (opponent && players.empty()) : (player == item.targetPlayer);
+      break;
+    default:
+      affected = !opponent;                 // "Sacrifice a creature": the controller does
+      break;
+    }
+    if (affected) {
+      players.push_back(player);
+    }
+  }
+
+  vector<ObjectID> victims;
+  for (const auto &player : players) {
+    vector<Permanent> &permanents = state.boards[player].permanents;
+    vector<size_t> creatures;
+    for (size_t i = 0; i < permanents.size(); i++) {
+      if (isCreature(permanents[i])) {
+        creatures.push_back(i);
+      }
+    }
+    stable_sort(creatures.begin(), creatures.end(), [&](size_t a, size_t b) {
+      const Characteristics &first = characteristics(permanents[a]);
+      const Characteristics &second = characteristics(permanents[b]);
+      return make_pair(first.power, first.toughness) < make_pair(second.power, second.toughness);
+    });
+
+    int remaining = max(effect.value, 1);
+    string names;
+    for (size_t index : creatures) {
+      if (remaining == 0) {
+        break;
+      }
+      Permanent &perm = permanents[index];
+      int taken = min(perm.count, remaining);
+      remaining -= taken;
+      names += (names.empty() ? "" : ", ") + (taken > 1 ? to_string(taken) + "x " : "") + perm.cardName;
+
+      if (taken == perm.count) {
+        victims.push_back(perm.id);
+        continue;
+      }
+
+      // Only part of a token record goes: split those copies off under a fresh id so they die as
+      // their own record (the survivors then see "another creature" die, the dead can look back)
+      Permanent gone = perm;
+      gone.id = nextTokenId();
+      gone.count = taken;
+      fingerprintRemove(perm);
+      perm.count -= taken;
+      fingerprintAdd(perm);
+      fingerprintAdd(gone);
+      victims.push_back(gone.id);
+      permanents.push_back(std::move(gone));  // Invalidates perm; creatures holds indexes
+    }
+    step.description += player + (names.empty() ? " has nothing to sacrifice. " : " sacrifices " + names + ". ");
+  }
+
+  destroyPermanents(victims, step.triggeredEvents, true);
+}
+
 // Handle ADD_COUNTERS
 void Engine::resolveAddCountersEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
-      target->powerModifier += effect.value;
-      target->toughnessModifier += effect.value;
+      fingerprintRemove(*target);
+      target->counters += effect.value;
+      invalidate(*target);
+      fingerprintAdd(*target);
       step.description += item.sourceName + " gives " + target->cardName + " +" + to_string(effect.value) + "/+" + to_string(effect.value) + ". ";
     }
   }
@@ -285,18 +703,16 @@ void Engine::resolveAddCountersEffect(const StackItem &item, const Effect &effec
 // Handle REMOVE_COUNTERS
 void Engine::resolveRemoveCountersEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
-      target->powerModifier -= effect.value;
-      target->toughnessModifier -= effect.value;
+      fingerprintRemove(*target);
+      target->counters -= effect.value;
+      invalidate(*target);
+      fingerprintAdd(*target);
       step.description += item.sourceName + " gives " + target->cardName + " -" + to_string(effect.value) + "/-" + to_string(effect.value) + ". ";
 
       // Check if creature dies from 0 toughness
-      const CardDef *card = getCardDef(target->cardName);
-      int toughness = (card != nullptr) ? card->toughness : 0;
-      toughness += target->toughnessModifier;
-
-      if (toughness <= 0) {
+      if (characteristics(*target).toughness <= 0) {
         step.description += target->cardName + " is put into the graveyard (0 toughness). ";
         destroyPermanent(item.targetId, step.triggeredEvents);
       }
@@ -307,9 +723,12 @@ void Engine::resolveRemoveCountersEffect(const StackItem &item, const Effect &ef
 // Handle CHANGE_POWER
 void Engine::resolveChangePowerEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
+      fingerprintRemove(*target);
       target->powerModifier += effect.value;
+      invalidate(*target);
+      fingerprintAdd(*target);
       step.description += item.sourceName + " changes " + target->cardName + " power by " + to_string(effect.value) + ". ";
     }
   }
@@ -318,17 +737,16 @@ void Engine::resolveChangePowerEffect(const StackItem &item, const Effect &effec
 // Handle CHANGE_TOUGHNESS
 void Engine::resolveChangeToughnessEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
+      fingerprintRemove(*target);
       target->toughnessModifier += effect.value;
+      invalidate(*target);
+      fingerprintAdd(*target);
       step.description += item.sourceName + " changes " + target->cardName + " toughness by " + to_string(effect.value) + ". ";
 
       // Check if creature dies from 0 toughness
-      const CardDef *card = getCardDef(target->cardName);
-      int toughness = (card != nullptr) ? card->toughness : 0;
-      toughness += target->toughnessModifier;
-
-      if (toughness <= 0) {
+      if (characteristics(*target).toughness <= 0) {
         step.description += target->cardName + " is put into the graveyard (0 toughness). ";
         destroyPermanent(item.targetId, step.triggeredEvents);
       }
@@ -339,13 +757,19 @@ void Engine::resolveChangeToughnessEffect(const StackItem &item, const Effect &e
 // Handle BOUNCE
 void Engine::resolveBounceEffect(const StackItem &item, ResolutionStep &step) {
   if (!item.targetId.empty()) {
-    Permanent *target = findPermanent(item.targetId);
+    Permanent *target = findSingle(item.targetId);
     if (target != nullptr) {
       step.description += item.sourceName + " returns " + target->cardName + " to its owner's hand. ";
 
       // Remove from all boards
       for (auto &[playerId, board] : state.boards) {
-        auto newEnd = remove_if(board.permanents.begin(), board.permanents.end(), [&](const Permanent &p) { return p.id == item.targetId; });
+        auto newEnd = remove_if(board.permanents.begin(), board.permanents.end(), [&](const Permanent &p) {
+          if (p.id != item.targetId) {
+            return false;
+          }
+          fingerprintRemove(p);
+          return true;
+        });
         board.permanents.erase(newEnd, board.permanents.end());
       }
     }
@@ -368,9 +792,13 @@ void Engine::resolveLoseLifeEffect(const StackItem &item, const Effect &effect,
         step.description += playerId + " loses " + to_string(effect.value) + " life. ";
       }
     }
+  } else if (!item.targetPlayer.empty() && state.boards.count(item.targetPlayer) != 0) {
+    // The player it targets
+    state.boards[item.targetPlayer].life -= effect.value;
+    step.description += item.targetPlayer + " loses " + to_string(effect.value) + " life. ";
   } else {
-    // Hit just one opponent
-    for (const auto &[playerId, board] : state.boards) {
+    // No target chosen: the first opponent in player order (same one whatever the map's layout)
+    for (const auto &playerId : playerOrder) {
       if (playerId != item.controller) {
         state.boards[playerId].life -= effect.value;
         step.description += playerId + " loses " + to_string(effect.value) + " life. ";
@@ -386,6 +814,57 @@ void Engine::resolveDrawCardsEffect(const StackItem &item, const Effect &effect,
   step.description += item.controller + " draws " + to_string(effect.value) + " card(s). ";
 }
 
+// Handle CREATE_TOKEN
+void Engine::resolveCreateTokenEffect(const StackItem &item, const Effect &effect, ResolutionStep &step) {
+  // Fresh tokens join an existing record of untouched copies when there is one, so a board of
+  // hundreds of identical 1/1s stays a single Permanent
+
+  int amount = max(effect.value, 1);
+  auto boardIt = state.boards.find(item.controller);
+  if (boardIt == state.boards.end()) {
+    output.errors.push_back("TOKEN ERROR: " + item.sourceName + " - controller " + item.controller + " has no board");
+    return;
+  }
+  Board &board = boardIt->second;
+  const CardDef &def = tokenDef(effect);
+
+  Permanent *record = nullptr;
+  for (auto &perm : board.permanents) {
+    if (perm.isToken && perm.cardName == def.name && perm.controller == item.controller && !perm.tapped &&
+        perm.damage == 0 && perm.powerModifier == 0 && perm.toughnessModifier == 0 && perm.counters == 0) {
+      record = &perm;
+      break;
+    }
+  }
+
+  if (record != nullptr) {
+    fingerprintRemove(*record);
+    record->count += amount;
+    fingerprintAdd(*record);
+  } else {
+    Permanent perm;
+    perm.id = nextTokenId();
+    perm.cardName = def.name;
+    perm.controller = item.controller;
+    perm.isToken = true;
+    perm.count = amount;
+    fingerprintAdd(perm);
+    board.permanents.push_back(std::move(perm));
+    record = &board.permanents.back();
+  }
+
+  step.description += item.sourceName + " creates " + to_string(amount) + "x " + def.name + ". ";
+
+  // One event for the whole batch; triggerCopies multiplies it out
+  GameEvent enterEvent;
+  enterEvent.type = TriggerEvent::ENTERS_BATTLEFIELD;
+  enterEvent.objectId = record->id;
+  enterEvent.cardName = def.name;
+  enterEvent.controller = item.controller;
+  enterEvent.count = amount;
+  step.triggeredEvents.push_back(enterEvent);
+}
+
 // ----------------------------- Main Resolution ----------------------------- //
 
 void Engine::resolveSpell(const StackItem &item, ResolutionStep &step) {
@@ -407,24 +886,16 @@ void Engine::resolveSpell(const StackItem &item, ResolutionStep &step) {
       return;
     }
 
-    // Check for hexproof
-    if (hasKeyword(target->cardName, "HEXPROOF") && target->controller != item.controller) {
-      step.description = item.sourceName + " fizzles - " + target->cardName + " has hexproof.";
-      return;
-    }
-
-    // Check for shroud
-    if (hasKeyword(target->cardName, "SHROUD")) {
-      step.description = item.sourceName + " fizzles - " + target->cardName + " has shroud.";
+    // Check for hexproof / shroud
+    if (const char *blocked = targetingBlockedBy(*target, item.controller)) {
+      step.description = item.sourceName + " fizzles - " + target->cardName + " has " + blocked + ".";
       return;
     }
   }
 
   // Check if the target spell still exists
   if (card->spellTarget == TargetType::SPELL && !item.targetStackId.empty()) {
-    bool exists = any_of(state.stack.begin(), state.stack.end(),
-                         [&](const StackItem &si) { return si.id == item.targetStackId; });
-    if (!exists) {
+    if (!stack.contains(item.targetStackId)) {
       step.description = item.sourceName + " fizzles - target spell no longer exists.";
       return;
     }
@@ -442,6 +913,12 @@ void Engine::resolveSpell(const StackItem &item, ResolutionStep &step) {
     case EffectType::DESTROY:
       resolveDestroyEffect(item, step);
       break;
+    case EffectType::DESTROY_ALL:
+      resolveDestroyAllEffect(item, effect, step);
+      break;
+    case EffectType::SACRIFICE:
+      resolveSacrificeEffect(item, effect, step);
+      break;
     case EffectType::ADD_COUNTERS:
       resolveAddCountersEffect(item, effect, step);
       break;
@@ -457,6 +934,9 @@ void Engine::resolveSpell(const StackItem &item, ResolutionStep &step) {
     case EffectType::BOUNCE:
       resolveBounceEffect(item, step);
       break;
+    case EffectType::CREATE_TOKEN:
+      resolveCreateTokenEffect(item, effect, step);
+      break;
     default:
       step.description += item.sourceName + " resolves. ";
       break;
@@ -506,6 +986,15 @@ void Engine::resolveTriggeredAbility(const StackItem &item, ResolutionStep &step
     case EffectType::CHANGE_TOUGHNESS:
       resolveChangeToughnessEffect(item, effect, step);
       break;
+    case EffectType::CREATE_TOKEN:
+      resolveCreateTokenEffect(item, effect, step);
+      break;
+    case EffectType::DESTROY_ALL:
+      resolveDestroyAllEffect(item, effect, step);
+      break;
+    case EffectType::SACRIFICE:
+      resolveSacrificeEffect(item, effect, step);
+      break;
     default:
       break;
     }
@@ -517,16 +1006,16 @@ auto Engine::resolveTop() -> ResolutionStep {
 
   ResolutionStep step;
 
-  if (state.stack.empty()) {
+  if (stack.empty()) {
     return step;
   }
 
   // Pop the top of the stack (LIFO - last in, first out)
-  StackItem item = state.stack.back();
-  state.stack.pop_back();
+  StackItem item = stack.pop();
+  journalPopped(item.id);
 
-  if (g_debug) {
-    cout << "[ENGINE] Resolving top: " << item.kind << " (" << item.sourceName << ")\n";
+  if (context->debug) {
+    *context->trace << "[ENGINE] Resolving top: " << item.kind << " (" << item.sourceName << ")\n";
   }
 
   // After something resolves, active player gets priority
@@ -542,42 +1031,675 @@ auto Engine::resolveTop() -> ResolutionStep {
   return step;
 }
 
-// Main simulation loop
-auto Engine::run() -> Output {
-  if (g_debug) {
-    cout << "[ENGINE] Starting...\n";
-  }
-
-  // Keep resolving until the stack is empty
-  while (!state.stack.empty()) {
-    // Resolve the top item
-    ResolutionStep step = resolveTop();
-
-    // Check for any triggers that fired from events during resolution
-    vector<PendingTrigger> allTriggers;
-    for (const auto &event : step.triggeredEvents) {
-      auto triggers = findTriggersForEvent(event);
-      // Add to our collection
-      for (const auto &t : triggers) {
-        allTriggers.push_back(t);
+auto Engine::resolveNext(vector<PendingTrigger> &triggers) -> ResolutionStep {
+  // Resolve the top item and collect what it triggered, sorted APNAP. With the stack empty,
+  // combat moves on a stage instead.
+
+  ResolutionStep step = stack.empty() ? combatStep() : resolveTop();
+
+  // Check for any triggers that fired from events during resolution
+  triggers = findTriggersForEvents(step.triggeredEvents);
+  departed.clear();
+  if (!triggers.empty()) {
+    triggers = orderAPNAP(std::move(triggers));
+  }
+  return step;
+}
+
+auto Engine::advance() -> ResolutionStep {
+  // resolveNext, then the triggers go on the stack as they are (the engine's answer to every decision)
+
+  vector<PendingTrigger> triggers;
+  ResolutionStep step = resolveNext(triggers);
+  if (!triggers.empty()) {
+    addTriggersToStack(triggers);
+    step.newTriggers = std::move(triggers);
+  }
+  return step;
+}
+
+// ----------------------------- Combat ----------------------------- //
+
+auto Engine::combatStep() -> ResolutionStep {
+  // Run the next combat stage (the stack is empty)
+
+  ResolutionStep step;
+  switch (combatStage) {
+  case CombatStage::DECLARE_ATTACKERS:
+    declareAttackers(step);
+    combatStage = CombatStage::COMBAT_DAMAGE;
+    break;
+  case CombatStage::COMBAT_DAMAGE:
+    combatStage = resolveCombatDamage(false, step) ? CombatStage::REGULAR_DAMAGE : CombatStage::DONE;
+    break;
+  case CombatStage::REGULAR_DAMAGE:
+    resolveCombatDamage(true, step);
+    combatStage = CombatStage::DONE;
+    break;
+  case CombatStage::DONE:
+    break;
+  }
+  return step;
+}
+
+void Engine::declareAttackers(ResolutionStep &step) {
+  // Tap attackers (unless they have vigilance) and fire ATTACKS. Token records in combat are
+  // split here, so every attacker/blocker id names exactly one creature from now on.
+
+  map<PlayerID, string> attackersOf;        // Defender -> names, for the description
+
+  // Splitting can move permanents, so do all of it before taking pointers
+  auto index = indexPermanents();
+  vector<ObjectID> records;
+  auto needsSplit = [&](const ObjectID &id) {
+    auto it = index.find(id);
+    if (it != index.end() && it->second->count > 1) {
+      records.push_back(id);
+    }
+  };
+  for (const auto &attack : state.combat.attacks) {
+    needsSplit(attack.attacker);
+  }
+  for (const auto &block : state.combat.blocks) {
+    needsSplit(block.blocker);
+  }
+  if (!records.empty()) {
+    for (const auto &id : records) {
+      findSingle(id);
+    }
+    index = indexPermanents();
+  }
+
+  for (auto &attack : state.combat.attacks) {
+    auto found = index.find(attack.attacker);
+    if (found == index.end()) {
+      continue;                             // Left the battlefield while the stack resolved
+    }
+    Permanent *attacker = found->second;
+    if (attack.defender.empty()) {
+      for (const auto &player : playerOrder) {
+        if (player != attacker->controller) {
+          attack.defender = player;
+          break;
+        }
       }
     }
 
-    // If there are triggers, sort by APNAP and add to stack
-    if (!allTriggers.empty()) {
-      auto ordered = orderAPNAP(allTriggers);
-      step.newTriggers = ordered;
-      addTriggersToStack(ordered);
+    if (!attacker->tapped && !hasKeywordBit(characteristics(*attacker).keywords, Keyword::VIGILANCE)) {
+      fingerprintRemove(*attacker);
+      attacker->tapped = true;
+      fingerprintAdd(*attacker);
     }
 
-    // Record this step in our output
-    output.steps.push_back(step);
+    GameEvent event;
+    event.type = TriggerEvent::ATTACKS;
+    event.objectId = attacker->id;
+    event.cardName = attacker->cardName;
+    event.controller = attacker->controller;
+    step.triggeredEvents.push_back(event);
+
+    string &names = attackersOf[attack.defender];
+    names += (names.empty() ? "" : ", ") + attacker->cardName;
+  }
+
+
+  step.description = state.activePlayer + " declares attackers.";
+  for (const auto &[defender, names] : attackersOf) {
+    step.description += " " + names + " attack " + defender + ".";
+  }
+}
+
+auto Engine::resolveCombatDamage(bool afterFirstStrike, ResolutionStep &step) -> bool {
+  // One damage pass for every creature still in combat, applied as a single batch
+
+  CombatTable table;
+  table.players = playerOrder.size();
+  vector<Permanent *> rowPermanent;
+  unordered_map<ObjectID, int> attackerRow;
+  auto index = indexPermanents();
+  auto lookup = [&](const ObjectID &id) -> Permanent * {
+    auto it = index.find(id);
+    return it != index.end() ? it->second : nullptr;
+  };
+
+  auto addRow = [&](Permanent &perm, int target) {
+    const Characteristics &stats = characteristics(perm);
+    rowPermanent.push_back(&perm);
+    return table.add(stats.power, stats.toughness, perm.damage, stats.keywords, target);
+  };
+
+  for (const auto &attack : state.combat.attacks) {
+    Permanent *attacker = lookup(attack.attacker);
+    auto defender = find(playerOrder.begin(), playerOrder.end(), attack.defender);
+    if (attacker == nullptr || defender == playerOrder.end()) {
+      continue;
+    }
+    attackerRow[attack.attacker] = addRow(*attacker, static_cast<int>(defender - playerOrder.begin()));
+  }
+  table.attackers = table.rows();
+
+  for (const auto &block : state.combat.blocks) {
+    auto row = attackerRow.find(block.attacker);
+    if (row == attackerRow.end()) {
+      continue;                             // Attacker is gone; its blockers deal no damage
+    }
+    table.blocked[static_cast<size_t>(row->second)] = 1;
+    if (Permanent *blocker = lookup(block.blocker)) {
+      addRow(*blocker, row->second);
+    }
   }
 
+  bool twoPasses = !afterFirstStrike && hasFirstStrike(table);
+  CombatPass pass = afterFirstStrike ? CombatPass::REGULAR : (twoPasses ? CombatPass::FIRST_STRIKE : CombatPass::ALL);
+  assignCombatDamage(table, pass);
+
+  step.description = twoPasses ? "First strike damage:" : "Combat damage:";
+
+  // Players
+  for (size_t p = 0; p < table.players; p++) {
+    if (table.playerDamage[p] > 0) {
+      state.boards[playerOrder[p]].life -= table.playerDamage[p];
+      step.description += " " + playerOrder[p] + " takes " + to_string(table.playerDamage[p]) + ".";
+    }
+  }
+
+  // Creatures: mark damage, then damage events and lifelink
+  vector<ObjectID> dying;
+  for (size_t row = 0; row < table.rows(); row++) {
+    Permanent &perm = *rowPermanent[row];
+    if (table.taken[row] > 0) {
+      fingerprintRemove(perm);
+      perm.damage += table.taken[row];
+      fingerprintAdd(perm);
+      step.description += " " + perm.cardName + " takes " + to_string(table.taken[row]) + ".";
+    }
+    if (table.dealt[row] > 0) {
+      GameEvent event;
+      event.objectId = perm.id;
+      event.cardName = perm.cardName;
+      event.controller = perm.controller;
+      event.type = TriggerEvent::DEALS_COMBAT_DAMAGE;
+      step.triggeredEvents.push_back(event);
+      event.type = TriggerEvent::DEALS_DAMAGE;
+      step.triggeredEvents.push_back(event);
+
+      if (hasKeywordBit(table.keywords[row], Keyword::LIFELINK)) {
+        state.boards[perm.controller].life += table.dealt[row];
+      }
+    }
+    if (table.lethal[row] != 0) {
+      dying.push_back(perm.id);
+      step.description += " " + perm.cardName + " is destroyed by lethal damage.";
+    }
+  }
+
+  // Deaths last, all together (this invalidates rowPermanent)
+  destroyPermanents(dying, step.triggeredEvents);
+  return twoPasses;
+}
+
+// Main simulation loop
+auto Engine::run(const RunOptions &options) -> Output {
+  if (context->debug) {
+    *context->trace << "[ENGINE] Starting...\n";
+  }
+
+  int stepsTaken = 0;
+
+  // Keep resolving until the stack is empty and combat (if any) is over
+  while (hasWork() && beginStep(options, stepsTaken)) {
+    recordStep(options, advance());
+
+    // Stop early if the state is cycling
+    if (checkForLoop()) {
+      output.stopReason = StopReason::LOOP_DETECTED;
+      break;
+    }
+  }
+
+  finishRun();
+  return output;
+}
+
+auto Engine::beginStep(const RunOptions &options, int &stepsTaken) -> bool {
+  // Stop cleanly if a budget ran out; what we have so far is still a valid partial result
+
+  StopReason budget = checkBudget(options, stepsTaken);
+  if (budget != StopReason::COMPLETED) {
+    output.stopReason = budget;
+    return false;
+  }
+  stepsTaken++;
+
+  // Players may respond before the top item resolves
+  if (options.onPriority && !stack.empty()) {
+    options.onPriority(*this);
+  }
+  if (options.onResolve && !stack.empty()) {
+    options.onResolve(stack.top());
+  }
+  return true;
+}
+
+void Engine::recordStep(const RunOptions &options, ResolutionStep step) {
+  if (options.steps != nullptr) {
+    options.steps->step(step);
+  } else {
+    output.steps.push_back(std::move(step));
+  }
+}
+
+void Engine::finishRun() {
+  output.unresolvedItems = static_cast<int>(stack.size());
+
   // Record final life totals
   for (const auto &[playerId, board] : state.boards) {
     output.finalLife[playerId] = board.life;
   }
+}
 
-  return output;
+// ----------------------------- Player Decisions ----------------------------- //
+
+auto Engine::start(const RunOptions &options) -> RunState {
+  // run(), except that the staged triggers of each step are walked for decisions first
+
+  if (pendingDecision() != nullptr) {
+    throw runtime_error("start: a decision is already pending");
+  }
+  if (context->debug) {
+    *context->trace << "[ENGINE] Starting (stopping at decisions)...\n";
+  }
+  suspended.emplace();
+  suspended->options = options;
+  return proceed();
+}
+
+auto Engine::answer(const DecisionAnswer &answer) -> RunState {
+  if (pendingDecision() == nullptr) {
+    throw runtime_error("answer: no decision is pending");
+  }
+  applyAnswer(answer);
+  suspended->pending.reset();
+  return proceed();
+}
+
+auto Engine::proceed() -> RunState {
+  // Same loop as run, with the trigger half of advance() able to stop and come back
+
+  SuspendedRun &paused = *suspended;
+  for (;;) {
+    if (paused.staging) {
+      paused.pending = nextDecision();
+      if (paused.pending) {
+        return RunState::DECISION;
+      }
+      pushStagedTriggers();
+      paused.staging = false;
+      recordStep(paused.options, std::move(paused.step));
+      if (checkForLoop()) {
+        output.stopReason = StopReason::LOOP_DETECTED;
+        break;
+      }
+    }
+
+    if (!hasWork() || !beginStep(paused.options, paused.stepsTaken)) {
+      break;
+    }
+    paused.step = resolveNext(paused.triggers);
+    paused.targets.clear();
+    paused.phase = SuspendedRun::Phase::MAY;
+    paused.cursor = 0;
+    paused.staging = true;
+  }
+
+  suspended.reset();
+  finishRun();
+  return RunState::FINISHED;
+}
+
+auto Engine::triggerTarget(const PendingTrigger &trig) const -> TargetType {
+  // The first effect that names a target decides it; "each opponent" / "you" leave nothing to pick
+
+  const CardDef *card = getCardDef(trig.sourceName);
+  if (card == nullptr || trig.abilityIndex >= static_cast<int>(card->triggeredAbilities.size())) {
+    return TargetType::NONE;
+  }
+  for (const auto &effect : card->triggeredAbilities[trig.abilityIndex].effects) {
+    switch (effect.target) {
+    case TargetType::ANY_TARGET:
+    case TargetType::CREATURE:
+    case TargetType::PLAYER:
+    case TargetType::OPPONENT:
+    case TargetType::PERMANENT:
+      return effect.target;
+    default:
+      break;
+    }
+  }
+  return TargetType::NONE;
+}
+
+auto Engine::nextDecision() -> optional<DecisionRequest> {
+  // Move the cursor to the next staged trigger that needs an answer and ask about it; nullopt once
+  // every phase is through
+
+  SuspendedRun &paused = *suspended;
+  vector<PendingTrigger> &triggers = paused.triggers;
+  using Phase = SuspendedRun::Phase;
+
+  if (paused.phase == Phase::MAY) {
+    for (; paused.cursor < triggers.size(); paused.cursor++) {
+      const PendingTrigger &trig = triggers[paused.cursor];
+      const CardDef *card = getCardDef(trig.sourceName);
+      if (card != nullptr && trig.abilityIndex < static_cast<int>(card->triggeredAbilities.size()) &&
+          card->triggeredAbilities[trig.abilityIndex].isMay) {
+        return DecisionRequest{DecisionKind::USE_MAY_TRIGGER, trig.controller, {trig}, {}};
+      }
+    }
+    paused.phase = Phase::ORDER;
+    paused.cursor = 0;
+  }
+
+  if (paused.phase == Phase::ORDER) {
+    // APNAP has grouped each player's triggers together; copies of one ability need no ordering
+    while (paused.cursor < triggers.size()) {
+      size_t begin = paused.cursor;
+      size_t end = begin + 1;
+      bool distinct = false;
+      while (end < triggers.size() && triggers[end].controller == triggers[begin].controller) {
+        distinct = distinct || triggers[end].sourceId != triggers[begin].sourceId ||
+                   triggers[end].abilityIndex != triggers[begin].abilityIndex;
+        end++;
+      }
+      if (distinct) {
+        return DecisionRequest{DecisionKind::ORDER_TRIGGERS, triggers[begin].controller,
+                               vector<PendingTrigger>(triggers.begin() + static_cast<ptrdiff_t>(begin),
+                                                      triggers.begin() + static_cast<ptrdiff_t>(end)),
+                               {}};
+      }
+      paused.cursor = end;
+    }
+    paused.phase = Phase::TARGET;
+    paused.cursor = 0;
+    paused.targets.assign(triggers.size(), StackItem());
+  }
+
+  for (; paused.cursor < triggers.size(); paused.cursor++) {
+    const PendingTrigger &trig = triggers[paused.cursor];
+    TargetType target = triggerTarget(trig);
+    if (target == TargetType::NONE) {
+      continue;
+    }
+    StackItem blank;
+    blank.kind = "TRIGGERED_ABILITY";
+    blank.sourceName = trig.sourceName;
+    blank.sourceId = trig.sourceId;
+    blank.abilityIndex = trig.abilityIndex;
+    blank.controller = trig.controller;
+    vector<StackItem> options = candidatesFor(blank, target);
+    if (!options.empty()) {
+      return DecisionRequest{DecisionKind::CHOOSE_TARGET, trig.controller, {trig}, std::move(options)};
+    }
+  }
+  return nullopt;
+}
+
+void Engine::applyAnswer(const DecisionAnswer &answer) {
+  // Check the answer fits the request before anything changes, then move the cursor past it
+
+  SuspendedRun &paused = *suspended;
+  const DecisionRequest &request = *paused.pending;
+  vector<PendingTrigger> &triggers = paused.triggers;
+
+  switch (request.kind) {
+  case DecisionKind::USE_MAY_TRIGGER:
+    if (answer.accept) {
+      paused.cursor++;
+    } else {
+      triggers.erase(triggers.begin() + static_cast<ptrdiff_t>(paused.cursor));
+    }
+    break;
+
+  case DecisionKind::ORDER_TRIGGERS: {
+    size_t count = request.triggers.size();
+    vector<bool> seen(count, false);
+    bool permutation = (answer.order.size() == count);
+    for (size_t index : answer.order) {
+      permutation = permutation && index < count && !seen[index];
+      if (index < count) {
+        seen[index] = true;
+      }
+    }
+    if (!permutation) {
+      throw runtime_error("answer: ORDER_TRIGGERS needs each of 0.." + to_string(count - 1) + " exactly once");
+    }
+    for (size_t i = 0; i < count; i++) {
+      triggers[paused.cursor + i] = request.triggers[answer.order[i]];
+    }
+    paused.cursor += count;
+    break;
+  }
+
+  case DecisionKind::CHOOSE_TARGET:
+    if (answer.choice && *answer.choice >= request.options.size()) {
+      throw runtime_error("answer: CHOOSE_TARGET choice must be below " + to_string(request.options.size()));
+    }
+    if (answer.choice) {
+      paused.targets[paused.cursor] = request.options[*answer.choice];
+    }
+    paused.cursor++;
+    break;
+  }
+}
+
+void Engine::pushStagedTriggers() {
+  // Every decision is in: the triggers go on the stack in their final order, with their targets
+
+  SuspendedRun &paused = *suspended;
+  for (size_t i = 0; i < paused.triggers.size(); i++) {
+    StackItem item = triggerItem(paused.triggers[i]);
+    if (i < paused.targets.size()) {
+      item.targetId = paused.targets[i].targetId;
+      item.targetPlayer = paused.targets[i].targetPlayer;
+      item.targetStackId = paused.targets[i].targetStackId;
+    }
+    pushItem(std::move(item));
+  }
+  paused.step.newTriggers = std::move(paused.triggers);
+  paused.triggers.clear();
+}
+
+// ----------------------------- Target Choices ----------------------------- //
+
+auto Engine::targetCandidates(const StackItem &spell) -> vector<StackItem> {
+  const CardDef *card = getCardDef(spell.sourceName);
+  if (card == nullptr) {
+    return {};
+  }
+
+  StackItem blank = spell;
+  blank.targetId.clear();
+  blank.targetPlayer.clear();
+  blank.targetStackId.clear();
+
+  // Cards given explicit spellEffects may leave spellTarget unset; their first effect says what it hits
+  TargetType target = card->spellTarget;
+  if (target == TargetType::NONE && !card->spellEffects.empty()) {
+    target = card->spellEffects.front().target;
+  }
+  return candidatesFor(blank, target);
+}
+
+auto Engine::candidatesFor(const StackItem &item, TargetType target) -> vector<StackItem> {
+  // Walk players and permanents in id order so the list is stable
+
+  vector<StackItem> candidates;
+  bool players = (target == TargetType::ANY_TARGET || target == TargetType::PLAYER || target == TargetType::OPPONENT);
+  bool permanents = (target == TargetType::ANY_TARGET || target == TargetType::CREATURE || target == TargetType::PERMANENT);
+
+  if (permanents) {
+    for (const auto &player : playerOrder) {
+      for (auto &perm : state.boards[player].permanents) {
+        if (target != TargetType::PERMANENT && !isCreature(perm)) {
+          continue;
+        }
+        if (targetingBlockedBy(perm, item.controller) != nullptr) {
+          continue;
+        }
+        candidates.push_back(item);
+        candidates.back().targetId = perm.id;
+      }
+    }
+  }
+
+  if (players) {
+    for (const auto &player : playerOrder) {
+      if (target == TargetType::OPPONENT && player == item.controller) {
+        continue;
+      }
+      candidates.push_back(item);
+      candidates.back().targetPlayer = player;
+    }
+  }
+
+  if (target == TargetType::SPELL) {
+    // Only spells: "counter target spell" can't hit an ability on the stack
+    for (const auto &other : stack.items()) {
+      if (other.id != item.id && other.kind == "SPELL") {
+        candidates.push_back(item);
+        candidates.back().targetStackId = other.id;
+      }
+    }
+  }
+  return candidates;
+}
+
+// ----------------------------- Session Control ----------------------------- //
+
+void Engine::pushItem(StackItem item) {
+  if (trackDeltas) {
+    pushedItems.push_back(item);
+  }
+  stack.push(std::move(item));
+}
+
+void Engine::journalPopped(const ObjectID &itemId) {
+  if (trackDeltas) {
+    poppedItems.push_back(itemId);
+  }
+}
+
+auto Engine::resolveOne(bool &loopDetected) -> optional<ResolutionStep> {
+  loopDetected = false;
+  if (!hasWork()) {
+    return nullopt;
+  }
+  ResolutionStep step = advance();
+  loopDetected = checkForLoop();
+  return step;
+}
+
+void Engine::push(StackItem item) {
+  editCount++;
+  pushItem(std::move(item));
+}
+
+void Engine::reserveIds(const vector<ObjectID> &objectIds) {
+  // Only affects ids minted from now on
+
+  givenIds.insert(objectIds.begin(), objectIds.end());
+}
+
+auto Engine::addPermanent(Permanent perm) -> bool {
+  auto board = state.boards.find(perm.controller);
+  if (board == state.boards.end() || findPermanent(perm.id) != nullptr) {
+    return false;
+  }
+  editCount++;
+  fingerprintAdd(perm);
+  givenIds.insert(perm.id);
+  board->second.permanents.push_back(std::move(perm));
+  return true;
+}
+
+auto Engine::removePermanent(const ObjectID &objectId) -> bool {
+  for (auto &[playerId, board] : state.boards) {
+    for (auto it = board.permanents.begin(); it != board.permanents.end(); ++it) {
+      if (it->id == objectId) {
+        editCount++;
+        fingerprintRemove(*it);
+        board.permanents.erase(it);
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+auto Engine::setLife(const PlayerID &player, int life) -> bool {
+  auto board = state.boards.find(player);
+  if (board == state.boards.end()) {
+    return false;
+  }
+  editCount++;
+  board->second.life = life;
+  return true;
+}
+
+void Engine::enableDeltas() {
+  // Everything up to now counts as already reported
+
+  trackDeltas = true;
+  takeDelta();
+}
+
+auto Engine::takeDelta() -> StateDelta {
+  // Turn the journal into a delta and reset it
+
+  StateDelta delta;
+  for (const auto &objectId : touchedPermanents) {
+    if (const Permanent *perm = findPermanent(objectId)) {
+      delta.changed.push_back(*perm);
+    } else {
+      delta.removed.push_back(objectId);
+    }
+  }
+  touchedPermanents.clear();
+
+  for (const auto &[playerId, board] : state.boards) {
+    auto reported = reportedLife.find(playerId);
+    if (reported == reportedLife.end() || reported->second != board.life) {
+      delta.life[playerId] = board.life;
+      reportedLife[playerId] = board.life;
+    }
+  }
+  for (const auto &[playerId, drawn] : output.cardsDrawn) {
+    auto reported = reportedDrawn.find(playerId);
+    if (reported == reportedDrawn.end() || reported->second != drawn) {
+      delta.cardsDrawn[playerId] = drawn;
+      reportedDrawn[playerId] = drawn;
+    }
+  }
+
+  // Items pushed and popped within the same delta cancel out
+  unordered_set<ObjectID> transient;
+  unordered_set<ObjectID> pushedIds;
+  for (const auto &item : pushedItems) {
+    pushedIds.insert(item.id);
+  }
+  for (const auto &itemId : poppedItems) {
+    if (pushedIds.count(itemId) != 0) {
+      transient.insert(itemId);
+    } else {
+      delta.popped.push_back(itemId);
+    }
+  }
+  for (auto &item : pushedItems) {
+    if (transient.count(item.id) == 0) {
+      delta.pushed.push_back(std::move(item));
+    }
+  }
+  pushedItems.clear();
+  poppedItems.clear();
+  return delta;
 }
@@ -6,39 +6,190 @@
 #ifndef ENGINE_H
 #define ENGINE_H
 
+#include "card_database.h"
+#include "combat.h"
+#include "context.h"
+#include "decision.h"
+#include "fingerprint.h"
+#include "game_stack.h"
+#include "step_sink.h"
 #include "types.h"
 
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <optional>
+#include <string_view>
+#include <unordered_set>
+
 using namespace std;
 
+// Ids the engine mints for tokens (and split-off token copies) are this plus a counter
+inline constexpr string_view kTokenIdPrefix = "token_";
+
+class CancellationToken {
+  // Flip from any thread (or a signal handler) to stop a run at the next resolution
+
+  atomic<bool> flag{false};
+
+public:
+  void cancel() { flag.store(true, memory_order_relaxed); }
+  auto cancelled() const -> bool { return flag.load(memory_order_relaxed); }
+};
+
+class Engine;
+
+struct RunOptions {
+  // Budgets checked before each resolveTop; 0 means unlimited
+  int maxSteps = 0;
+  size_t maxStackDepth = 0;
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::time_point::max();
+  const CancellationToken *cancel = nullptr;
+
+  // Called with the top item just before it resolves (--record / --replay); unset costs nothing
+  function<void(const StackItem &)> onResolve;
+
+  // Called each time players get priority with something on the stack; may push() responses
+  function<void(Engine &)> onPriority;
+
+  // Completed steps stream here instead of piling up in Output::steps (see step_sink.h)
+  StepSink *steps = nullptr;
+};
+
+struct StateDelta {
+  // What changed since the last takeDelta() (session mode)
+  vector<Permanent> changed;                // Added or modified permanents, current state
+  vector<ObjectID> removed;                 // Permanents that left the battlefield
+  unordered_map<PlayerID, int> life;        // New life totals of players whose life changed
+  unordered_map<PlayerID, int> cardsDrawn;  // New draw counts that changed
+  vector<StackItem> pushed;                 // Put on the stack, bottom -> top
+  vector<ObjectID> popped;                  // Left the stack (resolved or countered)
+};
+
 class Engine {
   // Simulates stack resolution (LIFO, checks triggers after each resolution)
 
-  GameInput state;                // Current game state (modified as we resolve)
+  shared_ptr<const CardDatabase> cards;  // Borrowed card pool (never copied)
+  const Context *context;         // Debug switch and trace stream (read only)
+  GameInput state;                // Current game state (modified as we resolve; state.cards is moved out)
+  GameStack stack;                // The stack, indexed by item id (state.stack is moved in here)
   Output output;                  // Results we're building up
   int triggerCount = 0;           // Ror generating trigger IDs
 
+  uint64_t boardFingerprint = 0;  // Sum of hashPermanent over every permanent (updated as they change)
+  vector<PlayerID> playerOrder;   // Fixed player order for loop snapshots
+  LoopDetector loopDetector;
+  uint64_t editCount = 0;         // Direct edits (push, addPermanent, ...): states from before one never repeat
+
+  // state.combat plays out once the stack is empty, one stage per step
+  enum class CombatStage { DECLARE_ATTACKERS, COMBAT_DAMAGE, REGULAR_DAMAGE, DONE };
+  CombatStage combatStage = CombatStage::DONE;
+
+  vector<Permanent> departed;     // Died during the current step and have dies triggers (they look back)
+
+  unordered_map<string, CardDef> tokenDefs;  // Generic token cards not in the pool
+  mutable unordered_set<string> deferredLookups;  // Deferred pool cards looked up (see takeDeferredLookups)
+  int tokenCount = 0;             // For generating token ids
+  unordered_set<ObjectID> givenIds;  // Permanent ids from the input / session; minted ids skip these
+
+  // Change journal for takeDelta (only kept once enableDeltas is called)
+  bool trackDeltas = false;
+  unordered_set<ObjectID> touchedPermanents;
+  vector<StackItem> pushedItems;
+  vector<ObjectID> poppedItems;
+  unordered_map<PlayerID, int> reportedLife;
+  unordered_map<PlayerID, int> reportedDrawn;
+
+  // A run stopped at a player decision (start / answer); run() never stops at one
+  struct SuspendedRun {
+    enum class Phase { MAY, ORDER, TARGET };
+
+    RunOptions options;
+    int stepsTaken = 0;
+    bool staging = false;                   // step has resolved, its triggers aren't on the stack yet
+    ResolutionStep step;
+    vector<PendingTrigger> triggers;        // APNAP order, answers so far applied
+    vector<StackItem> targets;              // TARGET phase on: chosen target fields, parallel to triggers
+    Phase phase = Phase::MAY;
+    size_t cursor = 0;                      // Trigger (or first of a player's triggers) to ask about next
+    optional<DecisionRequest> pending;
+  };
+  optional<SuspendedRun> suspended;
+
   auto getCardDef(const string &name) const -> const CardDef *;
   auto findPermanent(const ObjectID &objectId) -> Permanent *;
+  auto findSingle(const ObjectID &objectId) -> Permanent *;
+  auto indexPermanents() -> unordered_map<ObjectID, Permanent *>;  // Valid until permanents are added/removed
+  auto nextTokenId() -> ObjectID;
+  auto tokenDef(const Effect &effect) -> const CardDef &;
   auto getTurnOrder(const PlayerID &player) const -> int;
-  auto hasKeyword(const string &cardName, const string &keyword) const -> bool;
+  auto hasKeyword(const string &cardName, Keyword keyword) const -> bool;
+  auto hasCardType(const Permanent &perm, const string &upper) const -> bool;
+  auto isCreature(const Permanent &perm) const -> bool;
+
+  // "hexproof" / "shroud" if caster can't target the permanent, nullptr if it can
+  auto targetingBlockedBy(Permanent &target, const PlayerID &caster) const -> const char *;
+
+  // Effective power/toughness/keywords of a permanent; recomputed only after a contributing change
+  auto characteristics(Permanent &perm) const -> const Characteristics &;
+  static void invalidate(Permanent &perm) { perm.characteristicsDirty = true; }
 
 
   auto validatePriority(const StackItem &item) -> bool;
 
+  // Call around every change to a permanent so the board fingerprint stays current
+  void fingerprintRemove(const Permanent &perm);
+  void fingerprintAdd(const Permanent &perm);
+  auto checkForLoop() -> bool;
+  auto checkBudget(const RunOptions &options, int stepsTaken) -> StopReason;
+
+  // The pieces of run's loop that start / answer share
+  auto beginStep(const RunOptions &options, int &stepsTaken) -> bool;  // false: a budget ran out
+  void recordStep(const RunOptions &options, ResolutionStep step);
+  void finishRun();
 
-  static auto triggerMatches(const TriggerCondition &trig, const GameEvent &event, const Permanent &source) -> bool;
-  auto findTriggersForEvent(const GameEvent &event) -> vector<PendingTrigger>;
+  // Stack changes go through these so the delta journal sees them
+  void pushItem(StackItem item);
+  void journalPopped(const ObjectID &itemId);
+
+
+  static auto triggerCopies(const TriggerCondition &trig, const GameEvent &event, const Permanent &source) -> int;
+  // Every trigger a step's events cause, event by event; the battlefield (plus this step's dead) is
+  // scanned once per call
+  auto findTriggersForEvents(const vector<GameEvent> &events) -> vector<PendingTrigger>;
   static auto orderAPNAP(vector<PendingTrigger> triggers) -> vector<PendingTrigger>;
   void addTriggersToStack(const vector<PendingTrigger> &triggers);
+  auto triggerItem(const PendingTrigger &trig) -> StackItem;   // Gives out the next trig_N id
 
   auto resolveTop() -> ResolutionStep;
+  auto resolveNext(vector<PendingTrigger> &triggers) -> ResolutionStep;  // resolveTop (or the next combat stage); triggers it caused in APNAP order
+  auto advance() -> ResolutionStep;       // resolveNext + put the triggers on the stack
+
+  // Decision walk over the staged triggers (see decision.h)
+  auto triggerTarget(const PendingTrigger &trig) const -> TargetType;  // What the ability targets (NONE: nothing to choose)
+  auto nextDecision() -> optional<DecisionRequest>;
+  void applyAnswer(const DecisionAnswer &answer);
+  void pushStagedTriggers();
+  auto proceed() -> RunState;
+
+  // Copies of item, one per legal target of the given kind
+  auto candidatesFor(const StackItem &item, TargetType target) -> vector<StackItem>;
+  auto hasWork() const -> bool { return !stack.empty() || combatStage != CombatStage::DONE; }
+
+  auto combatStep() -> ResolutionStep;
+  void declareAttackers(ResolutionStep &step);
+  auto resolveCombatDamage(bool afterFirstStrike, ResolutionStep &step) -> bool;  // true if regular damage follows
   void resolveSpell(const StackItem &item, ResolutionStep &step);
   void resolveTriggeredAbility(const StackItem &item, ResolutionStep &step);
   void destroyPermanent(const ObjectID &objectId, vector<GameEvent> &events);
+  void destroyPermanents(const vector<ObjectID> &objectIds, vector<GameEvent> &events, bool sacrifice = false);  // One pass per board
+  void rememberDeparted(const Permanent &perm);
 
   void resolveDealDamageEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveCounterEffect(const StackItem &item, ResolutionStep &step);
   void resolveDestroyEffect(const StackItem &item, ResolutionStep &step);
+  void resolveDestroyAllEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
+  void resolveSacrificeEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveAddCountersEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveRemoveCountersEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveChangePowerEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
@@ -47,12 +198,59 @@ class Engine {
   void resolveGainLifeEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveLoseLifeEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
   void resolveDrawCardsEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
+  void resolveCreateTokenEffect(const StackItem &item, const Effect &effect, ResolutionStep &step);
 
 public:
-  explicit Engine(GameInput input);
+  // Takes the boards and stack by move and shares input.cards; nothing here scales with the card pool
+  explicit Engine(GameInput input, const Context &context = Context::defaults());
   
-  // Run until the stack is empty
-  auto run() -> Output;
+  // Run until the stack is empty (or a budget in options runs out)
+  auto run(const RunOptions &options = {}) -> Output;
+
+  // ---- Player decisions (see decision.h) ----
+
+  // Like run, but stop at the first choice a player has to make; answer resumes from that point.
+  // Once either returns FINISHED, result() holds the Output
+  auto start(const RunOptions &options = {}) -> RunState;
+  auto answer(const DecisionAnswer &answer) -> RunState;
+  auto pendingDecision() const -> const DecisionRequest * {
+    return suspended && suspended->pending ? &*suspended->pending : nullptr;
+  }
+
+  // ---- Step-by-step control (session mode) ----
+
+  // Resolve only the top item; nullopt if the stack is empty. loopDetected is set if the state
+  // has started repeating (details in result().loop)
+  auto resolveOne(bool &loopDetected) -> optional<ResolutionStep>;
+
+  // Direct state edits; these don't cause triggers
+  void push(StackItem item);
+  auto addPermanent(Permanent perm) -> bool;             // false if the id exists or the player doesn't
+
+  // Ids token minting must skip besides the permanents' own (a renamed cached run passes the caller's)
+  void reserveIds(const vector<ObjectID> &objectIds);
+  auto removePermanent(const ObjectID &objectId) -> bool;
+  auto setLife(const PlayerID &player, int life) -> bool;
+
+  auto boards() const -> const unordered_map<PlayerID, Board> & { return state.boards; }
+  auto stackItems() const -> vector<StackItem> { return stack.items(); }
+  auto topItem() const -> const StackItem * { return stack.empty() ? nullptr : &stack.top(); }
+  auto topSpell() const -> const StackItem * { return stack.topmost("SPELL"); }
+  auto result() const -> const Output & { return output; }
+  auto activePlayer() const -> const PlayerID & { return state.activePlayer; }
+  auto priorityPlayer() const -> const PlayerID & { return state.priorityPlayer; }
+
+  // Copies of a spell, one per legal choice for its card's spellTarget (hexproof/shroud as in
+  // resolveSpell); empty if the card has nothing to choose
+  auto targetCandidates(const StackItem &spell) -> vector<StackItem>;
+
+  // Deferred (--lazy-cards) pool cards looked up since the previous call; their syntax errors come
+  // from CardDatabase::deferredErrors, so each run reports its own cards' errors
+  auto takeDeferredLookups() -> unordered_set<string>;
+
+  // Start journaling changes; takeDelta returns everything since the previous call
+  void enableDeltas();
+  auto takeDelta() -> StateDelta;
 };
 
 #endif
@@ -0,0 +1,116 @@
+#include "fingerprint.h"
+
+#include <algorithm>
+
+using namespace std;
+
+// ----------------------------- Hashing ----------------------------- //
+
+auto mixHash(uint64_t value) -> uint64_t {
+  // splitmix64 finaliser
+
+  value += 0x9E3779B97F4A7C15ULL;
+  value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+  return value ^ (value >> 31);
+}
+
+auto hashString(string_view text) -> uint64_t {
+  // FNV-1a
+
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (char c : text) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+static auto combine(uint64_t seed, uint64_t value) -> uint64_t {
+  return mixHash(seed ^ (value + 0x9E3779B97F4A7C15ULL + (seed << 6) + (seed >> 2)));
+}
+
+auto hashPermanent(const Permanent &perm) -> uint64_t {
+  uint64_t hash = hashString(perm.cardName);
+  hash = combine(hash, hashString(perm.controller));
+  hash = combine(hash, perm.tapped ? 1 : 0);
+  hash = combine(hash, static_cast<uint64_t>(perm.damage));
+  hash = combine(hash, static_cast<uint64_t>(perm.powerModifier));
+  hash = combine(hash, static_cast<uint64_t>(perm.toughnessModifier));
+  hash = combine(hash, static_cast<uint64_t>(perm.counters));
+  hash = combine(hash, perm.isToken ? 1 : 0);
+  hash = combine(hash, static_cast<uint64_t>(perm.count));
+  return hash;
+}
+
+auto hashStackItem(const StackItem &item) -> uint64_t {
+  // What the item is; GameStack weights it by where it sits
+
+  uint64_t hash = hashString(item.kind);
+  hash = combine(hash, hashString(item.sourceName));
+  hash = combine(hash, static_cast<uint64_t>(item.abilityIndex));
+  hash = combine(hash, hashString(item.controller));
+  hash = combine(hash, hashString(item.targetId));
+  hash = combine(hash, hashString(item.targetPlayer));
+  return combine(hash, hashString(item.targetStackId));
+}
+
+// ----------------------------- Loop Detection ----------------------------- //
+
+auto LoopDetector::at(int step) const -> const Snapshot * {
+  // Snapshot for a step, if it's still inside the window
+
+  if (step < 0 || step >= steps || steps - step > static_cast<int>(window)) {
+    return nullptr;
+  }
+  return &ring[static_cast<size_t>(step) % window];
+}
+
+auto LoopDetector::observe(uint64_t fingerprint, vector<int> counters) -> optional<Match> {
+  int step = steps;
+  optional<Match> match;
+
+  auto seen = lastSeen.find(fingerprint);
+  if (seen != lastSeen.end()) {
+    int prev = seen->second;
+    int period = step - prev;
+    const Snapshot *prevSnap = at(prev);
+    const Snapshot *firstSnap = at(prev - period);
+
+    // Need two full laps with identical deltas before calling it a loop
+    if (prevSnap != nullptr && firstSnap != nullptr && prevSnap->fingerprint == fingerprint &&
+        firstSnap->fingerprint == fingerprint) {
+      vector<int> delta(counters.size());
+      bool repeating = true;
+      for (size_t i = 0; i < counters.size(); i++) {
+        delta[i] = counters[i] - prevSnap->counters[i];
+        if (prevSnap->counters[i] - firstSnap->counters[i] != delta[i]) {
+          repeating = false;
+          break;
+        }
+      }
+      if (repeating) {
+        match = Match{period, prev - period, std::move(delta)};
+      }
+    }
+  }
+
+  // Remember this step (overwrites the oldest slot once the ring is full)
+  if (ring.size() < window) {
+    ring.push_back({fingerprint, std::move(counters)});
+  } else {
+    ring[static_cast<size_t>(step) % window] = {fingerprint, std::move(counters)};
+  }
+  lastSeen[fingerprint] = step;
+  steps++;
+
+  // Forget fingerprints that fell out of the window so memory stays bounded
+  if (lastSeen.size() > 2 * window) {
+    lastSeen.clear();
+    for (int s = max(0, steps - static_cast<int>(window)); s < steps; s++) {
+      lastSeen[ring[static_cast<size_t>(s) % window].fingerprint] = s;
+    }
+  }
+
+  return match;
+}
@@ -0,0 +1,58 @@
+/*
+  Hashes for game state and the loop detector built on them. Board and stack fingerprints are sums
+  of per-object hashes, so the engine can update them incrementally (subtract the old hash, add the
+  new one) as it mutates permanents and pushes/pops stack items.
+
+  Object ids are left out on purpose: a death/ETB loop mints fresh ids every lap, but the state is
+  the same shape each time.
+*/
+
+#ifndef FINGERPRINT_H
+#define FINGERPRINT_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+auto mixHash(uint64_t value) -> uint64_t;
+auto hashString(string_view text) -> uint64_t;
+auto hashPermanent(const Permanent &perm) -> uint64_t;
+auto hashStackItem(const StackItem &item) -> uint64_t;
+
+class LoopDetector {
+  // Watches one fingerprint + counter snapshot per step and reports a loop once the same state
+  // shows up three times at a fixed period with the counters moving by the same delta each lap.
+
+  struct Snapshot {
+    uint64_t fingerprint = 0;
+    vector<int> counters;
+  };
+
+  size_t window;                            // How many recent steps we remember
+  vector<Snapshot> ring;
+  unordered_map<uint64_t, int> lastSeen;    // Fingerprint -> most recent step
+  int steps = 0;
+
+  auto at(int step) const -> const Snapshot *;
+
+public:
+  static constexpr size_t kDefaultWindow = 1024;
+
+  struct Match {
+    int period = 0;
+    int firstStep = 0;                      // 0-based step where the repeated state first appeared
+    vector<int> delta;                      // Counter change per lap
+  };
+
+  explicit LoopDetector(size_t windowSize = kDefaultWindow) : window(windowSize) {}
+
+  auto observe(uint64_t fingerprint, vector<int> counters) -> optional<Match>;
+};
+
+#endif
@@ -0,0 +1,175 @@
+#include "game_stack.h"
+#include "fingerprint.h"
+
+using namespace std;
+
+// Don't bother compacting tiny stacks
+static constexpr size_t kCompactThreshold = 32;
+
+// Odd, so multiplying by it is invertible mod 2^64 and no position weight collapses to zero
+static constexpr uint64_t kPositionBase = 0x9E3779B97F4A7C15ULL;
+
+GameStack::GameStack(vector<StackItem> items) {
+  slots.reserve(items.size());
+  live.reserve(items.size());
+  itemHashes.reserve(items.size());
+  for (auto &item : items) {
+    push(std::move(item));
+  }
+}
+
+void GameStack::trimTop() {
+  while (!live.empty() && live.back() == 0) {
+    live.pop_back();
+    slots.pop_back();
+    itemHashes.pop_back();
+  }
+}
+
+void GameStack::setLeaf(size_t slot, bool isLive) {
+  // Left child holds the lower slots, so the right child's positions start after its live items
+
+  size_t node = leafBase + slot;
+  hashTree[node] = isLive ? HashNode{itemHashes[slot], kPositionBase} : HashNode{};
+  for (node /= 2; node > 0; node /= 2) {
+    const HashNode &low = hashTree[2 * node];
+    const HashNode &high = hashTree[2 * node + 1];
+    hashTree[node] = HashNode{low.hash + high.hash * low.scale, low.scale * high.scale};
+  }
+}
+
+void GameStack::rebuildHashTree() {
+  // Leaves first, then every parent from the bottom level up
+
+  leafBase = 1;
+  while (leafBase < slots.size()) {
+    leafBase *= 2;
+  }
+  hashTree.assign(2 * leafBase, HashNode{});
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (live[i] != 0) {
+      hashTree[leafBase + i] = HashNode{itemHashes[i], kPositionBase};
+    }
+  }
+  for (size_t node = leafBase - 1; node > 0; node--) {
+    const HashNode &low = hashTree[2 * node];
+    const HashNode &high = hashTree[2 * node + 1];
+    hashTree[node] = HashNode{low.hash + high.hash * low.scale, low.scale * high.scale};
+  }
+}
+
+void GameStack::compact() {
+  // Slide live items down over the tombstones and re-point the index
+
+  size_t out = 0;
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (live[i] == 0) {
+      continue;
+    }
+    if (out != i) {
+      slots[out] = std::move(slots[i]);
+      itemHashes[out] = itemHashes[i];
+    }
+    if (!slots[out].id.empty()) {
+      slotOf[slots[out].id] = out;
+    }
+    out++;
+  }
+  slots.resize(out);
+  itemHashes.resize(out);
+  live.assign(out, 1);
+  rebuildHashTree();
+}
+
+void GameStack::push(StackItem item) {
+  if (!item.id.empty()) {
+    slotOf[item.id] = slots.size();
+  }
+  slots.push_back(std::move(item));
+  itemHashes.push_back(hashStackItem(slots.back()));
+  live.push_back(1);
+  liveCount++;
+
+  // Doubling keeps the rebuilds amortized O(1) per push
+  if (slots.size() > leafBase) {
+    rebuildHashTree();
+  } else {
+    setLeaf(slots.size() - 1, true);
+  }
+}
+
+auto GameStack::pop() -> StackItem {
+  // LIFO: back() is always live thanks to trimTop
+
+  StackItem item = std::move(slots.back());
+  slots.pop_back();
+  liveCount--;
+  setLeaf(slots.size(), false);
+  itemHashes.pop_back();
+  live.pop_back();
+
+  auto it = slotOf.find(item.id);
+  if (it != slotOf.end() && it->second == slots.size()) {
+    slotOf.erase(it);
+  }
+
+  trimTop();
+  return item;
+}
+
+auto GameStack::top() const -> const StackItem & {
+  return slots.back();
+}
+
+auto GameStack::remove(const ObjectID &itemId) -> bool {
+  // Tombstone the slot; no shifting. Clearing its leaf re-combines one path of the hash tree, and
+  // the items above move down a position there, so the fingerprint matches a stack that never held it.
+
+  auto it = slotOf.find(itemId);
+  if (it == slotOf.end()) {
+    return false;
+  }
+
+  size_t slot = it->second;
+  slotOf.erase(it);
+  setLeaf(slot, false);
+  live[slot] = 0;
+  slots[slot] = StackItem{};                // Release the strings now
+  liveCount--;
+
+  trimTop();
+
+  size_t tombstones = slots.size() - liveCount;
+  if (tombstones > kCompactThreshold && tombstones > liveCount) {
+    compact();
+  }
+  return true;
+}
+
+auto GameStack::find(const ObjectID &itemId) const -> const StackItem * {
+  auto it = slotOf.find(itemId);
+  if (it == slotOf.end()) {
+    return nullptr;
+  }
+  return &slots[it->second];
+}
+
+auto GameStack::topmost(const string &kind) const -> const StackItem * {
+  for (size_t i = slots.size(); i-- > 0;) {
+    if (live[i] != 0 && slots[i].kind == kind) {
+      return &slots[i];
+    }
+  }
+  return nullptr;
+}
+
+auto GameStack::items() const -> vector<StackItem> {
+  vector<StackItem> out;
+  out.reserve(liveCount);
+  for (size_t i = 0; i < slots.size(); i++) {
+    if (live[i] != 0) {
+      out.push_back(slots[i]);
+    }
+  }
+  return out;
+}
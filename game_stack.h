@@ -0,0 +1,79 @@
+/*
+  The stack as the engine sees it: LIFO push/pop plus O(1) lookup by id and O(log n) removal by id,
+  so countering a spell deep in the stack (or checking whether a counterspell's target is still
+  there) doesn't scan or shift the whole vector. Removed items leave a tombstone that's trimmed when
+  it reaches the top, or compacted away once tombstones outnumber live items. The fingerprint is
+  kept in a small tree over the slots that skips tombstones, so it only depends on the live items.
+*/
+
+#ifndef GAME_STACK_H
+#define GAME_STACK_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+class GameStack {
+  vector<StackItem> slots;                  // Bottom -> top, including tombstones
+  vector<uint8_t> live;                     // 1 if slots[i] is still on the stack
+  vector<uint64_t> itemHashes;              // hashStackItem(slots[i]), so a rebuild doesn't rehash strings
+  unordered_map<ObjectID, size_t> slotOf;   // Item id -> slot (ids are unique on the stack)
+  size_t liveCount = 0;
+
+  // One node per range of slots: hash = sum of itemHash * B^position over the range's live items
+  // (positions counted from the range's bottom), scale = B^(live items in the range)
+  struct HashNode {
+    uint64_t hash = 0;
+    uint64_t scale = 1;
+  };
+  vector<HashNode> hashTree;                // Implicit binary tree, leaves at [leafBase, 2 * leafBase)
+  size_t leafBase = 0;
+
+  // Drop tombstones sitting on top so back() is always live
+  void trimTop();
+
+  // Rebuild slots without tombstones (invalidates slot numbers; the fingerprint stays)
+  void compact();
+
+  // Point a slot's leaf at its item (or at nothing) and re-combine the path to the root
+  void setLeaf(size_t slot, bool isLive);
+
+  // Size the tree for the current slots and recompute every node
+  void rebuildHashTree();
+
+public:
+  GameStack() = default;
+  explicit GameStack(vector<StackItem> items);
+
+  void push(StackItem item);
+
+  // Remove and return the top item (stack must not be empty)
+  auto pop() -> StackItem;
+
+  // Topmost item (stack must not be empty)
+  auto top() const -> const StackItem &;
+
+  // Take an item off the stack wherever it is; false if it isn't there
+  auto remove(const ObjectID &itemId) -> bool;
+
+  auto contains(const ObjectID &itemId) const -> bool { return slotOf.count(itemId) != 0; }
+  auto find(const ObjectID &itemId) const -> const StackItem *;
+
+  // Topmost live item of the given kind ("SPELL", "TRIGGERED_ABILITY"), or nullptr
+  auto topmost(const string &kind) const -> const StackItem *;
+
+  auto empty() const -> bool { return liveCount == 0; }
+  auto size() const -> size_t { return liveCount; }
+
+  // Order-aware hash of the live items (ids excluded), kept up to date on every change
+  auto fingerprint() const -> uint64_t { return hashTree.empty() ? 0 : hashTree[1].hash; }
+
+  // Live items bottom -> top (for output and snapshots)
+  auto items() const -> vector<StackItem>;
+};
+
+#endif
@@ -0,0 +1,687 @@
+/*
+  Build-time tool: reads the input grammar (data/bnf.txt), checks that it is LL(1), and writes
+  grammar_tables.h, the tables Parser dispatches on. The Makefile runs it whenever the grammar
+  changes; it isn't linked into the engine.
+
+    ./grammar_gen data/bnf.txt > grammar_tables.h
+
+  What comes out, per JSON object the grammar describes (every <x_fields> rule):
+    - an enum of its fields, in grammar order (CardDefField::POWER, ...)
+    - each field's value shape, for checking the token that starts the value
+    - a collision-free hash from key to field (the LL(1) prediction for that rule): one hash and
+      one compare per key instead of an if / else chain of string compares
+*/
+
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// ---- Grammar AST ----
+
+struct Node {
+  enum Kind { TERMINAL, NONTERMINAL, SEQUENCE, CHOICE, OPTIONAL, REPEAT };
+  Kind kind = SEQUENCE;
+  string text;                              // Terminal text (quotes decoded) or nonterminal name
+  vector<Node> children;
+};
+
+struct Rule {
+  string name;
+  Node body;
+};
+
+const set<string> kBuiltins = {"string", "number", "boolean", "keyword"};
+
+// ---- Reading data/bnf.txt ----
+
+auto lexGrammar(const string &source) -> vector<string> {
+  // Symbols: <name>, "terminal", ::=, | ( ) [ ] *  (';' starts a comment line)
+
+  vector<string> symbols;
+  istringstream lines(source);
+  string line;
+  while (getline(lines, line)) {
+    size_t i = line.find_first_not_of(" \t\r");
+    if (i == string::npos || line[i] == ';') {
+      continue;
+    }
+    while (i < line.size()) {
+      char c = line[i];
+      if (isspace(static_cast<unsigned char>(c)) != 0) {
+        i++;
+      } else if (c == '<') {
+        size_t end = line.find('>', i);
+        if (end == string::npos) {
+          throw runtime_error("unterminated <name>: " + line);
+        }
+        symbols.push_back(line.substr(i, end - i + 1));
+        i = end + 1;
+      } else if (c == '"') {
+        // Keep the quotes; \" stays escaped until decodeTerminal
+        size_t end = i + 1;
+        while (end < line.size() && line[end] != '"') {
+          end += (line[end] == '\\') ? 2 : 1;
+        }
+        if (end >= line.size()) {
+          throw runtime_error("unterminated terminal: " + line);
+        }
+        symbols.push_back(line.substr(i, end - i + 1));
+        i = end + 1;
+      } else if (line.compare(i, 3, "::=") == 0) {
+        symbols.emplace_back("::=");
+        i += 3;
+      } else if (string("|()[]*").find(c) != string::npos) {
+        symbols.emplace_back(1, c);
+        i++;
+      } else {
+        throw runtime_error(string("unexpected '") + c + "' in: " + line);
+      }
+    }
+  }
+  return symbols;
+}
+
+auto decodeTerminal(const string &quoted) -> string {
+  string text;
+  for (size_t i = 1; i + 1 < quoted.size(); i++) {
+    if (quoted[i] == '\\' && i + 2 < quoted.size()) {
+      i++;
+    }
+    text.push_back(quoted[i]);
+  }
+  return text;
+}
+
+class GrammarReader {
+  const vector<string> &symbols;
+  size_t pos = 0;
+
+  auto atRuleStart() const -> bool {
+    return pos + 1 < symbols.size() && symbols[pos][0] == '<' && symbols[pos + 1] == "::=";
+  }
+
+  auto atEnd() const -> bool { return pos >= symbols.size() || atRuleStart(); }
+
+  auto item() -> Node {
+    // atom '*'?
+
+    Node node;
+    const string &symbol = symbols[pos++];
+    if (symbol == "(" || symbol == "[") {
+      Node inner = choice();
+      string close = (symbol == "(") ? ")" : "]";
+      if (pos >= symbols.size() || symbols[pos] != close) {
+        throw runtime_error("expected '" + close + "'");
+      }
+      pos++;
+      if (symbol == "(") {
+        node = std::move(inner);
+      } else {
+        node.kind = Node::OPTIONAL;
+        node.children.push_back(std::move(inner));
+      }
+    } else if (symbol[0] == '<') {
+      node.kind = Node::NONTERMINAL;
+      node.text = symbol.substr(1, symbol.size() - 2);
+    } else if (symbol[0] == '"') {
+      node.kind = Node::TERMINAL;
+      node.text = decodeTerminal(symbol);
+    } else {
+      throw runtime_error("unexpected '" + symbol + "'");
+    }
+
+    if (pos < symbols.size() && symbols[pos] == "*") {
+      pos++;
+      Node repeat;
+      repeat.kind = Node::REPEAT;
+      repeat.children.push_back(std::move(node));
+      return repeat;
+    }
+    return node;
+  }
+
+  auto sequence() -> Node {
+    Node node;
+    node.kind = Node::SEQUENCE;
+    while (!atEnd() && symbols[pos] != "|" && symbols[pos] != ")" && symbols[pos] != "]") {
+      node.children.push_back(item());
+    }
+    return node.children.size() == 1 ? std::move(node.children.front()) : node;
+  }
+
+  auto choice() -> Node {
+    Node node;
+    node.kind = Node::CHOICE;
+    node.children.push_back(sequence());
+    while (pos < symbols.size() && symbols[pos] == "|") {
+      pos++;
+      node.children.push_back(sequence());
+    }
+    return node.children.size() == 1 ? std::move(node.children.front()) : node;
+  }
+
+public:
+  explicit GrammarReader(const vector<string> &symbols) : symbols(symbols) {}
+
+  auto rules() -> vector<Rule> {
+    vector<Rule> rules;
+    while (pos < symbols.size()) {
+      if (!atRuleStart()) {
+        throw runtime_error("expected '<name> ::=' before '" + symbols[pos] + "'");
+      }
+      Rule rule;
+      rule.name = symbols[pos].substr(1, symbols[pos].size() - 2);
+      pos += 2;
+      rule.body = choice();
+      rules.push_back(std::move(rule));
+    }
+    return rules;
+  }
+};
+
+// ---- LL(1) check ----
+
+class Analysis {
+  // FIRST sets over token classes: punctuation, "key:<name>", string, number, boolean, keyword
+
+  const map<string, const Rule *> &rules;
+  map<string, set<string>> firstOf;
+  map<string, bool> nullableOf;
+
+  static auto terminalClass(const string &text) -> string {
+    if (text.size() > 2 && text.front() == '"' && text.back() == '"') {
+      return "key:" + text.substr(1, text.size() - 2);
+    }
+    return text;
+  }
+
+public:
+  explicit Analysis(const map<string, const Rule *> &rules) : rules(rules) {
+    // Iterate to a fixpoint (the grammar may refer to rules defined later)
+
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (const auto &[name, rule] : rules) {
+        set<string> first = this->first(rule->body);
+        bool empty = nullable(rule->body);
+        if (first != firstOf[name] || empty != nullableOf[name]) {
+          firstOf[name] = std::move(first);
+          nullableOf[name] = empty;
+          changed = true;
+        }
+      }
+    }
+  }
+
+  auto nullable(const Node &node) -> bool {
+    switch (node.kind) {
+    case Node::TERMINAL:
+      return false;
+    case Node::NONTERMINAL:
+      return kBuiltins.count(node.text) == 0 && nullableOf[node.text];
+    case Node::SEQUENCE:
+      for (const auto &child : node.children) {
+        if (!nullable(child)) {
+          return false;
+        }
+      }
+      return true;
+    case Node::CHOICE:
+      for (const auto &child : node.children) {
+        if (nullable(child)) {
+          return true;
+        }
+      }
+      return false;
+    case Node::OPTIONAL:
+    case Node::REPEAT:
+      return true;
+    }
+    return false;
+  }
+
+  auto first(const Node &node) -> set<string> {
+    set<string> result;
+    switch (node.kind) {
+    case Node::TERMINAL:
+      result.insert(terminalClass(node.text));
+      break;
+    case Node::NONTERMINAL:
+      if (kBuiltins.count(node.text) != 0) {
+        result.insert(node.text);
+      } else {
+        result = firstOf[node.text];
+      }
+      break;
+    case Node::SEQUENCE:
+      for (const auto &child : node.children) {
+        set<string> part = first(child);
+        result.insert(part.begin(), part.end());
+        if (!nullable(child)) {
+          break;
+        }
+      }
+      break;
+    case Node::CHOICE:
+    case Node::OPTIONAL:
+    case Node::REPEAT:
+      for (const auto &child : node.children) {
+        set<string> part = first(child);
+        result.insert(part.begin(), part.end());
+      }
+      break;
+    }
+    return result;
+  }
+
+  static auto overlaps(const string &a, const string &b) -> bool {
+    // Keys, strings and keywords are all string tokens; two different keys are told apart
+    auto stringish = [](const string &c) { return c == "string" || c == "keyword" || c.rfind("key:", 0) == 0; };
+    if (a == b) {
+      return true;
+    }
+    if (a.rfind("key:", 0) == 0 && b.rfind("key:", 0) == 0) {
+      return false;
+    }
+    return stringish(a) && stringish(b);
+  }
+
+  static auto conflict(const set<string> &a, const set<string> &b) -> string {
+    for (const auto &x : a) {
+      for (const auto &y : b) {
+        if (overlaps(x, y)) {
+          return x == y ? x : x + " / " + y;
+        }
+      }
+    }
+    return "";
+  }
+
+  void check(const string &rule, const Node &node) {
+    // Every choice point must be decidable from the next token
+
+    if (node.kind == Node::NONTERMINAL && kBuiltins.count(node.text) == 0 && rules.count(node.text) == 0) {
+      throw runtime_error(rule + ": <" + node.text + "> is not defined");
+    }
+    if (node.kind == Node::CHOICE) {
+      int empty = 0;
+      for (size_t i = 0; i < node.children.size(); i++) {
+        empty += nullable(node.children[i]) ? 1 : 0;
+        for (size_t j = i + 1; j < node.children.size(); j++) {
+          string clash = conflict(first(node.children[i]), first(node.children[j]));
+          if (!clash.empty()) {
+            throw runtime_error(rule + ": not LL(1), two alternatives start with " + clash);
+          }
+        }
+      }
+      if (empty > 1) {
+        throw runtime_error(rule + ": not LL(1), more than one alternative can be empty");
+      }
+    }
+    if (node.kind == Node::SEQUENCE) {
+      for (size_t i = 0; i < node.children.size(); i++) {
+        const Node &child = node.children[i];
+        if (child.kind != Node::OPTIONAL && child.kind != Node::REPEAT) {
+          continue;
+        }
+        Node rest;
+        rest.kind = Node::SEQUENCE;
+        rest.children.assign(node.children.begin() + static_cast<long>(i) + 1, node.children.end());
+        if (nullable(rest)) {
+          continue;
+        }
+        string clash = conflict(first(child.children.front()), first(rest));
+        if (!clash.empty()) {
+          throw runtime_error(rule + ": not LL(1), " + clash + " may start an optional part or what follows it");
+        }
+      }
+    }
+    for (const auto &child : node.children) {
+      check(rule, child);
+    }
+  }
+};
+
+// ---- Shapes ----
+
+struct Field {
+  string key;
+  string shape;                             // STRING, NUMBER, BOOLEAN, KEYWORD, OBJECT, ARRAY, MAP
+  string element;                           // Shape of array elements / map values (else = shape)
+};
+
+struct Object {
+  string name;                              // Rule name without _fields (card_def)
+  vector<Field> fields;
+};
+
+auto isTerminal(const Node &node, const string &text) -> bool {
+  return node.kind == Node::TERMINAL && node.text == text;
+}
+
+auto listElement(const Node &body, const string &open, const string &close) -> const Node * {
+  // open [ <x> ( "," <x> )* ] close  ->  <x>
+
+  if (body.kind != Node::SEQUENCE || body.children.size() != 3 || !isTerminal(body.children[0], open) ||
+      !isTerminal(body.children[2], close) || body.children[1].kind != Node::OPTIONAL) {
+    return nullptr;
+  }
+  const Node &inner = body.children[1].children.front();
+  if (inner.kind != Node::SEQUENCE || inner.children.size() != 2 || inner.children[0].kind != Node::NONTERMINAL ||
+      inner.children[1].kind != Node::REPEAT) {
+    return nullptr;
+  }
+  const Node &more = inner.children[1].children.front();
+  if (more.kind != Node::SEQUENCE || more.children.size() != 2 || !isTerminal(more.children[0], ",") ||
+      more.children[1].kind != Node::NONTERMINAL || more.children[1].text != inner.children[0].text) {
+    return nullptr;
+  }
+  return &inner.children[0];
+}
+
+class Shapes {
+  const map<string, const Rule *> &rules;
+
+public:
+  explicit Shapes(const map<string, const Rule *> &rules) : rules(rules) {}
+
+  static auto isFieldRule(const string &name) -> bool {
+    return name.size() > 7 && name.compare(name.size() - 7, 7, "_fields") == 0;
+  }
+
+  auto mapValue(const Node &entry) -> const Node * {
+    // <x_entry> ::= <string> ":" <value>
+
+    const Node &body = rules.at(entry.text)->body;
+    if (body.kind == Node::SEQUENCE && body.children.size() == 3 && body.children[0].kind == Node::NONTERMINAL &&
+        body.children[0].text == "string" && isTerminal(body.children[1], ":")) {
+      return &body.children[2];
+    }
+    return nullptr;
+  }
+
+  auto shapeOf(const Node &value) -> string {
+    if (value.kind != Node::NONTERMINAL) {
+      throw runtime_error("field values must be a single <name>");
+    }
+    if (kBuiltins.count(value.text) != 0) {
+      string upper = value.text;
+      for (auto &c : upper) {
+        c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+      }
+      return upper;
+    }
+    const Node &body = rules.at(value.text)->body;
+    if (listElement(body, "[", "]") != nullptr) {
+      return "ARRAY";
+    }
+    if (const Node *element = listElement(body, "{", "}")) {
+      if (isFieldRule(element->text)) {
+        return "OBJECT";
+      }
+      if (mapValue(*element) != nullptr) {
+        return "MAP";
+      }
+    }
+    throw runtime_error("<" + value.text + "> is not a value, object, array or map");
+  }
+
+  auto elementShape(const Node &value) -> string {
+    string shape = shapeOf(value);
+    if (shape == "ARRAY") {
+      return shapeOf(*listElement(rules.at(value.text)->body, "[", "]"));
+    }
+    if (shape == "MAP") {
+      return shapeOf(*mapValue(*listElement(rules.at(value.text)->body, "{", "}")));
+    }
+    return shape;
+  }
+
+  auto object(const Rule &rule) -> Object {
+    // "key" ":" <value> | "key" ":" <value> | ...
+
+    Object object;
+    object.name = rule.name.substr(0, rule.name.size() - 7);
+    vector<const Node *> alternatives;
+    if (rule.body.kind == Node::CHOICE) {
+      for (const auto &child : rule.body.children) {
+        alternatives.push_back(&child);
+      }
+    } else {
+      alternatives.push_back(&rule.body);
+    }
+
+    for (const Node *alt : alternatives) {
+      if (alt->kind != Node::SEQUENCE || alt->children.size() != 3 || alt->children[0].kind != Node::TERMINAL ||
+          alt->children[0].text.size() < 3 || alt->children[0].text.front() != '"' ||
+          !isTerminal(alt->children[1], ":")) {
+        throw runtime_error(rule.name + ": each alternative must be \"\\\"key\\\"\" \":\" <value>");
+      }
+      const string &quoted = alt->children[0].text;
+      object.fields.push_back(
+          {quoted.substr(1, quoted.size() - 2), shapeOf(alt->children[2]), elementShape(alt->children[2])});
+    }
+    if (object.fields.size() > 250) {
+      throw runtime_error(rule.name + ": too many fields");
+    }
+    return object;
+  }
+};
+
+// ---- Output ----
+
+auto grammarHash(const string &key, uint32_t seed) -> uint32_t {
+  // Must match grammarHash in the generated header (FNV-1a, seeded)
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : key) {
+    hash ^= static_cast<uint8_t>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+auto camelCase(const string &snake) -> string {
+  string out;
+  bool upper = true;
+  for (char c : snake) {
+    if (c == '_') {
+      upper = true;
+    } else {
+      out.push_back(upper ? static_cast<char>(toupper(static_cast<unsigned char>(c))) : c);
+      upper = false;
+    }
+  }
+  return out;
+}
+
+auto upperSnake(const string &name) -> string {
+  // activePlayer -> ACTIVE_PLAYER, card_def -> CARD_DEF
+  string out;
+  for (size_t i = 0; i < name.size(); i++) {
+    char c = name[i];
+    if (isupper(static_cast<unsigned char>(c)) != 0 && i > 0) {
+      out.push_back('_');
+    }
+    out.push_back(static_cast<char>(toupper(static_cast<unsigned char>(c))));
+  }
+  return out;
+}
+
+struct Slots {
+  uint32_t seed = 0;
+  uint32_t mask = 0;
+  vector<int> table;
+};
+
+auto perfectHash(const Object &object) -> Slots {
+  // Smallest power-of-two table (at least 2x the keys), then the first seed without collisions
+
+  uint32_t size = 2;
+  while (size < object.fields.size() * 2) {
+    size *= 2;
+  }
+  for (;; size *= 2) {
+    for (uint32_t seed = 0; seed < 100000; seed++) {
+      Slots slots{seed, size - 1, vector<int>(size, -1)};
+      bool ok = true;
+      for (size_t i = 0; i < object.fields.size() && ok; i++) {
+        int &slot = slots.table[grammarHash(object.fields[i].key, seed) & slots.mask];
+        ok = (slot < 0);
+        slot = static_cast<int>(i);
+      }
+      if (ok) {
+        return slots;
+      }
+    }
+  }
+}
+
+void writeHeader(ostream &out, const vector<Object> &objects, const string &source) {
+  out << "// Generated by grammar_gen from " << source << "; edit the grammar, not this file.\n\n"
+      << "#ifndef GRAMMAR_TABLES_H\n#define GRAMMAR_TABLES_H\n\n"
+      << "#include <cstdint>\n#include <string_view>\n\nusing namespace std;\n\n";
+
+  out << "enum class ValueShape : uint8_t { STRING, NUMBER, BOOLEAN, KEYWORD, OBJECT, ARRAY, MAP };\n\n";
+
+  out << "enum class GrammarObject : uint8_t {\n";
+  for (const auto &object : objects) {
+    out << "  " << upperSnake(object.name) << ",\n";
+  }
+  out << "};\n\n";
+
+  for (const auto &object : objects) {
+    out << "enum class " << camelCase(object.name) << "Field : uint8_t {";
+    for (size_t i = 0; i < object.fields.size(); i++) {
+      out << (i == 0 ? " " : ", ") << upperSnake(object.fields[i].key);
+    }
+    out << " };\n";
+  }
+  out << '\n';
+
+  out << "struct GrammarField {\n"
+      << "  string_view key;\n"
+      << "  ValueShape shape;\n"
+      << "  ValueShape element;                       // Array elements / map values (else the same as shape)\n"
+      << "};\n\n"
+      << "struct GrammarObjectTable {\n"
+      << "  const GrammarField *fields;\n"
+      << "  const uint8_t *slots;                     // Hash slot -> field index (0xFF: no key hashes here)\n"
+      << "  uint32_t seed;\n"
+      << "  uint32_t mask;\n"
+      << "};\n\n";
+
+  for (const auto &object : objects) {
+    string prefix = "k" + camelCase(object.name);
+    out << "inline constexpr GrammarField " << prefix << "Fields[] = {\n";
+    for (const auto &field : object.fields) {
+      out << "    {\"" << field.key << "\", ValueShape::" << field.shape << ", ValueShape::" << field.element
+          << "},\n";
+    }
+    out << "};\n";
+
+    Slots slots = perfectHash(object);
+    out << "inline constexpr uint8_t " << prefix << "Slots[] = {";
+    for (size_t i = 0; i < slots.table.size(); i++) {
+      out << (i == 0 ? "" : ", ") << (slots.table[i] < 0 ? 0xFF : slots.table[i]);
+    }
+    out << "};\n";
+    out << "inline constexpr uint32_t " << prefix << "Seed = " << slots.seed << ";\n";
+    out << "inline constexpr uint32_t " << prefix << "Mask = " << slots.mask << ";\n\n";
+  }
+
+  out << "inline constexpr GrammarObjectTable kGrammarObjects[] = {\n";
+  for (const auto &object : objects) {
+    string prefix = "k" + camelCase(object.name);
+    out << "    {" << prefix << "Fields, " << prefix << "Slots, " << prefix << "Seed, " << prefix << "Mask},\n";
+  }
+  out << "};\n\n";
+
+  out << "// Which object a field enum belongs to\n"
+      << "template <typename FieldEnum> struct GrammarObjectOf;\n";
+  for (const auto &object : objects) {
+    out << "template <> struct GrammarObjectOf<" << camelCase(object.name) << "Field> {\n"
+        << "  static constexpr GrammarObject value = GrammarObject::" << upperSnake(object.name) << ";\n"
+        << "};\n";
+  }
+  out << '\n';
+
+  out << "inline auto grammarHash(string_view key, uint32_t seed) -> uint32_t {\n"
+      << "  uint32_t hash = 2166136261u ^ seed;\n"
+      << "  for (char c : key) {\n"
+      << "    hash ^= static_cast<uint8_t>(c);\n"
+      << "    hash *= 16777619u;\n"
+      << "  }\n"
+      << "  return hash;\n"
+      << "}\n\n"
+      << "// Field index of key in object, or -1 if the grammar doesn't allow it there\n"
+      << "inline auto lookupGrammarField(GrammarObject object, string_view key) -> int {\n"
+      << "  const GrammarObjectTable &table = kGrammarObjects[static_cast<size_t>(object)];\n"
+      << "  uint8_t slot = table.slots[grammarHash(key, table.seed) & table.mask];\n"
+      << "  return (slot != 0xFF && table.fields[slot].key == key) ? slot : -1;\n"
+      << "}\n\n"
+      << "#endif\n";
+}
+
+}
+
+auto main(int argc, char *argv[]) -> int {
+  // grammar_gen <bnf file>  (header on stdout)
+
+  if (argc != 2) {
+    cerr << "usage: grammar_gen data/bnf.txt > grammar_tables.h\n";
+    return 1;
+  }
+
+  try {
+    ifstream file(argv[1]);
+    if (!file) {
+      throw runtime_error(string("could not read ") + argv[1]);
+    }
+    stringstream buf;
+    buf << file.rdbuf();
+
+    vector<string> symbols = lexGrammar(buf.str());
+    vector<Rule> rules = GrammarReader(symbols).rules();
+    if (rules.empty()) {
+      throw runtime_error("no rules");
+    }
+
+    map<string, const Rule *> byName;
+    for (const auto &rule : rules) {
+      if (!byName.emplace(rule.name, &rule).second) {
+        throw runtime_error("<" + rule.name + "> is defined twice");
+      }
+    }
+
+    Analysis analysis(byName);
+    for (const auto &rule : rules) {
+      analysis.check(rule.name, rule.body);
+    }
+
+    Shapes shapes(byName);
+    vector<Object> objects;
+    for (const auto &rule : rules) {
+      if (Shapes::isFieldRule(rule.name)) {
+        objects.push_back(shapes.object(rule));
+      }
+    }
+
+    writeHeader(cout, objects, argv[1]);
+  } catch (const exception &e) {
+    cerr << "grammar_gen: " << e.what() << '\n';
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,222 @@
+#include "json_index.h"
+
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define JSON_INDEX_X86 1
+#endif
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kBlockSize = 64;
+
+struct BlockMasks {
+  // One bit per byte of a 64-byte block
+  uint64_t structural = 0;                  // { } [ ] : ,
+  uint64_t quote = 0;                       // "
+  uint64_t backslash = 0;                   // '\'
+  uint64_t whitespace = 0;                  // space, tab, CR, LF
+};
+
+// ----------------------------- Classifiers ----------------------------- //
+
+void classifyScalar(const uint8_t *block, BlockMasks &masks) {
+  for (size_t i = 0; i < kBlockSize; i++) {
+    uint64_t bit = uint64_t{1} << i;
+    switch (block[i]) {
+    case '{': case '}': case '[': case ']': case ':': case ',':
+      masks.structural |= bit;
+      break;
+    case '"':
+      masks.quote |= bit;
+      break;
+    case '\\':
+      masks.backslash |= bit;
+      break;
+    case ' ': case '\t': case '\n': case '\r':
+      masks.whitespace |= bit;
+      break;
+    default:
+      break;
+    }
+  }
+}
+
+#ifdef JSON_INDEX_X86
+
+void classifySSE2(const uint8_t *block, BlockMasks &masks) {
+  // Four 16-byte lanes per block
+
+  for (size_t lane = 0; lane < kBlockSize; lane += 16) {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block + lane));
+    auto eq = [&](char c) { return _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)); };
+
+    __m128i structural = _mm_or_si128(_mm_or_si128(_mm_or_si128(eq('{'), eq('}')), _mm_or_si128(eq('['), eq(']'))),
+                                      _mm_or_si128(eq(':'), eq(',')));
+    __m128i whitespace = _mm_or_si128(_mm_or_si128(eq(' '), eq('\t')), _mm_or_si128(eq('\n'), eq('\r')));
+
+    masks.structural |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(structural))) << lane;
+    masks.whitespace |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(whitespace))) << lane;
+    masks.quote |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq('"')))) << lane;
+    masks.backslash |= static_cast<uint64_t>(static_cast<uint16_t>(_mm_movemask_epi8(eq('\\')))) << lane;
+  }
+}
+
+__attribute__((target("avx2"))) inline auto eq256(__m256i chunk, char c) -> __m256i {
+  return _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(c));
+}
+
+__attribute__((target("avx2"))) void classifyAVX2(const uint8_t *block, BlockMasks &masks) {
+  // Two 32-byte lanes per block
+
+  for (size_t lane = 0; lane < kBlockSize; lane += 32) {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(block + lane));
+
+    __m256i structural = _mm256_or_si256(_mm256_or_si256(_mm256_or_si256(eq256(chunk, '{'), eq256(chunk, '}')),
+                                                         _mm256_or_si256(eq256(chunk, '['), eq256(chunk, ']'))),
+                                         _mm256_or_si256(eq256(chunk, ':'), eq256(chunk, ',')));
+    __m256i whitespace = _mm256_or_si256(_mm256_or_si256(eq256(chunk, ' '), eq256(chunk, '\t')),
+                                         _mm256_or_si256(eq256(chunk, '\n'), eq256(chunk, '\r')));
+
+    masks.structural |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(structural))) << lane;
+    masks.whitespace |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(whitespace))) << lane;
+    masks.quote |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq256(chunk, '"')))) << lane;
+    masks.backslash |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(eq256(chunk, '\\')))) << lane;
+  }
+}
+
+#endif
+
+// ----------------------------- Bit Helpers ----------------------------- //
+
+auto prefixXor(uint64_t bits) -> uint64_t {
+  // Bit i becomes the XOR of bits 0..i (turns quote positions into "inside string" spans)
+
+  bits ^= bits << 1;
+  bits ^= bits << 2;
+  bits ^= bits << 4;
+  bits ^= bits << 8;
+  bits ^= bits << 16;
+  bits ^= bits << 32;
+  return bits;
+}
+
+auto escapedBits(uint64_t backslash, bool &carry) -> uint64_t {
+  // Mark every byte preceded by an unescaped backslash. Backslashes are rare in card text,
+  // so walking the set bits is cheaper than the branch-free odd-sequence trick.
+
+  uint64_t escaped = carry ? 1 : 0;
+  carry = false;
+
+  while (backslash != 0) {
+    int bit = __builtin_ctzll(backslash);
+    backslash &= backslash - 1;
+
+    if (((escaped >> bit) & 1) != 0) {
+      continue;                             // This backslash is itself escaped
+    }
+    if (bit == 63) {
+      carry = true;                         // Escapes the first byte of the next block
+    } else {
+      escaped |= uint64_t{1} << (bit + 1);
+    }
+  }
+  return escaped;
+}
+
+// ----------------------------- Index Builder ----------------------------- //
+
+using Classifier = void (*)(const uint8_t *, BlockMasks &);
+
+auto classifierFor(IndexBackend backend) -> Classifier {
+#ifdef JSON_INDEX_X86
+  if (backend == IndexBackend::AVX2 && detectIndexBackend() == IndexBackend::AVX2) {
+    return classifyAVX2;
+  }
+  if (backend != IndexBackend::SCALAR) {
+    return classifySSE2;
+  }
+#else
+  (void)backend;
+#endif
+  return classifyScalar;
+}
+
+auto buildWith(const string &input, Classifier classify) -> StructuralIndex {
+  StructuralIndex index;
+  index.starts.reserve(input.size() / 4);
+
+  bool escapeCarry = false;                 // First byte of the next block is escaped
+  uint64_t stringCarry = 0;                 // All ones if the next block starts inside a string
+  uint64_t boundaryCarry = 1;               // Start of input counts as a token boundary
+
+  const auto *data = reinterpret_cast<const uint8_t *>(input.data());
+  uint8_t tail[kBlockSize];
+
+  for (size_t base = 0; base < input.size(); base += kBlockSize) {
+    const uint8_t *block = data + base;
+    if (input.size() - base < kBlockSize) {
+      // Pad the last partial block with spaces so it classifies as whitespace
+      size_t remaining = input.size() - base;
+      memset(tail, ' ', kBlockSize);
+      memcpy(tail, block, remaining);
+      block = tail;
+    }
+
+    BlockMasks masks;
+    classify(block, masks);
+
+    uint64_t escaped = escapedBits(masks.backslash, escapeCarry);
+    uint64_t quotes = masks.quote & ~escaped;
+
+    // Opening quotes and string contents are 1, closing quotes are 0
+    uint64_t inString = prefixXor(quotes) ^ stringCarry;
+    stringCarry = static_cast<uint64_t>(static_cast<int64_t>(inString) >> 63);
+
+    // A scalar (number/keyword) starts right after a structural char, whitespace or a quote
+    uint64_t boundary = masks.structural | masks.whitespace | quotes;
+    uint64_t afterBoundary = (boundary << 1) | boundaryCarry;
+    boundaryCarry = boundary >> 63;
+
+    uint64_t scalar = ~boundary & ~inString;
+    uint64_t starts = (masks.structural & ~inString) | (quotes & inString) | (scalar & afterBoundary);
+
+    while (starts != 0) {
+      index.starts.push_back(static_cast<uint32_t>(base + __builtin_ctzll(starts)));
+      starts &= starts - 1;
+    }
+  }
+
+  index.unterminatedString = (stringCarry != 0);
+  return index;
+}
+
+}
+
+auto detectIndexBackend() -> IndexBackend {
+  // Checked once; AVX2 needs both the instruction set and OS support, which the builtin covers
+
+#ifdef JSON_INDEX_X86
+  static const IndexBackend best = []() {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") != 0) {
+      return IndexBackend::AVX2;
+    }
+    return IndexBackend::SSE2;
+  }();
+  return best;
+#else
+  return IndexBackend::SCALAR;
+#endif
+}
+
+auto buildStructuralIndex(const string &input, IndexBackend backend) -> StructuralIndex {
+  return buildWith(input, classifierFor(backend));
+}
+
+auto buildStructuralIndex(const string &input) -> StructuralIndex {
+  return buildStructuralIndex(input, detectIndexBackend());
+}
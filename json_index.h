@@ -0,0 +1,32 @@
+/*
+  First pass over the raw JSON text: classifies bytes in wide blocks (AVX2/SSE2 when the CPU has
+  them, plain scalar otherwise) and records where every token starts, so the tokenizer can jump
+  straight from one token to the next instead of walking whitespace byte by byte.
+*/
+
+#ifndef JSON_INDEX_H
+#define JSON_INDEX_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+enum class IndexBackend { SCALAR, SSE2, AVX2 };
+
+struct StructuralIndex {
+  vector<uint32_t> starts;                  // Byte offset of each token start, ascending
+  bool unterminatedString = false;          // Input ended inside a string literal
+};
+
+// Build the token start index for a JSON document
+auto buildStructuralIndex(const string &input) -> StructuralIndex;
+
+// Same, but force a backend (falls back to scalar if the CPU can't run it)
+auto buildStructuralIndex(const string &input, IndexBackend backend) -> StructuralIndex;
+
+// Best backend this CPU supports (checked once at runtime)
+auto detectIndexBackend() -> IndexBackend;
+
+#endif
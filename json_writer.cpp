@@ -0,0 +1,406 @@
+#include "json_writer.h"
+
+#include <charconv>
+
+using namespace std;
+
+// ----------------------------- Writer ----------------------------- //
+
+void JsonWriter::separator() {
+  // Comma before every element except the first in its container
+
+  if (needComma.empty()) {
+    return;
+  }
+  if (needComma.back()) {
+    buf.push_back(',');
+  }
+  needComma.back() = true;
+}
+
+void JsonWriter::beginObject() {
+  separator();
+  buf.push_back('{');
+  needComma.push_back(false);
+}
+
+void JsonWriter::endObject() {
+  needComma.pop_back();
+  buf.push_back('}');
+}
+
+void JsonWriter::beginArray() {
+  separator();
+  buf.push_back('[');
+  needComma.push_back(false);
+}
+
+void JsonWriter::endArray() {
+  needComma.pop_back();
+  buf.push_back(']');
+}
+
+void JsonWriter::key(string_view name) {
+  value(name);
+  buf.push_back(':');
+
+  // The value that follows must not emit another comma
+  needComma.back() = false;
+}
+
+void JsonWriter::value(string_view text) {
+  // Quote and escape; plain runs are appended in bulk
+
+  static const char *hex = "0123456789abcdef";
+  separator();
+  buf.push_back('"');
+
+  size_t runStart = 0;
+  for (size_t i = 0; i < text.size(); i++) {
+    auto c = static_cast<unsigned char>(text[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') {
+      continue;
+    }
+    buf.append(text.data() + runStart, i - runStart);
+    runStart = i + 1;
+
+    switch (c) {
+    case '"': buf.append("\\\""); break;
+    case '\\': buf.append("\\\\"); break;
+    case '\n': buf.append("\\n"); break;
+    case '\r': buf.append("\\r"); break;
+    case '\t': buf.append("\\t"); break;
+    default:
+      buf.append("\\u00");
+      buf.push_back(hex[c >> 4]);
+      buf.push_back(hex[c & 0xF]);
+      break;
+    }
+  }
+  buf.append(text.data() + runStart, text.size() - runStart);
+  buf.push_back('"');
+}
+
+void JsonWriter::value(int number) {
+  separator();
+  char digits[16];
+  auto result = to_chars(digits, digits + sizeof(digits), number);
+  buf.append(digits, result.ptr);
+}
+
+void JsonWriter::value(bool flag) {
+  separator();
+  buf.append(flag ? "true" : "false");
+}
+
+// ----------------------------- Output ----------------------------- //
+
+auto triggerEventName(TriggerEvent event) -> const char * {
+  switch (event) {
+  case TriggerEvent::ENTERS_BATTLEFIELD: return "ENTERS_BATTLEFIELD";
+  case TriggerEvent::DIES: return "DIES";
+  case TriggerEvent::ATTACKS: return "ATTACKS";
+  case TriggerEvent::BLOCKS: return "BLOCKS";
+  case TriggerEvent::DEALS_DAMAGE: return "DEALS_DAMAGE";
+  case TriggerEvent::DEALS_COMBAT_DAMAGE: return "DEALS_COMBAT_DAMAGE";
+  case TriggerEvent::BEGINNING_OF_UPKEEP: return "BEGINNING_OF_UPKEEP";
+  case TriggerEvent::END_OF_TURN: return "END_OF_TURN";
+  case TriggerEvent::SPELL_CAST: return "SPELL_CAST";
+  case TriggerEvent::BECOMES_TARGET: return "BECOMES_TARGET";
+  }
+  return "UNKNOWN";
+}
+
+auto stopReasonName(StopReason reason) -> const char * {
+  switch (reason) {
+  case StopReason::COMPLETED: return "COMPLETED";
+  case StopReason::LOOP_DETECTED: return "LOOP_DETECTED";
+  case StopReason::STEP_LIMIT: return "STEP_LIMIT";
+  case StopReason::STACK_DEPTH_LIMIT: return "STACK_DEPTH_LIMIT";
+  case StopReason::DEADLINE: return "DEADLINE";
+  case StopReason::CANCELLED: return "CANCELLED";
+  }
+  return "UNKNOWN";
+}
+
+auto decisionKindName(DecisionKind kind) -> const char * {
+  switch (kind) {
+  case DecisionKind::USE_MAY_TRIGGER: return "USE_MAY_TRIGGER";
+  case DecisionKind::ORDER_TRIGGERS: return "ORDER_TRIGGERS";
+  case DecisionKind::CHOOSE_TARGET: return "CHOOSE_TARGET";
+  }
+  return "UNKNOWN";
+}
+
+namespace {
+
+auto estimateSize(const Output &out) -> size_t {
+  // Rough upper bound so the buffer is allocated once
+
+  size_t bytes = 256;
+  for (const auto &err : out.errors) {
+    bytes += err.size() + 8;
+  }
+  for (const auto &step : out.steps) {
+    bytes += step.description.size() + 64;
+    bytes += step.triggeredEvents.size() * 96;
+    for (const auto &trig : step.newTriggers) {
+      bytes += trig.text.size() + trig.sourceName.size() + 128;
+    }
+  }
+  bytes += (out.finalLife.size() + out.cardsDrawn.size()) * 32;
+  for (const auto &id : out.destroyedPermanents) {
+    bytes += id.size() + 4;
+  }
+  for (const auto &id : out.counteredSpells) {
+    bytes += id.size() + 4;
+  }
+  return bytes;
+}
+
+void writePendingTrigger(JsonWriter &json, const PendingTrigger &trig) {
+  json.beginObject();
+  json.key("sourceId");
+  json.value(trig.sourceId);
+  json.key("sourceName");
+  json.value(trig.sourceName);
+  json.key("controller");
+  json.value(trig.controller);
+  json.key("abilityIndex");
+  json.value(trig.abilityIndex);
+  json.key("activePlayer");
+  json.value(trig.isActivePlayer);
+  json.key("text");
+  json.value(trig.text);
+  json.endObject();
+}
+
+void writeLoop(JsonWriter &json, const LoopReport &loop) {
+  json.key("loop");
+  json.beginObject();
+  json.key("detected");
+  json.value(loop.detected);
+  if (loop.detected) {
+    json.key("period");
+    json.value(loop.period);
+    json.key("firstStep");
+    json.value(loop.firstStep);
+    json.key("lifeDelta");
+    json.beginObject();
+    for (const auto &[player, delta] : loop.lifeDelta) {
+      json.key(player);
+      json.value(delta);
+    }
+    json.endObject();
+    json.key("cardsDrawnDelta");
+    json.beginObject();
+    for (const auto &[player, delta] : loop.cardsDrawnDelta) {
+      json.key(player);
+      json.value(delta);
+    }
+    json.endObject();
+    json.key("destroyedPerLap");
+    json.value(loop.destroyedPerLap);
+  }
+  json.endObject();
+}
+
+}
+
+auto writeOutputJson(const Output &out) -> string {
+  JsonWriter json(estimateSize(out));
+  writeOutputObject(json, out);
+  return json.take();
+}
+
+void writeOutputObject(JsonWriter &json, const Output &out) {
+  json.beginObject();
+  json.key("valid");
+  json.value(out.valid);
+  json.key("stopReason");
+  json.value(stopReasonName(out.stopReason));
+  json.key("unresolvedItems");
+  json.value(out.unresolvedItems);
+
+  json.key("errors");
+  json.beginArray();
+  for (const auto &err : out.errors) {
+    json.value(err);
+  }
+  json.endArray();
+
+  json.key("steps");
+  json.beginArray();
+  for (const auto &step : out.steps) {
+    writeStepJson(json, step);
+  }
+  json.endArray();
+
+  json.key("finalLife");
+  json.beginObject();
+  for (const auto &[player, life] : out.finalLife) {
+    json.key(player);
+    json.value(life);
+  }
+  json.endObject();
+
+  json.key("cardsDrawn");
+  json.beginObject();
+  for (const auto &[player, cards] : out.cardsDrawn) {
+    json.key(player);
+    json.value(cards);
+  }
+  json.endObject();
+
+  json.key("destroyedPermanents");
+  json.beginArray();
+  for (const auto &id : out.destroyedPermanents) {
+    json.value(id);
+  }
+  json.endArray();
+
+  json.key("counteredSpells");
+  json.beginArray();
+  for (const auto &id : out.counteredSpells) {
+    json.value(id);
+  }
+  json.endArray();
+
+  writeLoop(json, out.loop);
+
+  json.endObject();
+}
+
+void writeStepJson(JsonWriter &json, const ResolutionStep &step) {
+  json.beginObject();
+  json.key("description");
+  json.value(step.description);
+
+  json.key("events");
+  json.beginArray();
+  for (const auto &event : step.triggeredEvents) {
+    json.beginObject();
+    json.key("type");
+    json.value(triggerEventName(event.type));
+    json.key("objectId");
+    json.value(event.objectId);
+    json.key("cardName");
+    json.value(event.cardName);
+    json.key("controller");
+    json.value(event.controller);
+    json.key("count");
+    json.value(event.count);
+    json.endObject();
+  }
+  json.endArray();
+
+  // Already in APNAP order
+  json.key("newTriggers");
+  json.beginArray();
+  for (const auto &trig : step.newTriggers) {
+    writePendingTrigger(json, trig);
+  }
+  json.endArray();
+
+  json.endObject();
+}
+
+void writePermanentJson(JsonWriter &json, const Permanent &perm) {
+  // Same keys as the input format, plus the state the engine tracks
+
+  json.beginObject();
+  json.key("id");
+  json.value(perm.id);
+  json.key("name");
+  json.value(perm.cardName);
+  json.key("controller");
+  json.value(perm.controller);
+  json.key("tapped");
+  json.value(perm.tapped);
+  json.key("damage");
+  json.value(perm.damage);
+  json.key("powerModifier");
+  json.value(perm.powerModifier);
+  json.key("toughnessModifier");
+  json.value(perm.toughnessModifier);
+  json.key("counters");
+  json.value(perm.counters);
+  if (perm.isToken) {
+    json.key("token");
+    json.value(true);
+    json.key("count");
+    json.value(perm.count);
+  }
+  json.endObject();
+}
+
+void writeStackItemJson(JsonWriter &json, const StackItem &item) {
+  // Empty optional fields are left out
+
+  json.beginObject();
+  json.key("id");
+  json.value(item.id);
+  json.key("kind");
+  json.value(item.kind);
+  json.key("sourceName");
+  json.value(item.sourceName);
+  json.key("controller");
+  json.value(item.controller);
+  if (!item.sourceId.empty()) {
+    json.key("sourceId");
+    json.value(item.sourceId);
+    json.key("abilityIndex");
+    json.value(item.abilityIndex);
+  }
+  if (!item.targetId.empty()) {
+    json.key("targetId");
+    json.value(item.targetId);
+  }
+  if (!item.targetPlayer.empty()) {
+    json.key("targetPlayer");
+    json.value(item.targetPlayer);
+  }
+  if (!item.targetStackId.empty()) {
+    json.key("targetStackId");
+    json.value(item.targetStackId);
+  }
+  json.endObject();
+}
+
+void writeDecisionJson(JsonWriter &json, const DecisionRequest &request) {
+  // Options are stack items with only the target fields differing, so only those are written
+
+  json.beginObject();
+  json.key("kind");
+  json.value(decisionKindName(request.kind));
+  json.key("player");
+  json.value(request.player);
+  json.key("triggers");
+  json.beginArray();
+  for (const auto &trig : request.triggers) {
+    writePendingTrigger(json, trig);
+  }
+  json.endArray();
+  if (request.kind == DecisionKind::CHOOSE_TARGET) {
+    json.key("options");
+    json.beginArray();
+    for (const auto &option : request.options) {
+      json.beginObject();
+      if (!option.targetId.empty()) {
+        json.key("targetId");
+        json.value(option.targetId);
+      }
+      if (!option.targetPlayer.empty()) {
+        json.key("targetPlayer");
+        json.value(option.targetPlayer);
+      }
+      if (!option.targetStackId.empty()) {
+        json.key("targetStackId");
+        json.value(option.targetStackId);
+      }
+      json.endObject();
+    }
+    json.endArray();
+  }
+  json.endObject();
+}
@@ -0,0 +1,64 @@
+/*
+  Hand-rolled JSON serialiser for Output. Everything is appended to one preallocated buffer so the
+  whole result can go out in a single write (no iostream formatting per field).
+*/
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include "decision.h"
+#include "types.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+class JsonWriter {
+  string buf;
+  vector<bool> needComma;                   // One entry per open object/array
+
+  void separator();
+
+public:
+  explicit JsonWriter(size_t reserveBytes = 4096) { buf.reserve(reserveBytes); }
+
+  void beginObject();
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  // Object key (the value call that follows supplies the value)
+  void key(string_view name);
+
+  void value(string_view text);
+  void value(const char *text) { value(string_view(text)); }
+  void value(const string &text) { value(string_view(text)); }
+  void value(int number);
+  void value(bool flag);
+
+  auto str() const -> const string & { return buf; }
+  auto take() -> string { return std::move(buf); }
+};
+
+// Readable names matching the input keywords (DIES, ENTERS_BATTLEFIELD, ...)
+auto triggerEventName(TriggerEvent event) -> const char *;
+
+// COMPLETED, STEP_LIMIT, DEADLINE, ...
+auto stopReasonName(StopReason reason) -> const char *;
+
+// USE_MAY_TRIGGER, ORDER_TRIGGERS, CHOOSE_TARGET
+auto decisionKindName(DecisionKind kind) -> const char *;
+
+// Serialise a full Output
+auto writeOutputJson(const Output &out) -> string;
+
+// Pieces, for callers building their own documents (session and batch modes)
+void writeOutputObject(JsonWriter &json, const Output &out);
+void writeStepJson(JsonWriter &json, const ResolutionStep &step);
+void writePermanentJson(JsonWriter &json, const Permanent &perm);
+void writeStackItemJson(JsonWriter &json, const StackItem &item);
+void writeDecisionJson(JsonWriter &json, const DecisionRequest &request);
+
+#endif
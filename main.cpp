@@ -1,17 +1,35 @@
+#include "batch.h"
 #include "engine.h"
+#include "json_writer.h"
+#include "mem_stats.h"
 #include "parser.h"
+#include "replay.h"
+#include "rollout.h"
+#include "session.h"
+#include "step_sink.h"
+#include "whatif.h"
+#include "wire.h"
+#include <algorithm>
+#include <charconv>
+#include <csignal>
+#include <cstdio>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
 #include <sstream>
+#include <string_view>
+#include <unordered_set>
 
 using namespace std;
 
-bool g_debug = false;
+// Ctrl-C stops the run at the next resolution and still prints the partial result
+static CancellationToken g_interrupt;
+extern "C" void onInterrupt(int /*signal*/) { g_interrupt.cancel(); }
 
 auto readFile(const string &filename) -> string {
   // Read entire file into a string (empty if it fails).
 
-  ifstream fileStream(filename);
+  ifstream fileStream(filename, ios::binary);
   if (!fileStream) {
     return "";
   }
@@ -37,35 +55,36 @@ namespace {
     cout << '\n';
   }
 
-  void printSteps(const Output &out) {
-    // Print the step-by-step resolution log
+  void printLoop(const Output &out) {
+    // Report an infinite loop the engine stopped on
 
-    if (out.steps.empty()) {
-      cout << "Stack was empty, nothing to resolve.\n";
+    const LoopReport &loop = out.loop;
+    if (!loop.detected) {
       return;
     }
 
-    int stepNum = 1;
-    for (const auto &step : out.steps) {
-      cout << "STEP " << stepNum++ << ": " << step.description << '\n';
+    cout << "LOOP DETECTED: state repeats every " << loop.period << " step(s) starting at step "
+         << loop.firstStep << "; resolution stopped early.\n";
+    cout << "  Per lap:";
+    for (const auto &[player, delta] : loop.lifeDelta) {
+      cout << ' ' << player << ' ' << (delta >= 0 ? "+" : "") << delta << " life;";
+    }
+    for (const auto &[player, delta] : loop.cardsDrawnDelta) {
+      if (delta != 0) {
+        cout << ' ' << player << " draws " << delta << ';';
+      }
+    }
+    cout << ' ' << loop.destroyedPerLap << " destroyed\n\n";
+  }
 
-      // Show any triggers that fired during this step
-      if (!step.newTriggers.empty()) {
-        cout << "  >> TRIGGERS DETECTED (APNAP order):\n";
+  void printStopReason(const Output &out) {
+    // Say why a partial run ended (loops are reported by printLoop)
 
-        for (const auto &trigger : step.newTriggers) {
-          cout << "     - " << trigger.sourceName << " [" << trigger.controller;
-          if (trigger.isActivePlayer) {
-            cout << ", Active Player";
-          } else {
-            cout << ", Non-Active Player";
-          }
-          cout << "]\n";
-          cout << "       \"" << trigger.text << "\"\n";
-        }
-      }
-      cout << '\n';
+    if (out.stopReason == StopReason::COMPLETED || out.stopReason == StopReason::LOOP_DETECTED) {
+      return;
     }
+    cout << "STOPPED EARLY (" << stopReasonName(out.stopReason) << "): " << out.unresolvedItems
+         << " item(s) left on the stack.\n\n";
   }
 
   void printFinalState(const Output &out) {
@@ -96,64 +115,476 @@ namespace {
       }
       cout << '\n';
     }
+
+    // Countered spells
+    if (!out.counteredSpells.empty()) {
+      cout << "  Countered: " << out.counteredSpells.size() << " spell(s)\n";
+    }
   }
 }
 
-void printOutput(const Output &out) {
-  // Print the full simulation results
+void printRolloutSummary(const RolloutSummary &summary) {
+  // Outcome distributions over all rollouts, as percentages
+
+  auto percent = [&](int count) { return 100.0 * count / max(1, summary.rollouts); };
+  auto printHistogram = [&](const map<int, int> &histogram) {
+    double mean = 0;
+    for (const auto &[value, count] : histogram) {
+      mean += static_cast<double>(value) * count;
+    }
+    cout << "mean " << mean / max(1, summary.rollouts) << "  [";
+    bool first = true;
+    for (const auto &[value, count] : histogram) {
+      cout << (first ? "" : ", ") << value << ": " << percent(count) << '%';
+      first = false;
+    }
+    cout << "]\n";
+  };
+  auto printById = [&](const unordered_map<ObjectID, int> &counts) {
+    // Most frequent first
+    vector<pair<ObjectID, int>> sorted(counts.begin(), counts.end());
+    sort(sorted.begin(), sorted.end(), [](const auto &a, const auto &b) {
+      return a.second != b.second ? a.second > b.second : a.first < b.first;
+    });
+    for (const auto &[id, count] : sorted) {
+      cout << "    " << id << ": " << percent(count) << "%\n";
+    }
+  };
+
+  cout << fixed << setprecision(1);
+  double perMinute = summary.elapsedMs > 0 ? summary.rollouts * 60000.0 / summary.elapsedMs : 0;
+  cout << "ROLLOUTS: " << summary.rollouts << " on " << summary.threads << " thread(s) in " << summary.elapsedMs
+       << " ms (" << perMinute << " per minute)\n\n";
 
-  cout << "STACK RESOLUTION\n\n";
+  cout << "FINAL LIFE\n";
+  vector<PlayerID> players;
+  for (const auto &[player, lives] : summary.finalLife) {
+    players.push_back(player);
+  }
+  sort(players.begin(), players.end());
+  for (const auto &player : players) {
+    cout << "  " << player << ": ";
+    printHistogram(summary.finalLife.at(player));
+  }
+
+  cout << "PERMANENTS DESTROYED\n  ";
+  printHistogram(summary.destroyedCount);
+  printById(summary.destroyed);
+
+  cout << "SPELLS COUNTERED\n  ";
+  printHistogram(summary.counteredCount);
+  printById(summary.countered);
+
+  for (const auto &[reason, count] : summary.stopReasons) {
+    if (reason != StopReason::COMPLETED) {
+      cout << "STOPPED EARLY (" << stopReasonName(reason) << "): " << percent(count) << "% of rollouts\n";
+    }
+  }
+}
+
+void printWhatIf(const vector<WhatIfOutcome> &outcomes) {
+  // Ranked table, best target first
+
+  const StackItem &spell = outcomes.front().spell;
+  cout << "WHAT-IF: " << spell.sourceName << " (" << spell.id << ") cast by " << spell.controller << ", "
+       << outcomes.size() << " legal target(s)\n\n";
+
+  auto signedValue = [](int value) { return (value > 0 ? "+" : "") + to_string(value); };
+
+  int rank = 1;
+  for (const auto &outcome : outcomes) {
+    const Output &out = outcome.output;
+    cout << "  " << rank++ << ". " << outcome.target << ": permanents " << signedValue(outcome.permanentSwing)
+         << ", life " << signedValue(outcome.lifeSwing) << " (" << out.steps.size() << " step(s))\n";
+
+    vector<pair<PlayerID, int>> lives(out.finalLife.begin(), out.finalLife.end());
+    sort(lives.begin(), lives.end());
+    cout << "     ";
+    for (const auto &[player, life] : lives) {
+      cout << player << ": " << life << " life; ";
+    }
+    if (!out.destroyedPermanents.empty()) {
+      cout << "destroyed:";
+      for (const auto &id : out.destroyedPermanents) {
+        cout << ' ' << id;
+      }
+      cout << "; ";
+    }
+    if (!out.counteredSpells.empty()) {
+      cout << "countered " << out.counteredSpells.size() << " spell(s); ";
+    }
+    if (out.stopReason != StopReason::COMPLETED) {
+      cout << "stopped early (" << stopReasonName(out.stopReason) << ")";
+    }
+    cout << '\n';
+  }
+}
+
+void printMemStats() {
+  // Per-phase allocation table (--mem-stats); stderr so --json / binary output stays clean
+
+  MemStatsReport report = memStatsReport();
+  auto kib = [](int64_t bytes) { return static_cast<double>(bytes) / 1024.0; };
+
+  cerr << "MEMORY (allocations, KiB requested, peak live KiB)\n" << fixed << setprecision(1);
+  for (size_t i = 0; i < report.phases.size(); i++) {
+    const MemPhaseStats &phase = report.phases[i];
+    if (phase.allocations == 0) {
+      continue;
+    }
+    cerr << "  " << left << setw(14) << memPhaseName(static_cast<MemPhase>(i)) << right << setw(10)
+         << phase.allocations << setw(12) << kib(static_cast<int64_t>(phase.bytes)) << setw(12)
+         << kib(phase.peakLiveBytes) << '\n';
+  }
+  cerr << "  Peak live: " << kib(report.peakLiveBytes) << " KiB   Still live: " << kib(report.liveBytes)
+       << " KiB\n";
+}
+
+void printOutput(const Output &out, int steps) {
+  // Print what follows the streamed step log (the "STACK RESOLUTION" header and steps come first)
+
+  if (steps == 0) {
+    cout << "Stack was empty, nothing to resolve.\n";
+  }
   printErrors(out);
-  printSteps(out);
+  printLoop(out);
+  printStopReason(out);
   printFinalState(out);
 }
 
+auto parseBudget(const char *text, int &value) -> bool {
+  // A budget is a whole number >= 0 and nothing else ("-1", "10ms" and "" are rejected)
+
+  string_view digits(text);
+  auto [end, status] = from_chars(digits.data(), digits.data() + digits.size(), value);
+  return !digits.empty() && status == errc() && end == digits.data() + digits.size() && value >= 0;
+}
+
+auto poolNames(const shared_ptr<const CardDatabase> &cards) -> unordered_set<string> {
+  // Every card in the pool: rollouts and what-if run many engines, but this process only runs them
+  // for one game, so the deferred cards parsed so far are exactly the ones it used
+
+  vector<string> names = cards ? cards->names() : vector<string>();
+  return unordered_set<string>(names.begin(), names.end());
+}
+
+void reportDeferredErrors(const shared_ptr<const CardDatabase> &cards, const unordered_set<string> &names,
+                          Context &context) {
+  // Syntax errors in cards --lazy-cards skipped only turn up once the run parses them
+
+  if (!cards) {
+    return;
+  }
+  for (const auto &error : cards->deferredErrors(names)) {
+    *context.diagnostics << error << '\n';
+    context.syntaxErrors++;
+  }
+}
+
 auto main(int argc, char *argv[]) -> int {
   // Entry point.
 
   try {
     // Default input file
     string filename = "data/input.json";
+    string inputFormat = "json";
+    string outputFormat = "text";
+    bool lazyCards = false;
+    bool sessionMode = false;
+    bool replayMode = false;
+    string recordPath;
+    RolloutOptions rollout;
+    bool rolloutMode = false;
+    bool whatIfMode = false;
+    bool memStats = false;
+    bool batchMode = false;
+    BatchOptions batch;
+    string cardsPath;
+    vector<string> files;
+    RunOptions options;
+    int timeoutMs = 0;                      // The deadline starts when the run does, not at startup
+    Context context;
 
     // Parse command line arguments
     for (int i = 1; i < argc; ++i) {
       string arg = argv[i];
       if (arg == "--debug" || arg == "-d") {
-        g_debug = true;
+        context.debug = true;
         cout << "[DEBUG] Debug mode enabled.\n\n";
+      } else if (arg == "--json") {
+        outputFormat = "json";
+      } else if (arg == "--lazy-cards") {
+        lazyCards = true;
+      } else if (arg == "--session") {
+        sessionMode = true;
+      } else if (arg == "--replay") {
+        replayMode = true;
+      } else if (arg == "--record" && i + 1 < argc) {
+        recordPath = argv[++i];
+      } else if (arg == "--mem-stats") {
+        memStats = true;
+      } else if (arg == "--batch") {
+        batchMode = true;
+      } else if (arg == "--cache-size" && i + 1 < argc) {
+        batch.cacheSize = static_cast<size_t>(stoi(argv[++i]));
+      } else if (arg == "--workers" && i + 1 < argc) {
+        batch.workers = stoi(argv[++i]);
+      } else if (arg == "--cards" && i + 1 < argc) {
+        cardsPath = argv[++i];
+      } else if (arg == "--what-if") {
+        whatIfMode = true;
+      } else if (arg == "--rollouts" && i + 1 < argc) {
+        rolloutMode = true;
+        rollout.rollouts = stoi(argv[++i]);
+      } else if (arg == "--seed" && i + 1 < argc) {
+        rollout.seed = stoull(argv[++i]);
+      } else if (arg == "--threads" && i + 1 < argc) {
+        rollout.threads = stoi(argv[++i]);
+      } else if ((arg == "--max-steps" || arg == "--max-stack" || arg == "--timeout-ms") && i + 1 < argc) {
+        int budget = 0;
+        if (!parseBudget(argv[++i], budget)) {
+          cerr << "Error: " << arg << " takes a whole number >= 0, got '" << argv[i] << "'\n";
+          return 1;
+        }
+        if (arg == "--max-steps") {
+          options.maxSteps = budget;
+        } else if (arg == "--max-stack") {
+          options.maxStackDepth = static_cast<size_t>(budget);
+        } else {
+          timeoutMs = budget;
+        }
+      } else if (arg == "--input-format" && i + 1 < argc) {
+        inputFormat = argv[++i];
+      } else if (arg == "--output-format" && i + 1 < argc) {
+        outputFormat = argv[++i];
       } else {
         filename = arg;
+        files.push_back(arg);
       }
     }
 
+    if (memStats) {
+      enableMemStats();
+    }
+
+    if (inputFormat != "json" && inputFormat != "binary") {
+      cerr << "Error: unknown input format '" << inputFormat << "' (expected json or binary)\n";
+      return 1;
+    }
+    if (outputFormat != "text" && outputFormat != "json" && outputFormat != "jsonl" && outputFormat != "binary") {
+      cerr << "Error: unknown output format '" << outputFormat << "' (expected text, json, jsonl or binary)\n";
+      return 1;
+    }
+
+    // Interactive: commands on stdin, one JSON response per line on stdout
+    if (sessionMode) {
+      context.filename = "<session>";
+      runSession(cin, cout, context, lazyCards);
+      if (memStats) {
+        printMemStats();
+      }
+      return 0;
+    }
+
+    // Many scenario files, one result line each, repeats answered from the cache
+    if (batchMode) {
+      if (outputFormat == "binary" || inputFormat == "binary") {
+        cerr << "Error: --batch reads JSON files and prints text or JSON Lines\n";
+        return 1;
+      }
+      batch.lazyCards = lazyCards;
+      if (!cardsPath.empty()) {
+        // Parsed in full: with --workers, pages written after the fork would stop being shared
+        string pool = readFile(cardsPath);
+        if (pool.empty()) {
+          cerr << "Error: Could not read " << cardsPath << '\n';
+          return 1;
+        }
+        context.filename = cardsPath;
+        int errorsBefore = context.syntaxErrors;
+        MemPhaseScope phase(MemPhase::PARSE);
+        batch.cards = Parser(std::move(pool), context).parse().cards;
+        if (context.syntaxErrors != errorsBefore) {
+          return 1;
+        }
+      }
+      batch.json = (outputFormat != "text");
+      batch.run = options;
+      batch.timeoutMs = timeoutMs;
+      batch.run.cancel = &g_interrupt;
+      signal(SIGINT, onInterrupt);
+      BatchSummary summary = runBatch(files, batch, context, cout);
+      if (memStats) {
+        printMemStats();
+      }
+      return summary.failed == 0 ? 0 : 1;
+    }
+
     // Read the input file
-    setFilename(filename);
-    string json = readFile(filename);
-    if (json.empty()) {
+    context.filename = filename;
+    string contents;
+    {
+      MemPhaseScope phase(MemPhase::READ);
+      contents = readFile(filename);
+    }
+    if (contents.empty()) {
       cerr << "Error: Could not read " << filename << '\n';
       return 1;
     }
 
-    // Parse the JSON
-    Parser parser(json);
-    GameInput input = parser.parse();
+    // Re-execute a recorded run and check it still resolves the same way
+    if (replayMode) {
+      ReplayReport report = replayRunLog(contents);
+      cout << fixed << setprecision(3);
+      cout << "REPLAY " << filename << ": " << (report.identical ? "identical" : "DIVERGED") << " ("
+           << report.steps << " of " << report.recordedSteps << " recorded steps)\n";
+      if (!report.identical) {
+        cout << "  Step " << report.divergedAt << ": " << report.detail << '\n';
+      }
+      cout << "  Setup: " << report.setupMs << " ms   Run: " << report.runMs << " ms\n";
+      return report.identical ? 0 : 1;
+    }
+
+    // Parse the JSON (or decode the binary frame)
+    GameInput input;
+    {
+      MemPhaseScope phase(MemPhase::PARSE);
+      if (inputFormat == "binary") {
+        input = decodeGameInput(contents);
+      } else {
+        Parser parser(std::move(contents), context, lazyCards);
+        input = parser.parse();
+      }
+    }
+
+    bool textOutput = (outputFormat == "text");
 
     // Print some info about what we parsed
-    cout << "Parsed " << input.cards.size() << " card definitions\n";
-    cout << "Active player: " << input.activePlayer << '\n';
-    cout << "Priority: " << input.priorityPlayer << '\n';
-    if (!input.currentPhase.empty()) {
-      cout << "Current Phase: " << input.currentPhase << '\n';
+    if (textOutput) {
+      cout << "Parsed " << input.cards->parsedCount() << " card definitions";
+      if (input.cards->deferredCount() > 0) {
+        cout << " (" << input.cards->deferredCount() << " deferred)";
+      }
+      cout << '\n';
+      cout << "Active player: " << input.activePlayer << '\n';
+      cout << "Priority: " << input.priorityPlayer << '\n';
+      if (!input.currentPhase.empty()) {
+        cout << "Current Phase: " << input.currentPhase << '\n';
+      }
+      cout << "Stack size: " << input.stack.size() << '\n';
+      cout << '\n';
+    }
+
+    // Randomised responses instead of one fixed resolution
+    if (rolloutMode) {
+      rollout.maxSteps = options.maxSteps;
+      rollout.maxStackDepth = options.maxStackDepth;
+      RolloutSummary summary = runRollouts(input, rollout);
+      reportDeferredErrors(input.cards, poolNames(input.cards), context);
+      {
+        MemPhaseScope phase(MemPhase::OUTPUT);
+        if (outputFormat == "text") {
+          printRolloutSummary(summary);
+        } else {
+          cout << writeRolloutJson(summary) << '\n';
+        }
+      }
+      if (memStats) {
+        printMemStats();
+      }
+      return 0;
+    }
+
+    // One resolution per legal target of the top spell, ranked
+    if (whatIfMode) {
+      WhatIfOptions whatIf;
+      whatIf.threads = rollout.threads;
+      whatIf.maxSteps = options.maxSteps;
+      whatIf.maxStackDepth = options.maxStackDepth;
+      vector<WhatIfOutcome> outcomes = evaluateTargets(input, whatIf);
+      reportDeferredErrors(input.cards, poolNames(input.cards), context);
+      {
+        MemPhaseScope phase(MemPhase::OUTPUT);
+        if (outputFormat == "text") {
+          printWhatIf(outcomes);
+        } else {
+          cout << writeWhatIfJson(outcomes) << '\n';
+        }
+      }
+      if (memStats) {
+        printMemStats();
+      }
+      return 0;
+    }
+
+    // Text and JSON Lines print each step as it resolves; the other formats need the whole Output
+    TextStepSink textSteps(cout);
+    JsonLinesStepSink jsonSteps(cout);
+    StepSink *sink = nullptr;
+    if (textOutput) {
+      cout << "STACK RESOLUTION\n\n";
+      sink = &textSteps;
+    } else if (outputFormat == "jsonl") {
+      sink = &jsonSteps;
     }
-    cout << "Stack size: " << input.stack.size() << '\n';
-    cout << '\n';
 
-    // Run
-    Engine engine(input);
-    Output out = engine.run();
+    // Run (a recorded run keeps its steps for the log and prints them afterwards)
+    options.cancel = &g_interrupt;
+    signal(SIGINT, onInterrupt);
+    optional<RunRecorder> recorder;
+    shared_ptr<const CardDatabase> cards = input.cards;
+    unordered_set<string> deferredCards;
+    Output out;
+    {
+      MemPhaseScope phase(MemPhase::RESOLVE);
+      if (!recordPath.empty()) {
+        recorder.emplace(input, options);
+      } else {
+        options.steps = sink;
+      }
+      Engine engine(std::move(input), context);
+      if (timeoutMs > 0) {
+        options.deadline = chrono::steady_clock::now() + chrono::milliseconds(timeoutMs);
+      }
+      out = engine.run(options);
+      deferredCards = engine.takeDeferredLookups();
+    }
+    reportDeferredErrors(cards, deferredCards, context);
+
+    if (recorder) {
+      string log = recorder->finish(out);
+      ofstream logFile(recordPath, ios::binary);
+      if (!logFile.write(log.data(), static_cast<streamsize>(log.size()))) {
+        cerr << "Error: Could not write " << recordPath << '\n';
+        return 1;
+      }
+      if (sink != nullptr) {
+        for (const auto &step : out.steps) {
+          sink->step(step);
+        }
+        out.steps.clear();
+      }
+    }
 
     // Print
-    printOutput(out);
+    {
+      MemPhaseScope phase(MemPhase::OUTPUT);
+      if (textOutput) {
+        printOutput(out, textSteps.steps());
+      } else if (outputFormat == "jsonl") {
+        // Last line: the Output itself, with the steps already sent above
+        cout << writeOutputJson(out) << '\n';
+      } else {
+        // One buffer, one write
+        string payload = (outputFormat == "json") ? writeOutputJson(out) + '\n' : encodeOutput(out);
+        cout.flush();
+        fwrite(payload.data(), 1, payload.size(), stdout);
+        fflush(stdout);
+      }
+    }
+    if (memStats) {
+      printMemStats();
+    }
 
   } catch (const exception &e) {
     // Other errors
@@ -0,0 +1,121 @@
+#include "mem_stats.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+using namespace std;
+
+namespace {
+
+struct PhaseCounters {
+  atomic<uint64_t> allocations{0};
+  atomic<uint64_t> bytes{0};
+  atomic<int64_t> peakLiveBytes{0};
+};
+
+atomic<bool> g_enabled{false};
+atomic<int64_t> g_liveBytes{0};
+atomic<int64_t> g_peakLiveBytes{0};
+PhaseCounters g_phases[static_cast<size_t>(MemPhase::COUNT)];
+
+void raiseTo(atomic<int64_t> &peak, int64_t value) {
+  int64_t seen = peak.load(memory_order_relaxed);
+  while (value > seen && !peak.compare_exchange_weak(seen, value, memory_order_relaxed)) {
+  }
+}
+
+// Every block carries a header with the bytes it was charged (0: allocated before the stats were
+// on), so a free only gives back what its allocation counted and "live" can't drift below zero
+constexpr size_t kHeader = alignof(max_align_t);
+static_assert(kHeader >= sizeof(int64_t), "the header holds the charged size");
+
+auto recordAllocation(void *block, size_t size) -> int64_t {
+  // Live totals use the usable block size so a free subtracts exactly what the allocation added
+
+  auto usable = static_cast<int64_t>(malloc_usable_size(block));
+  int64_t live = g_liveBytes.fetch_add(usable, memory_order_relaxed) + usable;
+
+  PhaseCounters &phase = g_phases[static_cast<size_t>(t_memPhase)];
+  phase.allocations.fetch_add(1, memory_order_relaxed);
+  phase.bytes.fetch_add(size, memory_order_relaxed);
+  raiseTo(phase.peakLiveBytes, live);
+  raiseTo(g_peakLiveBytes, live);
+  return usable;
+}
+
+auto allocate(size_t size) -> void * {
+  if (size > SIZE_MAX - kHeader) {
+    throw bad_alloc();
+  }
+  auto *block = static_cast<char *>(malloc(size + kHeader));
+  if (block == nullptr) {
+    throw bad_alloc();
+  }
+  int64_t charged = g_enabled.load(memory_order_relaxed) ? recordAllocation(block, size) : 0;
+  *reinterpret_cast<int64_t *>(block) = charged;
+  return block + kHeader;
+}
+
+void release(void *ptr) noexcept {
+  if (ptr == nullptr) {
+    return;
+  }
+  char *block = static_cast<char *>(ptr) - kHeader;
+  int64_t charged = *reinterpret_cast<int64_t *>(block);
+  if (charged != 0) {
+    g_liveBytes.fetch_sub(charged, memory_order_relaxed);
+  }
+  free(block);
+}
+
+}
+
+// ---- Global replacements (the nothrow and array forms forward to these) ----
+
+auto operator new(size_t size) -> void * { return allocate(size); }
+auto operator new[](size_t size) -> void * { return allocate(size); }
+void operator delete(void *ptr) noexcept { release(ptr); }
+void operator delete[](void *ptr) noexcept { release(ptr); }
+void operator delete(void *ptr, size_t /*size*/) noexcept { release(ptr); }
+void operator delete[](void *ptr, size_t /*size*/) noexcept { release(ptr); }
+
+// ---- Reporting ----
+
+auto memPhaseName(MemPhase phase) -> const char * {
+  switch (phase) {
+  case MemPhase::OTHER:
+    return "other";
+  case MemPhase::READ:
+    return "read";
+  case MemPhase::TOKENIZE:
+    return "tokenize";
+  case MemPhase::PARSE:
+    return "parse";
+  case MemPhase::ABILITY_PARSE:
+    return "ability-parse";
+  case MemPhase::RESOLVE:
+    return "resolve";
+  case MemPhase::OUTPUT:
+    return "output";
+  case MemPhase::COUNT:
+    break;
+  }
+  return "unknown";
+}
+
+void enableMemStats() { g_enabled.store(true, memory_order_relaxed); }
+
+auto memStatsReport() -> MemStatsReport {
+  MemStatsReport report;
+  for (size_t i = 0; i < report.phases.size(); i++) {
+    report.phases[i].allocations = g_phases[i].allocations.load(memory_order_relaxed);
+    report.phases[i].bytes = g_phases[i].bytes.load(memory_order_relaxed);
+    report.phases[i].peakLiveBytes = g_phases[i].peakLiveBytes.load(memory_order_relaxed);
+  }
+  report.liveBytes = g_liveBytes.load(memory_order_relaxed);
+  report.peakLiveBytes = g_peakLiveBytes.load(memory_order_relaxed);
+  return report;
+}
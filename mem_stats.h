@@ -0,0 +1,66 @@
+/*
+  Opt-in allocation accounting (--mem-stats). mem_stats.cpp replaces the global operator new /
+  delete for the mtg_engine executable; once enableMemStats() is called every allocation is
+  charged to the phase the allocating thread is in: how many, how many bytes, and the highest
+  process-wide live byte count reached while that phase was allocating. Each block remembers what
+  it was charged, so freeing one allocated before the stats were on doesn't lower the live total.
+
+  Phases are tagged with MemPhaseScope where the work happens (the tokenizer, the ability parser,
+  main's read / parse / resolve / output blocks, the rollout and what-if workers). The tag is a
+  thread_local write, so the scopes cost nothing worth measuring when the stats are off, and
+  modules that tag phases don't need mem_stats.cpp linked in.
+*/
+
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+enum class MemPhase : uint8_t {
+  OTHER,                                    // Anything untagged (startup, argument parsing, ...)
+  READ,                                     // Loading the input file
+  TOKENIZE,                                 // Structural index over the JSON text
+  PARSE,                                    // Building GameInput (or decoding a binary frame)
+  ABILITY_PARSE,                            // Rules text -> triggers / effects
+  RESOLVE,                                  // Engine setup and the run itself
+  OUTPUT,                                   // Printing / serialising the Output
+  COUNT
+};
+
+inline thread_local MemPhase t_memPhase = MemPhase::OTHER;
+
+class MemPhaseScope {
+  // Tags this thread's allocations with a phase until the scope ends (nests; restores the outer one)
+  MemPhase previous;
+
+public:
+  explicit MemPhaseScope(MemPhase phase) : previous(t_memPhase) { t_memPhase = phase; }
+  ~MemPhaseScope() { t_memPhase = previous; }
+  MemPhaseScope(const MemPhaseScope &) = delete;
+  auto operator=(const MemPhaseScope &) -> MemPhaseScope & = delete;
+};
+
+struct MemPhaseStats {
+  uint64_t allocations = 0;
+  uint64_t bytes = 0;                       // Requested bytes
+  int64_t peakLiveBytes = 0;                // Highest live total seen by one of this phase's allocations
+};
+
+struct MemStatsReport {
+  array<MemPhaseStats, static_cast<size_t>(MemPhase::COUNT)> phases;
+  int64_t liveBytes = 0;                    // Still allocated (since enableMemStats) when the report was taken
+  int64_t peakLiveBytes = 0;
+};
+
+auto memPhaseName(MemPhase phase) -> const char *;
+
+// Start counting; call early in main, before the work worth measuring
+void enableMemStats();
+
+auto memStatsReport() -> MemStatsReport;
+
+#endif
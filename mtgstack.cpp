@@ -0,0 +1,236 @@
+#include "mtgstack.h"
+#include "context.h"
+#include "engine.h"
+#include "json_writer.h"
+#include "parser.h"
+#include "result_cache.h"
+#include "wire.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <sstream>
+#include <unordered_set>
+
+using namespace std;
+
+struct mtg_context {
+  Context context;
+  ostringstream diagnostics;                // Syntax errors of the current parse
+  int maxSteps = 0;
+  size_t maxStackDepth = 0;
+  int timeoutMs = 0;
+  bool lazyCards = false;
+  OutputCache *cache = nullptr;             // Borrowed from an mtg_cache
+  string lastError;
+
+  mtg_context() { context.diagnostics = &diagnostics; }
+};
+
+struct mtg_game {
+  GameInput input;
+};
+
+struct mtg_cache {
+  OutputCache outputs;
+
+  explicit mtg_cache(size_t capacity) : outputs(capacity) {}
+};
+
+namespace {
+
+auto runOptions(const mtg_context &ctx) -> RunOptions {
+  // Budgets start counting at the call, not when the limits were set
+
+  RunOptions options;
+  options.maxSteps = ctx.maxSteps;
+  options.maxStackDepth = ctx.maxStackDepth;
+  if (ctx.timeoutMs > 0) {
+    options.deadline = chrono::steady_clock::now() + chrono::milliseconds(ctx.timeoutMs);
+  }
+  return options;
+}
+
+auto resolve(const mtg_context &ctx, const GameInput &input, unordered_set<string> &deferredCards) -> Output {
+  // Through the context's cache when it has one
+
+  if (ctx.cache != nullptr) {
+    CachedRun run = resolveCached(input, ctx.context, runOptions(ctx), *ctx.cache);
+    deferredCards = std::move(run.deferredCards);
+    return std::move(run.output);
+  }
+  Engine engine(input, ctx.context);
+  Output output = engine.run(runOptions(ctx));
+  deferredCards = engine.takeDeferredLookups();
+  return output;
+}
+
+auto deferredErrors(mtg_context &ctx, const GameInput &input, const unordered_set<string> &deferredCards) -> bool {
+  // Cards a lazy parse skipped are parsed while resolving; their syntax errors fail the call
+
+  vector<string> errors = input.cards ? input.cards->deferredErrors(deferredCards) : vector<string>();
+  if (errors.empty()) {
+    return false;
+  }
+  ctx.lastError.clear();
+  for (const auto &error : errors) {
+    ctx.lastError += (ctx.lastError.empty() ? "" : "\n") + error;
+  }
+  ctx.context.syntaxErrors += static_cast<int>(errors.size());
+  return true;
+}
+
+auto copyOut(const string &bytes, size_t *length) -> char * {
+  // malloc'd so C callers can free it (with mtg_free)
+
+  auto *buffer = static_cast<char *>(malloc(bytes.size() + 1));
+  if (buffer == nullptr) {
+    throw bad_alloc();
+  }
+  memcpy(buffer, bytes.data(), bytes.size());
+  buffer[bytes.size()] = '\0';
+  if (length != nullptr) {
+    *length = bytes.size();
+  }
+  return buffer;
+}
+
+template <typename F> auto guarded(mtg_context *ctx, F &&call) -> int {
+  // No exception crosses the C boundary
+
+  if (ctx == nullptr) {
+    return MTG_ERROR;
+  }
+  ctx->lastError.clear();
+  try {
+    return call();
+  } catch (const exception &e) {
+    ctx->lastError = e.what();
+  } catch (...) {
+    ctx->lastError = "unknown error";
+  }
+  return MTG_ERROR;
+}
+
+}
+
+extern "C" {
+
+auto mtg_context_new(void) -> mtg_context * {
+  try {
+    return new mtg_context();
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void mtg_context_free(mtg_context *ctx) { delete ctx; }
+
+void mtg_context_set_limits(mtg_context *ctx, int max_steps, size_t max_stack_depth, int timeout_ms) {
+  if (ctx != nullptr) {
+    ctx->maxSteps = max_steps;
+    ctx->maxStackDepth = max_stack_depth;
+    ctx->timeoutMs = timeout_ms;
+  }
+}
+
+void mtg_context_set_lazy_cards(mtg_context *ctx, int lazy) {
+  if (ctx != nullptr) {
+    ctx->lazyCards = (lazy != 0);
+  }
+}
+
+auto mtg_cache_new(size_t capacity) -> mtg_cache * {
+  try {
+    return new mtg_cache(capacity);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+void mtg_cache_free(mtg_cache *cache) { delete cache; }
+
+void mtg_cache_stats(const mtg_cache *cache, size_t *hits, size_t *misses) {
+  if (hits != nullptr) {
+    *hits = cache != nullptr ? cache->outputs.hits() : 0;
+  }
+  if (misses != nullptr) {
+    *misses = cache != nullptr ? cache->outputs.misses() : 0;
+  }
+}
+
+void mtg_context_set_cache(mtg_context *ctx, mtg_cache *cache) {
+  if (ctx != nullptr) {
+    ctx->cache = cache != nullptr ? &cache->outputs : nullptr;
+  }
+}
+
+auto mtg_last_error(const mtg_context *ctx) -> const char * { return ctx != nullptr ? ctx->lastError.c_str() : ""; }
+
+auto mtg_parse_json(mtg_context *ctx, const char *json, size_t length, mtg_game **game) -> int {
+  return guarded(ctx, [&]() {
+    if (json == nullptr || game == nullptr) {
+      ctx->lastError = "mtg_parse_json: null argument";
+      return MTG_ERROR;
+    }
+    *game = nullptr;
+
+    ctx->diagnostics.str("");
+    int errorsBefore = ctx->context.syntaxErrors;
+    Parser parser(string(json, length), ctx->context, ctx->lazyCards);
+    GameInput input = parser.parse();
+    if (ctx->context.syntaxErrors != errorsBefore) {
+      ctx->lastError = ctx->diagnostics.str();
+      while (!ctx->lastError.empty() && ctx->lastError.back() == '\n') {
+        ctx->lastError.pop_back();
+      }
+      return MTG_SYNTAX_ERROR;
+    }
+
+    *game = new mtg_game{std::move(input)};
+    return MTG_OK;
+  });
+}
+
+void mtg_game_free(mtg_game *game) { delete game; }
+
+auto mtg_resolve(mtg_context *ctx, const mtg_game *game, char **out, size_t *out_length) -> int {
+  return guarded(ctx, [&]() {
+    if (game == nullptr || out == nullptr) {
+      ctx->lastError = "mtg_resolve: null argument";
+      return MTG_ERROR;
+    }
+
+    // The engine takes its state by value; the copy shares the card pool
+    unordered_set<string> deferredCards;
+    Output result = resolve(*ctx, game->input, deferredCards);
+    if (deferredErrors(*ctx, game->input, deferredCards)) {
+      return MTG_SYNTAX_ERROR;
+    }
+    *out = copyOut(writeOutputJson(result), out_length);
+    return MTG_OK;
+  });
+}
+
+auto mtg_resolve_wire(mtg_context *ctx, const void *frame, size_t length, void **out, size_t *out_length) -> int {
+  return guarded(ctx, [&]() {
+    if (frame == nullptr || out == nullptr) {
+      ctx->lastError = "mtg_resolve_wire: null argument";
+      return MTG_ERROR;
+    }
+
+    // Wire frames carry every card parsed, so there are no deferred errors to report
+    GameInput input = decodeGameInput(string_view(static_cast<const char *>(frame), length));
+    unordered_set<string> deferredCards;
+    Output result = resolve(*ctx, input, deferredCards);
+    *out = copyOut(encodeOutput(result), out_length);
+    return MTG_OK;
+  });
+}
+
+void mtg_free(void *buffer) { free(buffer); }
+
+auto mtg_wire_version(void) -> int { return kWireVersion; }
+
+}
@@ -0,0 +1,75 @@
+/*
+  C interface to libmtgstack, for services that link the engine in-process instead of running
+  mtg_engine per request.
+
+  An mtg_context carries the run budgets, the lazy-cards switch and the last error. Use one context
+  per thread (contexts share nothing but an optional mtg_cache, which is thread-safe). A parsed mtg_game is read-only, so any number of threads can
+  resolve the same game at once, each with its own context; every resolve starts from the parsed
+  state.
+
+  Buffers returned through out parameters are malloc'd; release them with mtg_free. Every call that
+  returns an int gives one of the MTG_* status codes; on failure mtg_last_error says why.
+*/
+
+#ifndef MTGSTACK_H
+#define MTGSTACK_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct mtg_context mtg_context;
+typedef struct mtg_game mtg_game;
+typedef struct mtg_cache mtg_cache;
+
+enum {
+  MTG_OK = 0,
+  MTG_SYNTAX_ERROR = 1,                     /* The game JSON has syntax errors (all of them in mtg_last_error) */
+  MTG_ERROR = 2                             /* Bad frame, bad argument, out of memory, ... */
+};
+
+mtg_context *mtg_context_new(void);
+void mtg_context_free(mtg_context *ctx);
+
+/* Budgets for the following resolves; 0 means unlimited */
+void mtg_context_set_limits(mtg_context *ctx, int max_steps, size_t max_stack_depth, int timeout_ms);
+
+/* Parse only the cards the boards and stack use (the rest on first use) */
+void mtg_context_set_lazy_cards(mtg_context *ctx, int lazy);
+
+/* Bounded LRU of resolved Outputs (see result_cache.h); repeat queries skip the engine. One cache
+   may serve any number of contexts on any number of threads; it must outlive every context using it */
+mtg_cache *mtg_cache_new(size_t capacity);
+void mtg_cache_free(mtg_cache *cache);
+void mtg_cache_stats(const mtg_cache *cache, size_t *hits, size_t *misses);
+
+/* Resolve through cache from now on (NULL: no cache) */
+void mtg_context_set_cache(mtg_context *ctx, mtg_cache *cache);
+
+/* Message for the last failed call on this context ("" if none) */
+const char *mtg_last_error(const mtg_context *ctx);
+
+/* Game JSON (the mtg_engine input format) -> *game; free it with mtg_game_free */
+int mtg_parse_json(mtg_context *ctx, const char *json, size_t length, mtg_game **game);
+void mtg_game_free(mtg_game *game);
+
+/* Resolve the whole stack; *out is the Output as one JSON object (what mtg_engine --json prints).
+   With lazy cards, a card this game uses that has syntax errors gives MTG_SYNTAX_ERROR (no *out),
+   on every call and thread that uses it */
+int mtg_resolve(mtg_context *ctx, const mtg_game *game, char **out, size_t *out_length);
+
+/* GameInput wire frame in, Output wire frame out (see wire.h) */
+int mtg_resolve_wire(mtg_context *ctx, const void *frame, size_t length, void **out, size_t *out_length);
+
+void mtg_free(void *buffer);
+
+/* Frame version this library reads and writes */
+int mtg_wire_version(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,13 +1,17 @@
 #include "parser.h"
 #include "ability_parser.h"
+#include "card_database.h"
+#include "mem_stats.h"
+#include <cctype>
 #include <iostream>
+#include <sstream>
 
 using namespace std;
 
 void Parser::error(const string &msg) {
-  // Throw a parse error at the current position
+  // Report a parse error at the current position
 
-  syntaxError(msg);
+  ctx.syntaxError(tok.currentLine(), msg);
 }
 
 void Parser::expect(TokenType expectedToken, const string &context) {
@@ -15,8 +19,8 @@ void Parser::expect(TokenType expectedToken, const string &context) {
 
   Token got = tok.getNext();
 
-  if (g_debug) {
-    cout << "[PARSER] Expecting " << tokenTypeToString(expectedToken)
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Expecting " << tokenTypeToString(expectedToken)
          << ", consumed " << tokenTypeToString(got.type) << '\n';
   }
 
@@ -45,47 +49,163 @@ void Parser::expect(TokenType expectedToken, const string &context) {
 }
 
 void Parser::skip(const string &unknownKey) {
-  // Handle unknown JSON keys.
+  // Handle JSON keys the grammar doesn't allow: report, then step over the value
 
   error("Unexpected '" + unknownKey + "'");
+  skipValue();
 }
 
-void Parser::parseTriggeredAbilityField(TriggeredAbility &ability, bool &explicitTrigger, const string &key) {
-  // Parse a single field of a triggered ability.
+void Parser::skipValue() {
+  // Step over the next value, if there is one (a missing value leaves the '}' for expect)
 
-  if (key == "trigger") {
-    ability.trigger = parseTriggerCondition();
-    explicitTrigger = true;
-    return;
+  TokenType next = tok.peekNext().type;
+  if (next != RBRACE && next != RBRACKET && next != COLON && next != COMMA && next != END_OF_FILE) {
+    tok.skipValue();
   }
+}
 
-  if (key == "effects") {
-    expect(LBRACKET);
-    while (tok.peekNext().type != RBRACKET) {
-      ability.effects.push_back(parseEffect());
-      if (tok.peekNext().type == COMMA) {
-        tok.getNext();
-      }
+// ---- Table-driven loops (keys and value shapes come from grammar_tables.h) ----
+
+namespace {
+
+auto isStringToken(TokenType type) -> bool {
+  // Quoted keywords come back as their keyword token; the text is still in Token::str
+  switch (type) {
+  case LBRACE:
+  case RBRACE:
+  case LBRACKET:
+  case RBRACKET:
+  case COLON:
+  case COMMA:
+  case NUMBER:
+  case END_OF_FILE:
+  case ERROR_TOKEN:
+    return false;
+  default:
+    return true;
+  }
+}
+
+auto startsValue(Tokenizer &tok, ValueShape shape) -> bool {
+  // The shape's FIRST set, checked on the next token's first byte so the value is scanned once.
+  // Booleans need the token: a quoted "true" counts, any other string doesn't. Bare numbers and
+  // keywords need it too, since the tokenizer rejects them when junk is stuck on the end ("20abc").
+
+  auto first = static_cast<unsigned char>(tok.peekByte());
+  switch (shape) {
+  case ValueShape::STRING:
+  case ValueShape::KEYWORD:
+    return first == '"' || ((isalpha(first) != 0 || first == '_') && tok.peekNext().type != ERROR_TOKEN);
+  case ValueShape::NUMBER:
+    return (first == '-' || isdigit(first) != 0) && tok.peekNext().type == NUMBER;
+  case ValueShape::BOOLEAN: {
+    TokenType type = tok.peekNext().type;
+    return type == TRUE || type == FALSE;
+  }
+  case ValueShape::OBJECT:
+  case ValueShape::MAP:
+    return first == '{';
+  case ValueShape::ARRAY:
+    return first == '[';
+  }
+  return false;
+}
+
+auto shapeName(ValueShape shape) -> const char * {
+  switch (shape) {
+  case ValueShape::STRING:
+    return "a string";
+  case ValueShape::NUMBER:
+    return "a number";
+  case ValueShape::BOOLEAN:
+    return "true or false";
+  case ValueShape::KEYWORD:
+    return "a keyword";
+  case ValueShape::OBJECT:
+  case ValueShape::MAP:
+    return "an object";
+  case ValueShape::ARRAY:
+    return "an array";
+  }
+  return "a value";
+}
+
+}
+
+template <typename FieldEnum, typename OnField> void Parser::forEachField(const string &context, OnField &&onField) {
+  // { "key": value, ... } in any order. onField gets each key the grammar allows here, with a
+  // value of the right shape, and consumes the value; everything else is reported and skipped.
+
+  constexpr GrammarObject object = GrammarObjectOf<FieldEnum>::value;
+  const GrammarField *fields = kGrammarObjects[static_cast<size_t>(object)].fields;
+
+  expect(LBRACE, context);
+  while (tok.peekNext().type != RBRACE && tok.peekNext().type != END_OF_FILE) {
+    Token key = tok.getNext();
+    if (!isStringToken(key.type)) {
+      error("Expected key string in " + context);
+    }
+    expect(COLON);
+
+    int field = lookupGrammarField(object, key.str);
+    if (field < 0) {
+      skip(key.str);
+    } else if (!startsValue(tok, fields[field].shape)) {
+      error(string("Expected ") + shapeName(fields[field].shape) + " for '" + key.str + "'");
+      skipValue();
+    } else {
+      onField(static_cast<FieldEnum>(field));
+    }
+
+    if (tok.peekNext().type == COMMA) {
+      tok.getNext();
     }
-    expect(RBRACKET);
-    return;
   }
+  expect(RBRACE);
+}
+
+template <typename OnElement>
+void Parser::forEachElement(const string &context, ValueShape element, OnElement &&onElement) {
+  // [ value, ... ]; onElement consumes each value that starts like an element should
 
-  if (key == "isMay") {
-    Token mayToken = tok.getNext();
-    if (mayToken.type != TRUE && mayToken.type != FALSE) {
-      error("Expected boolean 'true' or 'false' for isMay");
+  expect(LBRACKET, context);
+  while (tok.peekNext().type != RBRACKET && tok.peekNext().type != END_OF_FILE) {
+    if (startsValue(tok, element)) {
+      onElement();
+    } else {
+      error(string("Expected ") + shapeName(element) + " in " + context);
+      tok.skipValue();
+    }
+
+    if (tok.peekNext().type == COMMA) {
+      tok.getNext();
     }
-    ability.isMay = (mayToken.type == TRUE);
-    return;
   }
+  expect(RBRACKET);
+}
 
-  if (key == "text") {
-    ability.text = tok.getNext().str;
-    return;
+template <typename OnEntry> void Parser::forEachEntry(const string &context, OnEntry &&onEntry) {
+  // { "name": value, ... } with names chosen by the input (card names, player ids)
+
+  expect(LBRACE, context);
+  while (tok.peekNext().type != RBRACE && tok.peekNext().type != END_OF_FILE) {
+    Token name = tok.getNext();
+    if (!isStringToken(name.type)) {
+      error("Expected a name in " + context);
+    }
+    expect(COLON);
+    onEntry(name.str);
+
+    if (tok.peekNext().type == COMMA) {
+      tok.getNext();
+    }
   }
+  expect(RBRACE);
+}
 
-  skip(key);
+auto Parser::requireBoolean() -> bool {
+  // The field's shape was checked before its handler runs
+  return tok.getNext().type == TRUE;
 }
 
 void Parser::applyRulesTextFallback(CardDef &card) {
@@ -208,6 +328,8 @@ auto Parser::requireEffectType(TokenType token) -> EffectType {
     return EffectType::MILL;
   case BOUNCE:
     return EffectType::BOUNCE;
+  case DESTROY_ALL:
+    return EffectType::DESTROY_ALL;
   default:
     error("Expected an effect type");
     return EffectType::DEAL_DAMAGE;
@@ -249,18 +371,9 @@ auto Parser::requireTargetType(TokenType token, const string &context) -> Target
 }
 
 void Parser::parseStringArray(vector<string> &outVec) {
-  // Parse a JSON array
+  // Parse a JSON array of strings
 
-  expect(LBRACKET);
-
-  while (tok.peekNext().type != RBRACKET) {
-    outVec.push_back(tok.getNext().str);
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-
-  expect(RBRACKET);
+  forEachElement("string array", ValueShape::STRING, [&]() { outVec.push_back(tok.getNext().str); });
 }
 
 auto Parser::parseTriggerCondition() -> TriggerCondition {
@@ -270,27 +383,18 @@ auto Parser::parseTriggerCondition() -> TriggerCondition {
   bool haveEvent = false;
   bool haveScope = false;
 
-  expect(LBRACE, "trigger condition");
-
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
-
-    if (key == "event") {
+  forEachField<TriggerConditionField>("trigger condition", [&](TriggerConditionField field) {
+    switch (field) {
+    case TriggerConditionField::EVENT:
       cond.event = requireTriggerEvent(tok.getNext().type);
       haveEvent = true;
-    } else if (key == "scope") {
+      break;
+    case TriggerConditionField::SCOPE:
       cond.scope = requireTriggerScope(tok.getNext().type);
       haveScope = true;
-    } else {
-      skip(key);
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
 
   // Both event and scope are required
   if (!haveEvent || !haveScope) {
@@ -305,28 +409,23 @@ auto Parser::parseEffect() -> Effect {
   Effect eff;
   bool hasType = false;
 
-  expect(LBRACE, "effect");
-
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
-
-    if (key == "type") {
+  forEachField<EffectField>("effect", [&](EffectField field) {
+    switch (field) {
+    case EffectField::TYPE:
       eff.type = requireEffectType(tok.getNext().type);
       hasType = true;
-    } else if (key == "value") {
+      break;
+    case EffectField::VALUE:
       eff.value = tok.getNext().num;
-    } else if (key == "target") {
+      break;
+    case EffectField::TARGET:
       eff.target = requireTargetType(tok.getNext().type, "effect target");
-    } else {
-      skip(key);
+      break;
+    case EffectField::TOKEN:
+      eff.tokenName = tok.getNext().str;
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
 
   if (!hasType) {
     error("Effect missing required field");
@@ -334,23 +433,33 @@ auto Parser::parseEffect() -> Effect {
   return eff;
 }
 
+void Parser::parseEffects(vector<Effect> &effects) {
+  forEachElement("effects", ValueShape::OBJECT, [&]() { effects.push_back(parseEffect()); });
+}
+
 auto Parser::parseTriggeredAbility() -> TriggeredAbility {
   // Parse a triggered ability
 
   TriggeredAbility ability;
-  expect(LBRACE, "triggered ability");
-
   bool explicitTrigger = false;
 
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
-    parseTriggeredAbilityField(ability, explicitTrigger, key);
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
+  forEachField<TriggeredAbilityField>("triggered ability", [&](TriggeredAbilityField field) {
+    switch (field) {
+    case TriggeredAbilityField::TRIGGER:
+      ability.trigger = parseTriggerCondition();
+      explicitTrigger = true;
+      break;
+    case TriggeredAbilityField::EFFECTS:
+      parseEffects(ability.effects);
+      break;
+    case TriggeredAbilityField::IS_MAY:
+      ability.isMay = requireBoolean();
+      break;
+    case TriggeredAbilityField::TEXT:
+      ability.text = tok.getNext().str;
+      break;
     }
-  }
-  expect(RBRACE);
+  });
 
   // If we only got text, try to parse it for effects
   if (!ability.text.empty()) {
@@ -369,121 +478,98 @@ auto Parser::parseTriggeredAbility() -> TriggeredAbility {
 auto Parser::parseCardDef(const string &name) -> CardDef {
   // Parse a card definition
 
-  if (g_debug) {
-    cout << "[PARSER] Parsing card for \"" << name << "\"" << '\n';
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Parsing card for \"" << name << "\"" << '\n';
   }
 
   CardDef card;
   card.name = name;
 
-  expect(LBRACE, "card for " + name);
-
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
-
-    if (key == "text") {
+  forEachField<CardDefField>("card for " + name, [&](CardDefField field) {
+    switch (field) {
+    case CardDefField::TEXT:
       card.rulesText = tok.getNext().str;
-    } else if (key == "types") {
+      break;
+    case CardDefField::TYPES:
       parseStringArray(card.types);
-    } else if (key == "subtypes") {
+      break;
+    case CardDefField::SUBTYPES:
       parseStringArray(card.subtypes);
-    } else if (key == "keywords") {
+      break;
+    case CardDefField::KEYWORDS:
       parseStringArray(card.keywords);
-    } else if (key == "power") {
+      break;
+    case CardDefField::POWER:
       card.power = tok.getNext().num;
-    } else if (key == "toughness") {
+      break;
+    case CardDefField::TOUGHNESS:
       card.toughness = tok.getNext().num;
-    } else if (key == "spellTarget") {
+      break;
+    case CardDefField::SPELL_TARGET:
       card.spellTarget = requireTargetType(tok.getNext().type, "spellTarget");
-    } else if (key == "spellEffects") {
-      // Parse array of effects
-      expect(LBRACKET);
-      while (tok.peekNext().type != RBRACKET) {
-        card.spellEffects.push_back(parseEffect());
-        if (tok.peekNext().type == COMMA) {
-          tok.getNext();
-        }
-      }
-      expect(RBRACKET);
-    } else if (key == "triggeredAbilities") {
-      // Parse array of triggered abilities
-      expect(LBRACKET);
-      while (tok.peekNext().type != RBRACKET) {
-        card.triggeredAbilities.push_back(parseTriggeredAbility());
-        if (tok.peekNext().type == COMMA) {
-          tok.getNext();
-        }
-      }
-      expect(RBRACKET);
-    } else {
-      skip(key);
+      break;
+    case CardDefField::SPELL_EFFECTS:
+      parseEffects(card.spellEffects);
+      break;
+    case CardDefField::TRIGGERED_ABILITIES:
+      forEachElement("triggeredAbilities", ValueShape::OBJECT,
+                     [&]() { card.triggeredAbilities.push_back(parseTriggeredAbility()); });
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
 
   // Try to fill in missing data from rules text
   applyRulesTextFallback(card);
+  card.keywordMask = keywordMask(card.keywords);
   return card;
 }
 
 // Parse the"cards object (card name -> definition map)
 void Parser::parseCards(unordered_map<string, CardDef> &cards) {
-  if (g_debug) {
-    cout << "[PARSER] Parsing 'cards' object" << '\n';
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Parsing 'cards' object" << '\n';
   }
 
-  expect(LBRACE, "cards object");
-
-  while (tok.peekNext().type != RBRACE) {
-    Token nameToken = tok.getNext();
-    if (nameToken.type != STRING) {
-      error("Expected card name");
-    }
-    expect(COLON);
-    cards[nameToken.str] = parseCardDef(nameToken.str);
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
+  forEachEntry("cards object", [&](const string &name) {
+    if (deferCards) {
+      deferredSpans[name] = tok.skipValue();
+    } else {
+      cards[name] = parseCardDef(name);
     }
-  }
-  expect(RBRACE);
+  });
 }
 
 auto Parser::parsePermanent() -> Permanent {
   // Parse a permanent on the battlefield
 
   Permanent perm;
-  expect(LBRACE, "permanent");
 
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
-
-    if (key == "id") {
+  forEachField<PermanentField>("permanent", [&](PermanentField field) {
+    switch (field) {
+    case PermanentField::ID:
       perm.id = tok.getNext().str;
-    } else if (key == "name") {
+      break;
+    case PermanentField::NAME:
       perm.cardName = tok.getNext().str;
-    } else if (key == "controller") {
+      break;
+    case PermanentField::CONTROLLER:
       perm.controller = tok.getNext().str;
-    } else if (key == "tapped") {
-      Token tappedToken = tok.getNext();
-      if (tappedToken.type != TRUE && tappedToken.type != FALSE) {
-        error("Expected boolean for tapped status");
+      break;
+    case PermanentField::TAPPED:
+      perm.tapped = requireBoolean();
+      break;
+    case PermanentField::TOKEN:
+      perm.isToken = requireBoolean();
+      break;
+    case PermanentField::COUNT:
+      perm.count = tok.getNext().num;
+      if (perm.count < 1) {
+        error("Permanent count must be at least 1");
+        perm.count = 1;
       }
-      perm.tapped = (tappedToken.type == TRUE);
-    } else {
-      skip(key);
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
   return perm;
 }
 
@@ -491,164 +577,240 @@ auto Parser::parseBoard() -> Board {
   // Parse one player's board state
 
   Board board;
-  expect(LBRACE, "board");
-
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
 
-    if (key == "life") {
+  forEachField<BoardField>("board", [&](BoardField field) {
+    switch (field) {
+    case BoardField::LIFE:
       board.life = tok.getNext().num;
-    } else if (key == "player") {
+      break;
+    case BoardField::PLAYER:
       board.player = tok.getNext().str;
-    } else if (key == "permanents") {
-      expect(LBRACKET);
-      while (tok.peekNext().type != RBRACKET) {
-        board.permanents.push_back(parsePermanent());
-        if (tok.peekNext().type == COMMA) {
-          tok.getNext();
-        }
-      }
-      expect(RBRACKET);
-    } else {
-      skip(key);
+      break;
+    case BoardField::PERMANENTS:
+      forEachElement("permanents", ValueShape::OBJECT, [&]() { board.permanents.push_back(parsePermanent()); });
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
   return board;
 }
 
 void Parser::parseBoards(unordered_map<PlayerID, Board> &boards) {
   // Parse the "boards" object
 
-  if (g_debug) {
-    cout << "[PARSER] Parsing 'boards' object" << '\n';
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Parsing 'boards' object" << '\n';
   }
 
-  expect(LBRACE, "boards");
-
-  while (tok.peekNext().type != RBRACE) {
-    string playerId = tok.getNext().str;
-    expect(COLON);
+  forEachEntry("boards", [&](const string &playerId) {
     Board board = parseBoard();
     board.player = playerId;
     boards[playerId] = board;
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
 }
 
 auto Parser::parseStackItem() -> StackItem {
   // Parse one item on the stack (spell or ability)
 
   StackItem item;
-  expect(LBRACE, "stack item");
-
-  while (tok.peekNext().type != RBRACE) {
-    string key = tok.getNext().str;
-    expect(COLON);
 
-    if (key == "id") {
+  forEachField<StackItemField>("stack item", [&](StackItemField field) {
+    switch (field) {
+    case StackItemField::ID:
       item.id = tok.getNext().str;
-    } else if (key == "kind") {
+      break;
+    case StackItemField::KIND:
       item.kind = tok.getNext().str;
-    } else if (key == "sourceName") {
+      break;
+    case StackItemField::SOURCE_NAME:
       item.sourceName = tok.getNext().str;
-    } else if (key == "sourceId") {
+      break;
+    case StackItemField::SOURCE_ID:
       item.sourceId = tok.getNext().str;
-    } else if (key == "abilityIndex") {
+      break;
+    case StackItemField::ABILITY_INDEX:
       item.abilityIndex = tok.getNext().num;
-    } else if (key == "controller") {
+      break;
+    case StackItemField::CONTROLLER:
       item.controller = tok.getNext().str;
-    } else if (key == "targetId") {
+      break;
+    case StackItemField::TARGET_ID:
       item.targetId = tok.getNext().str;
-    } else if (key == "targetStackId") {
+      break;
+    case StackItemField::TARGET_STACK_ID:
       item.targetStackId = tok.getNext().str;
-    } else if (key == "targetPlayer") {
+      break;
+    case StackItemField::TARGET_PLAYER:
       item.targetPlayer = tok.getNext().str;
-    } else {
-      skip(key);
-    }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
+      break;
     }
-  }
-  expect(RBRACE);
+  });
   return item;
 }
 
 void Parser::parseStack(vector<StackItem> &stack) {
   // Parse the "stack" array
 
-  if (g_debug) {
-    cout << "[PARSER] Parsing 'stack' array" << '\n';
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Parsing 'stack' array" << '\n';
   }
 
-  expect(LBRACKET, "stack");
+  forEachElement("stack", ValueShape::OBJECT, [&]() { stack.push_back(parseStackItem()); });
+}
 
-  while (tok.peekNext().type != RBRACKET) {
-    stack.push_back(parseStackItem());
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
+void Parser::parseResponses(unordered_map<PlayerID, vector<StackItem>> &responses) {
+  // Parse the "responses" object: player id -> array of stack items they could cast
+
+  forEachEntry("responses", [&](const string &player) {
+    vector<StackItem> &pool = responses[player];
+    parseStack(pool);
+    for (auto &item : pool) {
+      if (item.controller.empty()) {
+        item.controller = player;
+      }
+      if (item.kind.empty()) {
+        item.kind = "SPELL";
+      }
     }
-  }
-  expect(RBRACKET);
+  });
+}
+
+void Parser::parseCombat(Combat &combat) {
+  // {"attackers": [{"id": "p1_3", "defender": "p2"}], "blockers": [{"id": "p2_1", "blocking": "p1_3"}]}
+
+  forEachField<CombatField>("combat", [&](CombatField field) {
+    switch (field) {
+    case CombatField::ATTACKERS:
+      forEachElement("attackers", ValueShape::OBJECT, [&]() {
+        Attack attack;
+        forEachField<AttackField>("attacker", [&](AttackField key) {
+          (key == AttackField::ID ? attack.attacker : attack.defender) = tok.getNext().str;
+        });
+        combat.attacks.push_back(attack);
+      });
+      break;
+    case CombatField::BLOCKERS:
+      forEachElement("blockers", ValueShape::OBJECT, [&]() {
+        Block block;
+        forEachField<BlockField>("blocker", [&](BlockField key) {
+          (key == BlockField::ID ? block.blocker : block.attacker) = tok.getNext().str;
+        });
+        combat.blocks.push_back(block);
+      });
+      break;
+    }
+  });
 }
 
 auto Parser::parse() -> GameInput {
   // Main entry point: parse the entire JSON input
 
-  if (g_debug) {
-    cout << "[PARSER] Starting..." << '\n';
+  if (ctx.debug) {
+    *ctx.trace << "[PARSER] Starting..." << '\n';
   }
 
   GameInput input;
-
-  expect(LBRACE, "root object");
-
-  while (tok.peekNext().type != RBRACE && tok.peekNext().type != END_OF_FILE) {
-    Token keyToken = tok.getNext();
-    if (keyToken.type != STRING) {
-      error("Expected key string");
-    }
-    string key = keyToken.str;
-    expect(COLON);
-
-    if (key == "cards") {
-      parseCards(input.cards);
-    } else if (key == "activePlayer") {
+  unordered_map<string, CardDef> cards;
+
+  forEachField<GameInputField>("root object", [&](GameInputField field) {
+    switch (field) {
+    case GameInputField::CARDS:
+      parseCards(cards);
+      break;
+    case GameInputField::ACTIVE_PLAYER:
       input.activePlayer = tok.getNext().str;
-    } else if (key == "priorityPlayer") {
+      break;
+    case GameInputField::PRIORITY_PLAYER:
       input.priorityPlayer = tok.getNext().str;
-    } else if (key == "currentPhase") {
+      break;
+    case GameInputField::CURRENT_PHASE:
       input.currentPhase = tok.getNext().str;
-    } else if (key == "turnNumber") {
+      break;
+    case GameInputField::TURN_NUMBER:
       tok.getNext();
-    } else if (key == "boards") {
+      break;
+    case GameInputField::BOARDS:
       parseBoards(input.boards);
-    } else if (key == "stack") {
+      break;
+    case GameInputField::STACK:
       parseStack(input.stack);
-    } else {
-      skip(key);
+      break;
+    case GameInputField::RESPONSES:
+      parseResponses(input.responses);
+      break;
+    case GameInputField::COMBAT:
+      parseCombat(input.combat);
+      break;
     }
-
-    if (tok.peekNext().type == COMMA) {
-      tok.getNext();
-    }
-  }
-  expect(RBRACE);
+  });
 
   // Default priority to active player if not specified
   if (input.priorityPlayer.empty()) {
     input.priorityPlayer = input.activePlayer;
   }
 
+  DeferredCards deferred;
+  if (deferCards) {
+    deferred = materializeReferencedCards(input, cards);
+  }
+  input.cards = make_shared<const CardDatabase>(std::move(cards), std::move(deferred));
   return input;
 }
+
+auto Parser::materializeReferencedCards(const GameInput &input, unordered_map<string, CardDef> &cards)
+    -> DeferredCards {
+  // Cards may come before or after boards/stack in the document, so this runs once at the end
+
+  auto materialize = [&](const string &name) {
+    auto it = deferredSpans.find(name);
+    if (it == deferredSpans.end()) {
+      return;
+    }
+    Parser cardParser(tok.source().substr(it->second.begin, it->second.end - it->second.begin), ctx,
+                      false, it->second.line);
+    cards[name] = cardParser.parseCardDef(name);
+    deferredSpans.erase(it);
+  };
+
+  for (const auto &[playerId, board] : input.boards) {
+    for (const auto &perm : board.permanents) {
+      materialize(perm.cardName);
+    }
+  }
+  for (const auto &item : input.stack) {
+    materialize(item.sourceName);
+  }
+  for (const auto &[player, pool] : input.responses) {
+    for (const auto &item : pool) {
+      materialize(item.sourceName);
+    }
+  }
+
+  DeferredCards deferred;
+  if (!deferredSpans.empty()) {
+    deferred.source = make_shared<const string>(tok.source());
+    deferred.spans = std::move(deferredSpans);
+    deferred.filename = ctx.filename;
+  }
+  return deferred;
+}
+
+auto Parser::parseDeferredCard(const DeferredCards &deferred, const string &name, string &errors)
+    -> optional<CardDef> {
+  // Parse one skipped card straight from its span (on first lookup, usually mid-resolve). The
+  // caller's Context is long gone by now, so diagnostics are handed back instead of printed.
+
+  MemPhaseScope phase(MemPhase::PARSE);
+  auto it = deferred.spans.find(name);
+  if (it == deferred.spans.end() || !deferred.source) {
+    return nullopt;
+  }
+  const SourceSpan &span = it->second;
+  ostringstream diagnostics;
+  Context context;
+  context.filename = deferred.filename;
+  context.diagnostics = &diagnostics;
+  Parser cardParser(deferred.source->substr(span.begin, span.end - span.begin), context, false, span.line);
+  optional<CardDef> card = cardParser.parseCardDef(name);
+  errors = diagnostics.str();
+  return card;
+}
@@ -5,8 +5,11 @@
 #ifndef PARSER_H
 #define PARSER_H
 
+#include "context.h"
+#include "grammar_tables.h"
 #include "tokenizer.h"
 #include "types.h"
+#include <optional>
 #include <stdexcept>
 #include <string>
 #include <unordered_map>
@@ -16,6 +19,9 @@ using namespace std;
 
 class Parser {
   Tokenizer tok;
+  Context &ctx;                             // Where syntax errors and debug traces go
+  bool deferCards = false;                  // Skip card bodies, parse only the ones the game uses
+  unordered_map<string, SourceSpan> deferredSpans;
 
   // Consumes a token and check it's what we expected
   void expect(TokenType expectedToken, const string &context = "");
@@ -23,11 +29,14 @@ class Parser {
   // Throw error at the current position
   void error(const string &msg);
 
-  // Called for unknown JSON keys
+  // Called for JSON keys the grammar doesn't allow; skips the value
   void skip(const string &unknownKey);
+  void skipValue();
 
-  // Parse a single field within a triggered ability
-  void parseTriggeredAbilityField(TriggeredAbility &ability, bool &explicitTrigger, const string &key);
+  // Table-driven loops over an object's fields, an array's elements and a map's entries
+  template <typename FieldEnum, typename OnField> void forEachField(const string &context, OnField &&onField);
+  template <typename OnElement> void forEachElement(const string &context, ValueShape element, OnElement &&onElement);
+  template <typename OnEntry> void forEachEntry(const string &context, OnEntry &&onEntry);
 
   // Try to parse effects
   static void applyRulesTextFallback(CardDef &card);
@@ -37,6 +46,7 @@ class Parser {
   auto requireTriggerScope(TokenType token) -> TriggerScope;
   auto requireEffectType(TokenType token) -> EffectType;
   auto requireTargetType(TokenType token, const string &context) -> TargetType;
+  auto requireBoolean() -> bool;
 
   // Parse a JSON array of strings
   void parseStringArray(vector<string> &outVec);
@@ -47,17 +57,33 @@ class Parser {
   auto parseTriggeredAbility() -> TriggeredAbility;
   auto parseTriggerCondition() -> TriggerCondition;
   auto parseEffect() -> Effect;
+  void parseEffects(vector<Effect> &effects);
   void parseBoards(unordered_map<PlayerID, Board> &boards);
   auto parseBoard() -> Board;
   auto parsePermanent() -> Permanent;
   void parseStack(vector<StackItem> &stack);
   auto parseStackItem() -> StackItem;
+  void parseResponses(unordered_map<PlayerID, vector<StackItem>> &responses);
+  void parseCombat(Combat &combat);
+
+  // Parse the deferred cards the boards and stack refer to; keep the source for the rest
+  auto materializeReferencedCards(const GameInput &input, unordered_map<string, CardDef> &cards) -> DeferredCards;
 
 public:
-  explicit Parser(string json) : tok(json) {}
+  Parser(string json, Context &context, bool deferCards = false, int firstLine = 1)
+      : tok(std::move(json), firstLine), ctx(context), deferCards(deferCards) {}
 
   // Main entry point
   auto parse() -> GameInput;
+
+  // Documents holding a single object (session commands)
+  auto parseStackItemDocument() -> StackItem { return parseStackItem(); }
+  auto parsePermanentDocument() -> Permanent { return parsePermanent(); }
+
+  // Parse one card a lazy parse skipped (CardDatabase::find calls this on first use); syntax errors
+  // come back in `errors`, one "file:line message" per line
+  static auto parseDeferredCard(const DeferredCards &deferred, const string &name, string &errors)
+      -> optional<CardDef>;
 };
 
 #endif
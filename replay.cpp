@@ -0,0 +1,162 @@
+#include "replay.h"
+
+#include <chrono>
+
+using namespace std;
+
+namespace {
+
+using Clock = chrono::steady_clock;
+
+auto elapsedMs(Clock::time_point from, Clock::time_point to) -> double {
+  return chrono::duration<double, milli>(to - from).count();
+}
+
+// ----------------------------- Comparison ----------------------------- //
+
+auto sameItem(const StackItem &a, const StackItem &b) -> bool {
+  return a.id == b.id && a.kind == b.kind && a.sourceName == b.sourceName && a.sourceId == b.sourceId &&
+         a.abilityIndex == b.abilityIndex && a.controller == b.controller && a.targetId == b.targetId &&
+         a.targetPlayer == b.targetPlayer && a.targetStackId == b.targetStackId;
+}
+
+auto sameEvent(const GameEvent &a, const GameEvent &b) -> bool {
+  return a.type == b.type && a.objectId == b.objectId && a.cardName == b.cardName &&
+         a.controller == b.controller && a.count == b.count;
+}
+
+auto sameTrigger(const PendingTrigger &a, const PendingTrigger &b) -> bool {
+  return a.sourceId == b.sourceId && a.sourceName == b.sourceName && a.controller == b.controller &&
+         a.abilityIndex == b.abilityIndex && a.text == b.text && a.isActivePlayer == b.isActivePlayer &&
+         a.turnOrder == b.turnOrder;
+}
+
+template <typename T, typename Eq> auto sameList(const vector<T> &a, const vector<T> &b, Eq eq) -> bool {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i = 0; i < a.size(); i++) {
+    if (!eq(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+auto describeItem(const StackItem &item) -> string {
+  return item.sourceName + " (" + item.id + ")";
+}
+
+auto stepDifference(const ResolutionStep &expected, const ResolutionStep &actual) -> string {
+  // Empty if the two steps match
+  if (expected.description != actual.description) {
+    return "expected \"" + expected.description + "\", got \"" + actual.description + "\"";
+  }
+  if (!sameList(expected.triggeredEvents, actual.triggeredEvents, sameEvent)) {
+    return "different events (" + to_string(expected.triggeredEvents.size()) + " recorded, " +
+           to_string(actual.triggeredEvents.size()) + " replayed)";
+  }
+  if (!sameList(expected.newTriggers, actual.newTriggers, sameTrigger)) {
+    return "different trigger order (" + to_string(expected.newTriggers.size()) + " recorded, " +
+           to_string(actual.newTriggers.size()) + " replayed)";
+  }
+  return "";
+}
+
+}
+
+// ----------------------------- Recording ----------------------------- //
+
+RunRecorder::RunRecorder(GameInput &input, RunOptions &options) {
+  log.input = encodeGameInput(input);
+  input = decodeGameInput(log.input);
+  log.maxSteps = options.maxSteps;
+  log.maxStackDepth = options.maxStackDepth;
+  options.onResolve = [this](const StackItem &item) { log.resolved.push_back(item); };
+}
+
+auto RunRecorder::finish(const Output &out) -> string {
+  log.output = encodeOutput(out);
+  return encodeRunLog(log);
+}
+
+// ----------------------------- Replay ----------------------------- //
+
+auto replayRunLog(string_view bytes) -> ReplayReport {
+  ReplayReport report;
+  Clock::time_point start = Clock::now();
+
+  RunLog log = decodeRunLog(bytes);
+  Output recorded = decodeOutput(log.output);
+  report.recordedSteps = static_cast<int>(log.resolved.size());
+
+  // A deadline or Ctrl-C can't be replayed, so stop where the recorded run stopped instead
+  bool stoppedByClock = (recorded.stopReason == StopReason::DEADLINE || recorded.stopReason == StopReason::CANCELLED);
+
+  RunOptions options;
+  options.maxSteps = stoppedByClock ? report.recordedSteps : log.maxSteps;
+  options.maxStackDepth = log.maxStackDepth;
+
+  // Check each item as it comes off the stack and stop at the first one that differs
+  CancellationToken diverged;
+  options.cancel = &diverged;
+  if (stoppedByClock && report.recordedSteps == 0) {
+    diverged.cancel();                      // maxSteps 0 would mean unlimited
+  }
+  options.onResolve = [&](const StackItem &item) {
+    size_t index = static_cast<size_t>(report.steps++);
+    if (report.divergedAt != 0) {
+      return;
+    }
+    if (index >= log.resolved.size()) {
+      report.divergedAt = report.steps;
+      report.detail = "resolved " + describeItem(item) + " after the recording ended";
+    } else if (!sameItem(item, log.resolved[index])) {
+      report.divergedAt = report.steps;
+      report.detail = "expected " + describeItem(log.resolved[index]) + ", resolved " + describeItem(item);
+    }
+    if (report.divergedAt != 0) {
+      diverged.cancel();
+    }
+  };
+
+  Engine engine(decodeGameInput(log.input));
+  Clock::time_point ready = Clock::now();
+  Output out = engine.run(options);
+  Clock::time_point done = Clock::now();
+
+  report.setupMs = elapsedMs(start, ready);
+  report.runMs = elapsedMs(ready, done);
+
+  if (report.divergedAt != 0) {
+    return report;
+  }
+
+  // Same items in the same order; now the events and trigger order of each step
+  size_t common = min(out.steps.size(), recorded.steps.size());
+  for (size_t i = 0; i < common; i++) {
+    string difference = stepDifference(recorded.steps[i], out.steps[i]);
+    if (!difference.empty()) {
+      report.divergedAt = static_cast<int>(i) + 1;
+      report.detail = difference;
+      return report;
+    }
+  }
+  if (out.steps.size() != recorded.steps.size()) {
+    report.divergedAt = static_cast<int>(common) + 1;
+    report.detail = "recorded " + to_string(recorded.steps.size()) + " steps, replayed " + to_string(out.steps.size());
+    return report;
+  }
+
+  if (stoppedByClock && (out.stopReason == StopReason::STEP_LIMIT || out.stopReason == StopReason::CANCELLED)) {
+    out.stopReason = recorded.stopReason;
+  }
+
+  // Final life, draws, destroyed list, loop report, stop reason: compare the encoded frames
+  report.identical = (encodeOutput(out) == log.output);
+  if (!report.identical) {
+    report.divergedAt = report.steps;
+    report.detail = "final state differs";
+  }
+  return report;
+}
@@ -0,0 +1,52 @@
+/*
+  Record/replay of engine runs (--record / --replay) so a slow production scenario can be kept as
+  a single file and re-run against every build. The log (wire.h RunLog) holds the input, the item
+  resolved at each step and the final Output; each step's events and APNAP trigger order come
+  from the Output's steps. Replaying checks every resolved item as it happens, then the whole
+  Output byte-for-byte, and times the run.
+*/
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "engine.h"
+#include "wire.h"
+
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+class RunRecorder {
+  // Captures one Engine::run into a RunLog
+
+  RunLog log;
+
+public:
+  // Logs the input and hooks options.onResolve. input is swapped for the decoded copy of what was
+  // logged, so the recorded run and every replay start from the same state (map order included)
+  RunRecorder(GameInput &input, RunOptions &options);
+
+  RunRecorder(const RunRecorder &) = delete;
+  auto operator=(const RunRecorder &) -> RunRecorder & = delete;
+
+  // The encoded log for a finished run
+  auto finish(const Output &out) -> string;
+};
+
+struct ReplayReport {
+  // Outcome of re-executing a run log
+  bool identical = false;
+  int steps = 0;                            // Steps the replay resolved
+  int recordedSteps = 0;
+  int divergedAt = 0;                       // First step (1-based) that differs; 0 if none did
+  string detail;                            // What differed
+
+  double setupMs = 0;                       // Decoding the log + building the engine
+  double runMs = 0;                         // Engine::run alone
+};
+
+// Throws runtime_error if the bytes aren't a run log
+auto replayRunLog(string_view bytes) -> ReplayReport;
+
+#endif
@@ -0,0 +1,390 @@
+#include "result_cache.h"
+#include "card_database.h"
+#include "fingerprint.h"
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <unordered_set>
+#include <utility>
+
+using namespace std;
+
+namespace {
+
+// ----------------------------- Canonical Form ----------------------------- //
+
+// Canonical ids are the index between two separators; no parsed id, name or text contains one
+constexpr char kIdMark = '\x1E';
+
+auto canonicalId(size_t index) -> ObjectID { return kIdMark + to_string(index) + kIdMark; }
+
+class CanonicalWriter {
+  // Length-prefixed dump of everything the key covers, hashed once at the end
+  string bytes;
+
+public:
+  void number(int64_t value) {
+    for (int shift = 0; shift < 64; shift += 8) {
+      bytes += static_cast<char>((static_cast<uint64_t>(value) >> shift) & 0xFF);
+    }
+  }
+
+  void text(string_view value) {
+    number(static_cast<int64_t>(value.size()));
+    bytes.append(value);
+  }
+
+  void texts(const vector<string> &values) {
+    number(static_cast<int64_t>(values.size()));
+    for (const auto &value : values) {
+      text(value);
+    }
+  }
+
+  auto key() const -> CacheKey {
+    // Two independent 64-bit hashes: FNV-1a over the bytes, splitmix64 chained over 8-byte words
+
+    CacheKey key;
+    key.low = hashString(bytes);
+    uint64_t chained = mixHash(bytes.size());
+    for (size_t i = 0; i < bytes.size(); i += 8) {
+      uint64_t word = 0;
+      for (size_t j = i; j < bytes.size() && j < i + 8; j++) {
+        word |= static_cast<uint64_t>(static_cast<unsigned char>(bytes[j])) << ((j - i) * 8);
+      }
+      chained = mixHash(chained ^ word);
+    }
+    key.high = chained;
+    return key;
+  }
+};
+
+void writeEffects(CanonicalWriter &w, const vector<Effect> &effects, const function<void(const string &)> &refer) {
+  w.number(static_cast<int64_t>(effects.size()));
+  for (const auto &effect : effects) {
+    w.number(static_cast<int64_t>(effect.type));
+    w.number(effect.value);
+    w.number(static_cast<int64_t>(effect.target));
+    w.text(effect.tokenName);
+    w.number(effect.tokenPower);
+    w.number(effect.tokenToughness);
+    w.text(effect.cardType);
+    if (!effect.tokenName.empty()) {
+      refer(effect.tokenName);
+    }
+  }
+}
+
+void writeCard(CanonicalWriter &w, const CardDef &card, const function<void(const string &)> &refer) {
+  // Every field of the definition: two pools agreeing on a name but not a card must not collide
+
+  w.texts(card.types);
+  w.texts(card.subtypes);
+  w.texts(card.keywords);
+  w.number(static_cast<int64_t>(card.keywordMask));
+  w.text(card.rulesText);
+  w.number(card.power);
+  w.number(card.toughness);
+  w.number(static_cast<int64_t>(card.spellTarget));
+  writeEffects(w, card.spellEffects, refer);
+
+  w.number(static_cast<int64_t>(card.triggeredAbilities.size()));
+  for (const auto &ability : card.triggeredAbilities) {
+    w.number(static_cast<int64_t>(ability.trigger.event));
+    w.number(static_cast<int64_t>(ability.trigger.scope));
+    writeEffects(w, ability.effects, refer);
+    w.number(ability.isMay ? 1 : 0);
+    w.text(ability.text);
+  }
+}
+
+auto renameIds(const GameInput &input, const CanonicalQuery &query) -> GameInput {
+  // Copy of the input with every id swapped for its canonical one (the card pool is shared)
+
+  auto rename = [&](ObjectID &id) {
+    if (!id.empty()) {
+      id = canonicalId(query.canonicalOf.at(id));
+    }
+  };
+
+  GameInput renamed = input;
+  for (auto &[player, board] : renamed.boards) {
+    for (auto &perm : board.permanents) {
+      rename(perm.id);
+    }
+  }
+  for (auto &item : renamed.stack) {
+    rename(item.id);
+    rename(item.sourceId);
+    rename(item.targetId);
+    rename(item.targetStackId);
+  }
+  for (auto &attack : renamed.combat.attacks) {
+    rename(attack.attacker);
+  }
+  for (auto &block : renamed.combat.blocks) {
+    rename(block.blocker);
+    rename(block.attacker);
+  }
+  return renamed;
+}
+
+void restoreIds(string &text, const vector<ObjectID> &originalIds) {
+  // Swap canonical ids back wherever they appear (ids inside step descriptions and errors too)
+
+  size_t start = text.find(kIdMark);
+  if (start == string::npos) {
+    return;
+  }
+
+  string restored;
+  restored.reserve(text.size());
+  size_t copied = 0;
+  while (start != string::npos) {
+    size_t end = text.find(kIdMark, start + 1);
+    if (end == string::npos) {
+      break;
+    }
+    size_t index = 0;
+    auto [last, status] = from_chars(text.data() + start + 1, text.data() + end, index);
+    if (status != errc() || last != text.data() + end || index >= originalIds.size()) {
+      start = end;
+      continue;
+    }
+    restored.append(text, copied, start - copied);
+    restored += originalIds[index];
+    copied = end + 1;
+    start = text.find(kIdMark, copied);
+  }
+  restored.append(text, copied, string::npos);
+  text = std::move(restored);
+}
+
+auto restoreIds(const Output &canonical, const vector<ObjectID> &originalIds) -> Output {
+  Output out = canonical;
+  for (auto &err : out.errors) {
+    restoreIds(err, originalIds);
+  }
+  for (auto &step : out.steps) {
+    restoreIds(step.description, originalIds);
+    for (auto &event : step.triggeredEvents) {
+      restoreIds(event.objectId, originalIds);
+    }
+    for (auto &trigger : step.newTriggers) {
+      restoreIds(trigger.sourceId, originalIds);
+    }
+  }
+  for (auto &id : out.destroyedPermanents) {
+    restoreIds(id, originalIds);
+  }
+  for (auto &id : out.counteredSpells) {
+    restoreIds(id, originalIds);
+  }
+  return out;
+}
+
+auto cacheable(StopReason reason) -> bool {
+  // Wall-clock and Ctrl-C stops depend on the moment, not on the query
+  return reason != StopReason::DEADLINE && reason != StopReason::CANCELLED;
+}
+
+}
+
+auto canonicalQuery(const GameInput &input, const RunOptions &options, unordered_set<string> *lookedUp)
+    -> CanonicalQuery {
+  // Walk the input in the order the engine does, numbering ids as they first appear
+
+  CanonicalQuery query;
+  auto idOf = [&](const ObjectID &id) -> int64_t {
+    if (id.empty()) {
+      return -1;
+    }
+    auto [it, added] = query.canonicalOf.emplace(id, query.originalIds.size());
+    if (added) {
+      query.originalIds.push_back(id);
+    }
+    return static_cast<int64_t>(it->second);
+  };
+
+  vector<string> cardNames;
+  unordered_set<string> referenced;
+  function<void(const string &)> refer = [&](const string &name) {
+    if (referenced.insert(name).second) {
+      cardNames.push_back(name);
+    }
+  };
+
+  CanonicalWriter w;
+  w.number(options.maxSteps);
+  w.number(static_cast<int64_t>(options.maxStackDepth));
+  w.text(input.activePlayer);
+  w.text(input.priorityPlayer);
+
+  // Boards in iteration order: effects that hit "each opponent" report players in that order
+  w.number(static_cast<int64_t>(input.boards.size()));
+  for (const auto &[player, board] : input.boards) {
+    w.text(player);
+    w.text(board.player);
+    w.number(board.life);
+    w.number(static_cast<int64_t>(board.permanents.size()));
+    for (const auto &perm : board.permanents) {
+      w.number(idOf(perm.id));
+      w.text(perm.cardName);
+      refer(perm.cardName);
+      w.text(perm.controller);
+      w.number(perm.tapped ? 1 : 0);
+      w.number(perm.damage);
+      w.number(perm.powerModifier);
+      w.number(perm.toughnessModifier);
+      w.number(perm.counters);
+      w.number(perm.isToken ? 1 : 0);
+      w.number(perm.count);
+    }
+  }
+
+  w.number(static_cast<int64_t>(input.stack.size()));
+  for (const auto &item : input.stack) {
+    w.number(idOf(item.id));
+    w.text(item.kind);
+    w.text(item.sourceName);
+    refer(item.sourceName);
+    w.number(idOf(item.sourceId));
+    w.number(item.abilityIndex);
+    w.text(item.controller);
+    w.number(idOf(item.targetId));
+    w.text(item.targetPlayer);
+    w.number(idOf(item.targetStackId));
+  }
+
+  w.number(static_cast<int64_t>(input.combat.attacks.size()));
+  for (const auto &attack : input.combat.attacks) {
+    w.number(idOf(attack.attacker));
+    w.text(attack.defender);
+  }
+  w.number(static_cast<int64_t>(input.combat.blocks.size()));
+  for (const auto &block : input.combat.blocks) {
+    w.number(idOf(block.blocker));
+    w.number(idOf(block.attacker));
+  }
+
+  // Minted token ids skip the caller's permanent ids, so the ones that look minted are part of the
+  // query (sorted: only the set matters) and are reserved again in the renamed run
+  for (const auto &[player, board] : input.boards) {
+    for (const auto &perm : board.permanents) {
+      if (perm.id.compare(0, kTokenIdPrefix.size(), kTokenIdPrefix) == 0) {
+        query.reservedIds.push_back(perm.id);
+      }
+    }
+  }
+  sort(query.reservedIds.begin(), query.reservedIds.end());
+  w.number(static_cast<int64_t>(query.reservedIds.size()));
+  for (const auto &id : query.reservedIds) {
+    w.text(id);
+  }
+
+  // Only the cards the game can reach, in order of first reference (the list grows with token names)
+  for (size_t i = 0; i < cardNames.size(); i++) {
+    const string name = cardNames[i];
+    w.text(name);
+    const CardDef *card = input.cards ? input.cards->find(name, lookedUp) : nullptr;
+    if (card == nullptr) {
+      w.number(-1);
+      continue;
+    }
+    writeCard(w, *card, refer);
+  }
+
+  query.key = w.key();
+  return query;
+}
+
+// ----------------------------- LRU ----------------------------- //
+
+auto OutputCache::find(const CacheKey &key) -> shared_ptr<const Output> {
+  lock_guard<mutex> guard(lock);
+  auto it = byKey.find(key);
+  if (it == byKey.end()) {
+    missCount++;
+    return nullptr;
+  }
+  hitCount++;
+  entries.splice(entries.begin(), entries, it->second);
+  return it->second->output;
+}
+
+void OutputCache::insert(const CacheKey &key, shared_ptr<const Output> output) {
+  lock_guard<mutex> guard(lock);
+  if (capacity == 0) {
+    return;
+  }
+
+  auto it = byKey.find(key);
+  if (it != byKey.end()) {
+    it->second->output = std::move(output);
+    entries.splice(entries.begin(), entries, it->second);
+    return;
+  }
+
+  if (entries.size() == capacity) {
+    byKey.erase(entries.back().key);
+    entries.pop_back();
+  }
+  entries.push_front({key, std::move(output)});
+  byKey.emplace(key, entries.begin());
+}
+
+auto OutputCache::size() const -> size_t {
+  lock_guard<mutex> guard(lock);
+  return entries.size();
+}
+
+auto OutputCache::hits() const -> size_t {
+  lock_guard<mutex> guard(lock);
+  return hitCount;
+}
+
+auto OutputCache::misses() const -> size_t {
+  lock_guard<mutex> guard(lock);
+  return missCount;
+}
+
+// ----------------------------- Cached Runs ----------------------------- //
+
+auto resolveCached(const GameInput &input, const Context &context, const RunOptions &options,
+                   OutputCache &cache) -> CachedRun {
+  // The callbacks watch (or steer) a live run, so those queries always run the engine
+
+  if (options.onResolve || options.onPriority) {
+    Engine engine(input, context);
+    Output output = engine.run(options);
+    return {std::move(output), false, engine.takeDeferredLookups()};
+  }
+
+  // Steps are kept in the cached Output and handed to the sink afterwards
+  RunOptions run = options;
+  run.steps = nullptr;
+
+  unordered_set<string> deferredCards;
+  CanonicalQuery query = canonicalQuery(input, run, &deferredCards);
+  shared_ptr<const Output> canonical = cache.find(query.key);
+  bool hit = (canonical != nullptr);
+  if (!hit) {
+    Engine engine(renameIds(input, query), context);
+    engine.reserveIds(query.reservedIds);
+    auto fresh = make_shared<const Output>(engine.run(run));
+    if (cacheable(fresh->stopReason)) {
+      cache.insert(query.key, fresh);
+    }
+    canonical = std::move(fresh);
+  }
+
+  CachedRun result{restoreIds(*canonical, query.originalIds), hit, std::move(deferredCards)};
+  if (options.steps != nullptr) {
+    for (const auto &step : result.output.steps) {
+      options.steps->step(step);
+    }
+    result.output.steps.clear();
+  }
+  return result;
+}
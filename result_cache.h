@@ -0,0 +1,94 @@
+/*
+  Memoised resolution for the batch runner and the C API. A query is keyed by a canonical
+  fingerprint of what Engine::run reads: the boards (player order as the engine iterates them,
+  permanents in board order), the stack, combat, the budgets and the definitions of the cards those
+  refer to (tokens they create included). Object ids are renamed to their position of first
+  appearance, so a scenario that only differs in id naming, JSON key order, whitespace or unused
+  cards in the pool maps to the same key.
+
+  A miss runs the engine on the renamed input and caches that Output; every answer (hit or miss)
+  then has the caller's own ids put back. Runs cut short by a deadline or cancellation aren't cached.
+*/
+
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include "context.h"
+#include "engine.h"
+#include "types.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+using namespace std;
+
+struct CacheKey {
+  // 128-bit canonical fingerprint of a query
+  uint64_t high = 0;
+  uint64_t low = 0;
+
+  auto operator==(const CacheKey &other) const -> bool { return high == other.high && low == other.low; }
+};
+
+struct CacheKeyHash {
+  auto operator()(const CacheKey &key) const -> size_t { return static_cast<size_t>(key.low); }
+};
+
+struct CanonicalQuery {
+  // A GameInput's cache key plus the renaming that produced it
+  CacheKey key;
+  unordered_map<ObjectID, size_t> canonicalOf;  // Caller's id -> canonical index
+  vector<ObjectID> originalIds;                  // Canonical index -> caller's id
+  vector<ObjectID> reservedIds;                  // Caller's permanent ids token minting must skip (token_N)
+};
+
+// Deferred pool cards the query reaches are parsed for the key and added to *lookedUp
+auto canonicalQuery(const GameInput &input, const RunOptions &options, unordered_set<string> *lookedUp = nullptr)
+    -> CanonicalQuery;
+
+class OutputCache {
+  // Bounded LRU of canonical Outputs; every member is safe to call from any thread
+
+  struct Entry {
+    CacheKey key;
+    shared_ptr<const Output> output;
+  };
+
+  mutable mutex lock;
+  size_t capacity;
+  list<Entry> entries;                      // Most recently used first
+  unordered_map<CacheKey, list<Entry>::iterator, CacheKeyHash> byKey;
+  size_t hitCount = 0;
+  size_t missCount = 0;
+
+public:
+  explicit OutputCache(size_t capacity) : capacity(capacity) {}
+
+  // Cached Output for key (and mark it most recently used), or nullptr
+  auto find(const CacheKey &key) -> shared_ptr<const Output>;
+
+  // Add or refresh an entry, evicting the least recently used one when full
+  void insert(const CacheKey &key, shared_ptr<const Output> output);
+
+  auto size() const -> size_t;
+  auto hits() const -> size_t;
+  auto misses() const -> size_t;
+};
+
+struct CachedRun {
+  Output output;
+  bool hit = false;                         // Answered without running the engine
+  unordered_set<string> deferredCards;      // Deferred pool cards the query reached (hit or miss)
+};
+
+// Engine::run through the cache. Steps reach options.steps after the run rather than during it;
+// runs with onResolve or onPriority set always run the engine.
+auto resolveCached(const GameInput &input, const Context &context, const RunOptions &options,
+                   OutputCache &cache) -> CachedRun;
+
+#endif
@@ -0,0 +1,293 @@
+#include "rollout.h"
+#include "card_database.h"
+#include "fingerprint.h"
+#include "json_writer.h"
+#include "mem_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+constexpr int kChunk = 64;                  // Rollouts a thread claims at a time
+
+class Rng {
+  // splitmix64: one word of state, so seeding a rollout costs nothing
+
+  uint64_t state;
+
+public:
+  explicit Rng(uint64_t seed) : state(seed) {}
+
+  auto next() -> uint64_t {
+    state += 0x9E3779B97F4A7C15ULL;
+    uint64_t z = state;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform in [0, bound)
+  auto below(size_t bound) -> size_t { return static_cast<size_t>(next() % bound); }
+};
+
+struct Response {
+  StackItem item;
+  bool targetsTop = false;                  // A counterspell with no explicit target: aim at the topmost spell
+};
+
+struct ResponsePools {
+  // Per player, in the order players get to respond (active player first)
+  vector<PlayerID> players;
+  vector<vector<Response>> pools;
+};
+
+auto buildPools(const GameInput &input) -> ResponsePools {
+  ResponsePools pools;
+
+  for (const auto &[player, items] : input.responses) {
+    if (player != input.activePlayer) {
+      pools.players.push_back(player);
+    }
+  }
+  sort(pools.players.begin(), pools.players.end());
+  if (input.responses.count(input.activePlayer) != 0) {
+    pools.players.insert(pools.players.begin(), input.activePlayer);
+  }
+
+  for (const auto &player : pools.players) {
+    vector<Response> &pool = pools.pools.emplace_back();
+    for (const auto &item : input.responses.at(player)) {
+      Response response{item, false};
+      const CardDef *card = input.cards ? input.cards->find(item.sourceName) : nullptr;
+      if (card != nullptr && item.targetStackId.empty()) {
+        response.targetsTop = any_of(card->spellEffects.begin(), card->spellEffects.end(),
+                                     [](const Effect &eff) { return eff.type == EffectType::COUNTERSPELL; });
+      }
+      pool.push_back(std::move(response));
+    }
+  }
+  return pools;
+}
+
+void offerResponses(Engine &engine, vector<vector<const Response *>> &unused, Rng &rng) {
+  // Go round the players until everyone passes in a row; each response can be cast once.
+  // Each player picks uniformly between passing and every response they still hold.
+
+  bool anyCast = true;
+  while (anyCast) {
+    anyCast = false;
+    for (auto &hand : unused) {
+      if (hand.empty()) {
+        continue;
+      }
+      size_t pick = rng.below(hand.size() + 1);
+      if (pick == hand.size()) {
+        continue;                           // Pass
+      }
+
+      // A counterspell goes at the topmost spell; with only abilities on the stack it has no target
+      StackItem item = hand[pick]->item;
+      if (hand[pick]->targetsTop) {
+        const StackItem *spell = engine.topSpell();
+        if (spell == nullptr) {
+          continue;                         // Pass
+        }
+        item.targetStackId = spell->id;
+      }
+      hand[pick] = hand.back();
+      hand.pop_back();
+
+      engine.push(std::move(item));
+      anyCast = true;
+    }
+  }
+}
+
+void countIds(vector<ObjectID> ids, unordered_map<ObjectID, int> &totals) {
+  // Count each id once per rollout
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
+  for (const auto &id : ids) {
+    totals[id]++;
+  }
+}
+
+void record(const Output &out, RolloutSummary &summary) {
+  summary.rollouts++;
+  for (const auto &[player, life] : out.finalLife) {
+    summary.finalLife[player][life]++;
+  }
+  summary.destroyedCount[static_cast<int>(out.destroyedPermanents.size())]++;
+  summary.counteredCount[static_cast<int>(out.counteredSpells.size())]++;
+  countIds(out.destroyedPermanents, summary.destroyed);
+  countIds(out.counteredSpells, summary.countered);
+  summary.stopReasons[out.stopReason]++;
+}
+
+void merge(const RolloutSummary &part, RolloutSummary &total) {
+  total.rollouts += part.rollouts;
+  for (const auto &[player, lives] : part.finalLife) {
+    for (const auto &[life, count] : lives) {
+      total.finalLife[player][life] += count;
+    }
+  }
+  for (const auto &[value, count] : part.destroyedCount) {
+    total.destroyedCount[value] += count;
+  }
+  for (const auto &[value, count] : part.counteredCount) {
+    total.counteredCount[value] += count;
+  }
+  for (const auto &[id, count] : part.destroyed) {
+    total.destroyed[id] += count;
+  }
+  for (const auto &[id, count] : part.countered) {
+    total.countered[id] += count;
+  }
+  for (const auto &[reason, count] : part.stopReasons) {
+    total.stopReasons[reason] += count;
+  }
+}
+
+void writeHistogram(JsonWriter &json, const map<int, int> &histogram) {
+  // {"value": rollouts, ...}
+  json.beginObject();
+  for (const auto &[value, count] : histogram) {
+    json.key(to_string(value));
+    json.value(count);
+  }
+  json.endObject();
+}
+
+void writeCounts(JsonWriter &json, const unordered_map<ObjectID, int> &counts) {
+  // Sorted by id so the document is stable
+  vector<pair<ObjectID, int>> sorted(counts.begin(), counts.end());
+  sort(sorted.begin(), sorted.end());
+  json.beginObject();
+  for (const auto &[id, count] : sorted) {
+    json.key(id);
+    json.value(count);
+  }
+  json.endObject();
+}
+
+}
+
+auto runRollouts(const GameInput &input, const RolloutOptions &options) -> RolloutSummary {
+  auto start = chrono::steady_clock::now();
+
+  // What every rollout starts from: the boards and stack, minus the pools (those live in hands)
+  GameInput base;
+  base.cards = input.cards;
+  base.activePlayer = input.activePlayer;
+  base.priorityPlayer = input.priorityPlayer;
+  base.currentPhase = input.currentPhase;
+  base.boards = input.boards;
+  base.stack = input.stack;
+  const ResponsePools pools = buildPools(input);
+
+  int threadCount = options.threads > 0 ? options.threads : static_cast<int>(thread::hardware_concurrency());
+  threadCount = max(1, min(threadCount, (options.rollouts + kChunk - 1) / kChunk));
+
+  atomic<int> nextRollout{0};
+  vector<RolloutSummary> parts(static_cast<size_t>(threadCount));
+
+  auto worker = [&](RolloutSummary &part) {
+    MemPhaseScope phase(MemPhase::RESOLVE);
+    vector<vector<const Response *>> unused(pools.pools.size());
+
+    while (true) {
+      int first = nextRollout.fetch_add(kChunk, memory_order_relaxed);
+      if (first >= options.rollouts) {
+        return;
+      }
+      int last = min(first + kChunk, options.rollouts);
+
+      for (int index = first; index < last; index++) {
+        // Same (seed, index) -> same rollout, whichever thread runs it
+        Rng rng(mixHash(options.seed ^ mixHash(static_cast<uint64_t>(index))));
+        for (size_t p = 0; p < unused.size(); p++) {
+          unused[p].clear();
+          for (const auto &response : pools.pools[p]) {
+            unused[p].push_back(&response);
+          }
+        }
+
+        RunOptions run;
+        run.maxSteps = options.maxSteps;
+        run.maxStackDepth = options.maxStackDepth;
+        run.onPriority = [&](Engine &engine) { offerResponses(engine, unused, rng); };
+
+        Engine engine(base);
+        record(engine.run(run), part);
+      }
+    }
+  };
+
+  vector<thread> threads;
+  for (int t = 1; t < threadCount; t++) {
+    threads.emplace_back(worker, ref(parts[static_cast<size_t>(t)]));
+  }
+  worker(parts[0]);
+  for (auto &th : threads) {
+    th.join();
+  }
+
+  RolloutSummary summary;
+  for (const auto &part : parts) {
+    merge(part, summary);
+  }
+  summary.threads = threadCount;
+  summary.elapsedMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+  return summary;
+}
+
+auto writeRolloutJson(const RolloutSummary &summary) -> string {
+  JsonWriter json;
+
+  json.beginObject();
+  json.key("rollouts");
+  json.value(summary.rollouts);
+  json.key("threads");
+  json.value(summary.threads);
+  json.key("elapsedMs");
+  json.value(static_cast<int>(summary.elapsedMs));
+
+  // Life histograms per player, players in id order
+  vector<PlayerID> players;
+  for (const auto &[player, lives] : summary.finalLife) {
+    players.push_back(player);
+  }
+  sort(players.begin(), players.end());
+  json.key("finalLife");
+  json.beginObject();
+  for (const auto &player : players) {
+    json.key(player);
+    writeHistogram(json, summary.finalLife.at(player));
+  }
+  json.endObject();
+
+  json.key("destroyedCount");
+  writeHistogram(json, summary.destroyedCount);
+  json.key("counteredCount");
+  writeHistogram(json, summary.counteredCount);
+  json.key("destroyed");
+  writeCounts(json, summary.destroyed);
+  json.key("countered");
+  writeCounts(json, summary.countered);
+
+  json.key("stopReasons");
+  json.beginObject();
+  for (const auto &[reason, count] : summary.stopReasons) {
+    json.key(stopReasonName(reason));
+    json.value(count);
+  }
+  json.endObject();
+
+  json.endObject();
+  return json.take();
+}
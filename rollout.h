@@ -0,0 +1,52 @@
+/*
+  Monte Carlo rollouts (--rollouts N): instead of resolving the one fixed stack, let each player
+  respond from their "responses" pool at random every time priority passes, and count how the
+  exchange tends to end (final life, permanents destroyed, spells countered).
+
+  Every rollout gets its own Engine (boards copied, card pool shared) and its own RNG seeded
+  from (seed, rollout index). Rollouts never share mutable state, so they are split across
+  threads freely, and the totals come out the same whatever the thread count.
+*/
+
+#ifndef ROLLOUT_H
+#define ROLLOUT_H
+
+#include "engine.h"
+#include "types.h"
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+struct RolloutOptions {
+  int rollouts = 1000;
+  uint64_t seed = 1;
+  int threads = 0;                          // 0: one per hardware thread
+  int maxSteps = 0;                         // Per-rollout budgets (0 means unlimited)
+  size_t maxStackDepth = 0;
+};
+
+struct RolloutSummary {
+  // Outcome counts over all rollouts (values are numbers of rollouts)
+  int rollouts = 0;
+  int threads = 0;
+  double elapsedMs = 0;
+
+  unordered_map<PlayerID, map<int, int>> finalLife;   // Player -> life total -> rollouts
+  map<int, int> destroyedCount;             // Permanents destroyed in a rollout -> rollouts
+  map<int, int> counteredCount;             // Spells countered in a rollout -> rollouts
+  unordered_map<ObjectID, int> destroyed;   // Permanent -> rollouts it was destroyed in
+  unordered_map<ObjectID, int> countered;   // Stack item -> rollouts it was countered in
+  map<StopReason, int> stopReasons;
+};
+
+// Runs options.rollouts resolutions of input (input.responses is the pool to draw from)
+auto runRollouts(const GameInput &input, const RolloutOptions &options) -> RolloutSummary;
+
+// One JSON object (--rollouts with --json)
+auto writeRolloutJson(const RolloutSummary &summary) -> string;
+
+#endif
@@ -0,0 +1,502 @@
+#include "session.h"
+#include "card_database.h"
+#include "engine.h"
+#include "json_writer.h"
+#include "parser.h"
+#include "step_sink.h"
+
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+struct SessionCommand {
+  string cmd;
+  string path;
+  string id;
+  string player;
+  int life = 0;
+  bool haveLife = false;
+  int count = 1;
+
+  // Answer to a pending decision (checked against the decision's kind in Session::answer)
+  optional<Token> accept;
+  optional<Token> choice;
+  SourceSpan order;
+
+  // Nested objects are handed to the regular parser as-is
+  SourceSpan input;
+  SourceSpan item;
+  SourceSpan permanent;
+};
+
+auto hasSpan(const SourceSpan &span) -> bool { return span.end > span.begin; }
+
+auto parseCommand(const string &line, SessionCommand &command) -> bool {
+  // Flat key/value scan; object values are only skipped over and remembered
+
+  Tokenizer tok(line);
+  if (tok.getNext().type != LBRACE) {
+    return false;
+  }
+
+  while (tok.peekNext().type != RBRACE) {
+    Token key = tok.getNext();
+    if (key.type == END_OF_FILE || tok.getNext().type != COLON) {
+      return false;
+    }
+
+    if (key.str == "input") {
+      command.input = tok.skipValue();
+    } else if (key.str == "item") {
+      command.item = tok.skipValue();
+    } else if (key.str == "permanent") {
+      command.permanent = tok.skipValue();
+    } else if (key.str == "order") {
+      command.order = tok.skipValue();
+    } else {
+      Token value = tok.getNext();
+      if (value.type == ERROR_TOKEN) {
+        return false;
+      }
+      if (key.str == "cmd") {
+        command.cmd = value.str;
+      } else if (key.str == "path") {
+        command.path = value.str;
+      } else if (key.str == "id") {
+        command.id = value.str;
+      } else if (key.str == "player") {
+        command.player = value.str;
+      } else if (key.str == "life") {
+        command.life = value.num;
+        command.haveLife = true;
+      } else if (key.str == "count") {
+        command.count = value.num;
+      } else if (key.str == "accept") {
+        command.accept = value;
+      } else if (key.str == "choice") {
+        command.choice = value;
+      }
+    }
+
+    if (tok.peekNext().type == COMMA) {
+      tok.getNext();
+    }
+  }
+  return true;
+}
+
+auto slice(const string &line, const SourceSpan &span) -> string {
+  return line.substr(span.begin, span.end - span.begin);
+}
+
+auto parseOrder(const string &text, vector<size_t> &order) -> bool {
+  // [2, 0, 1]
+
+  Tokenizer tok(text);
+  if (tok.getNext().type != LBRACKET) {
+    return false;
+  }
+  while (tok.peekNext().type != RBRACKET) {
+    Token index = tok.getNext();
+    if (index.type != NUMBER || index.num < 0) {
+      return false;
+    }
+    order.push_back(static_cast<size_t>(index.num));
+    if (tok.peekNext().type == COMMA) {
+      tok.getNext();
+    }
+  }
+  return true;
+}
+
+void writeDelta(JsonWriter &json, const StateDelta &delta) {
+  json.key("delta");
+  json.beginObject();
+  if (!delta.changed.empty()) {
+    json.key("changed");
+    json.beginArray();
+    for (const auto &perm : delta.changed) {
+      writePermanentJson(json, perm);
+    }
+    json.endArray();
+  }
+  if (!delta.removed.empty()) {
+    json.key("removed");
+    json.beginArray();
+    for (const auto &objectId : delta.removed) {
+      json.value(objectId);
+    }
+    json.endArray();
+  }
+  if (!delta.life.empty()) {
+    json.key("life");
+    json.beginObject();
+    for (const auto &[player, life] : delta.life) {
+      json.key(player);
+      json.value(life);
+    }
+    json.endObject();
+  }
+  if (!delta.cardsDrawn.empty()) {
+    json.key("cardsDrawn");
+    json.beginObject();
+    for (const auto &[player, drawn] : delta.cardsDrawn) {
+      json.key(player);
+      json.value(drawn);
+    }
+    json.endObject();
+  }
+  if (!delta.pushed.empty()) {
+    json.key("pushed");
+    json.beginArray();
+    for (const auto &item : delta.pushed) {
+      writeStackItemJson(json, item);
+    }
+    json.endArray();
+  }
+  if (!delta.popped.empty()) {
+    json.key("popped");
+    json.beginArray();
+    for (const auto &itemId : delta.popped) {
+      json.value(itemId);
+    }
+    json.endArray();
+  }
+  json.endObject();
+}
+
+void writeState(JsonWriter &json, const Engine &engine) {
+  json.key("state");
+  json.beginObject();
+  json.key("activePlayer");
+  json.value(engine.activePlayer());
+  json.key("priorityPlayer");
+  json.value(engine.priorityPlayer());
+
+  json.key("life");
+  json.beginObject();
+  for (const auto &[player, board] : engine.boards()) {
+    json.key(player);
+    json.value(board.life);
+  }
+  json.endObject();
+
+  json.key("permanents");
+  json.beginArray();
+  for (const auto &[player, board] : engine.boards()) {
+    for (const auto &perm : board.permanents) {
+      writePermanentJson(json, perm);
+    }
+  }
+  json.endArray();
+
+  json.key("stack");
+  json.beginArray();
+  for (const auto &item : engine.stackItems()) {
+    writeStackItemJson(json, item);
+  }
+  json.endArray();
+  json.endObject();
+}
+
+class Session {
+  Context &context;
+  bool lazyCards;
+  unique_ptr<Engine> engine;
+  shared_ptr<const CardDatabase> cardPool;  // Kept across loads
+  CollectingStepSink runSteps;              // Steps finished since the last run / answer response
+
+  auto fail(const string &message) -> string {
+    JsonWriter json(128);
+    json.beginObject();
+    json.key("ok");
+    json.value(false);
+    json.key("error");
+    json.value(message);
+    json.endObject();
+    return json.take();
+  }
+
+  auto load(const string &line, const SessionCommand &command) -> string {
+    string source;
+    if (hasSpan(command.input)) {
+      source = slice(line, command.input);
+    } else if (!command.path.empty()) {
+      ifstream file(command.path, ios::binary);
+      if (!file) {
+        return fail("could not read " + command.path);
+      }
+      stringstream buf;
+      buf << file.rdbuf();
+      source = buf.str();
+    } else {
+      return fail("load needs \"path\" or \"input\"");
+    }
+
+    int errorsBefore = context.syntaxErrors;
+    Parser parser(std::move(source), context, lazyCards);
+    GameInput input = parser.parse();
+    if (context.syntaxErrors != errorsBefore) {
+      return fail("syntax error in game input (details on stderr)");
+    }
+
+    // A scenario without cards reuses the pool we already have
+    if (cardPool && input.cards->parsedCount() == 0 && input.cards->deferredCount() == 0) {
+      input.cards = cardPool;
+    }
+    cardPool = input.cards;
+
+    engine = make_unique<Engine>(std::move(input), context);
+    engine->enableDeltas();
+
+    JsonWriter json(128);
+    json.beginObject();
+    json.key("ok");
+    json.value(true);
+    json.key("cards");
+    json.value(static_cast<int>(cardPool->parsedCount()));
+    json.key("deferredCards");
+    json.value(static_cast<int>(cardPool->deferredCount()));
+    json.key("stackSize");
+    json.value(static_cast<int>(engine->stackItems().size()));
+    json.endObject();
+    return json.take();
+  }
+
+  auto resolve(const SessionCommand &command) -> string {
+    JsonWriter json;
+    json.beginObject();
+    json.key("ok");
+    json.value(true);
+
+    bool loopDetected = false;
+    json.key("steps");
+    json.beginArray();
+    for (int i = 0; i < max(command.count, 1) && !loopDetected; i++) {
+      auto step = engine->resolveOne(loopDetected);
+      if (!step.has_value()) {
+        break;
+      }
+      writeStepJson(json, *step);
+    }
+    json.endArray();
+
+    json.key("loop");
+    json.value(loopDetected);
+    writeDelta(json, engine->takeDelta());
+    json.endObject();
+    return json.take();
+  }
+
+  auto stopped(RunState state) -> string {
+    // Response for run / answer: the steps finished since, then the next decision or the end
+
+    JsonWriter json;
+    json.beginObject();
+    json.key("ok");
+    json.value(true);
+    json.key("steps");
+    json.beginArray();
+    for (const auto &step : runSteps.steps) {
+      writeStepJson(json, step);
+    }
+    json.endArray();
+    runSteps.steps.clear();
+
+    if (state == RunState::DECISION) {
+      json.key("decision");
+      writeDecisionJson(json, *engine->pendingDecision());
+    } else {
+      json.key("done");
+      json.value(true);
+      json.key("stopReason");
+      json.value(stopReasonName(engine->result().stopReason));
+    }
+    writeDelta(json, engine->takeDelta());
+    json.endObject();
+    return json.take();
+  }
+
+  auto answer(const string &line, const SessionCommand &command) -> string {
+    // Each decision takes exactly its own field: accept (true / false), order ([...]) or choice
+    // (index, or null for no target)
+
+    const DecisionRequest *pending = engine->pendingDecision();
+    if (pending == nullptr) {
+      return fail("no decision is pending");
+    }
+
+    DecisionAnswer answer;
+    switch (pending->kind) {
+    case DecisionKind::USE_MAY_TRIGGER:
+      if (!command.accept || (command.accept->type != TRUE && command.accept->type != FALSE) ||
+          command.choice || hasSpan(command.order)) {
+        return fail("USE_MAY_TRIGGER is answered with \"accept\": true or false");
+      }
+      answer.accept = (command.accept->type == TRUE);
+      break;
+
+    case DecisionKind::ORDER_TRIGGERS:
+      if (!hasSpan(command.order) || command.accept || command.choice ||
+          !parseOrder(slice(line, command.order), answer.order)) {
+        return fail("ORDER_TRIGGERS is answered with \"order\": an array of trigger indices");
+      }
+      break;
+
+    case DecisionKind::CHOOSE_TARGET:
+      if (!command.choice || command.accept || hasSpan(command.order)) {
+        return fail("CHOOSE_TARGET is answered with \"choice\": an option index or null");
+      }
+      if (command.choice->type == NUMBER && command.choice->num >= 0) {
+        answer.choice = static_cast<size_t>(command.choice->num);
+      } else if (command.choice->type != NULL_TOKEN) {
+        return fail("CHOOSE_TARGET is answered with \"choice\": an option index or null");
+      }
+      break;
+    }
+
+    try {
+      return stopped(engine->answer(answer));
+    } catch (const runtime_error &e) {
+      return fail(e.what());
+    }
+  }
+
+
+  auto edited(bool applied, const string &message) -> string {
+    // Response for push / addPermanent / removePermanent / setLife
+
+    if (!applied) {
+      return fail(message);
+    }
+    JsonWriter json(256);
+    json.beginObject();
+    json.key("ok");
+    json.value(true);
+    writeDelta(json, engine->takeDelta());
+    json.endObject();
+    return json.take();
+  }
+
+  template <typename T> auto parseObject(const string &line, const SourceSpan &span, T (Parser::*parse)(),
+                                         T &out) -> bool {
+    int errorsBefore = context.syntaxErrors;
+    Parser parser(slice(line, span), context);
+    out = (parser.*parse)();
+    return context.syntaxErrors == errorsBefore;
+  }
+
+public:
+  Session(Context &context, bool lazyCards) : context(context), lazyCards(lazyCards) {}
+
+  void reportDeferredErrors() {
+    // Syntax errors in cards a lazy load skipped turn up once a command parses them; each command
+    // reports the deferred cards its engine looked up
+
+    if (!cardPool || !engine) {
+      return;
+    }
+    for (const auto &error : cardPool->deferredErrors(engine->takeDeferredLookups())) {
+      *context.diagnostics << error << '\n';
+      context.syntaxErrors++;
+    }
+  }
+
+  // Handle one line; sets quit on "quit"
+  auto handle(const string &line, bool &quit) -> string {
+    SessionCommand command;
+    if (!parseCommand(line, command) || command.cmd.empty()) {
+      return fail("expected a command object like {\"cmd\":\"resolve\"}");
+    }
+
+    if (command.cmd == "quit") {
+      quit = true;
+      return "{\"ok\":true}";
+    }
+    if (command.cmd == "load") {
+      return load(line, command);
+    }
+    if (!engine) {
+      return fail("no game loaded");
+    }
+
+    // A run waiting on a decision only takes its answer (or a look at the state)
+    if (command.cmd == "answer") {
+      return answer(line, command);
+    }
+    if (engine->pendingDecision() != nullptr && command.cmd != "state") {
+      return fail("a decision is pending; answer it first");
+    }
+    if (command.cmd == "run") {
+      RunOptions options;
+      options.steps = &runSteps;
+      return stopped(engine->start(options));
+    }
+
+    if (command.cmd == "resolve") {
+      return resolve(command);
+    }
+    if (command.cmd == "state") {
+      engine->takeDelta();
+      JsonWriter json;
+      json.beginObject();
+      json.key("ok");
+      json.value(true);
+      writeState(json, *engine);
+      json.endObject();
+      return json.take();
+    }
+    if (command.cmd == "push") {
+      StackItem item;
+      if (!hasSpan(command.item) || !parseObject(line, command.item, &Parser::parseStackItemDocument, item)) {
+        return fail("push needs a valid \"item\" object");
+      }
+      engine->push(std::move(item));
+      return edited(true, "");
+    }
+    if (command.cmd == "addPermanent") {
+      Permanent perm;
+      if (!hasSpan(command.permanent) ||
+          !parseObject(line, command.permanent, &Parser::parsePermanentDocument, perm)) {
+        return fail("addPermanent needs a valid \"permanent\" object");
+      }
+      string permId = perm.id;
+      return edited(engine->addPermanent(std::move(perm)), "cannot add " + permId + " (duplicate id or unknown controller)");
+    }
+    if (command.cmd == "removePermanent") {
+      return edited(engine->removePermanent(command.id), "no permanent " + command.id);
+    }
+    if (command.cmd == "setLife") {
+      if (!command.haveLife) {
+        return fail("setLife needs \"life\"");
+      }
+      return edited(engine->setLife(command.player, command.life), "unknown player " + command.player);
+    }
+    return fail("unknown command " + command.cmd);
+  }
+};
+
+}
+
+void runSession(istream &in, ostream &out, Context &context, bool lazyCards) {
+  Session session(context, lazyCards);
+  string line;
+  bool quit = false;
+
+  while (!quit && getline(in, line)) {
+    if (line.find_first_not_of(" \t\r") == string::npos) {
+      continue;
+    }
+    string response = session.handle(line, quit);
+    session.reportDeferredErrors();
+    response.push_back('\n');
+    out.write(response.data(), static_cast<streamsize>(response.size()));
+    out.flush();
+  }
+}
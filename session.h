@@ -0,0 +1,39 @@
+/*
+  Line-delimited JSON session (--session): one command object per stdin line, one response object
+  per stdout line. The engine stays alive between commands, so resolving an item costs one
+  resolveTop instead of a re-parse, and responses carry only what changed since the last one.
+
+    {"cmd":"load","path":"data/input.json"}       or  {"cmd":"load","input":{...game json...}}
+        (an input without "cards" keeps the card pool from the previous load)
+    {"cmd":"push","item":{...stack item...}}
+    {"cmd":"resolve"}                              or  {"cmd":"resolve","count":5}
+    {"cmd":"state"}                                full snapshot (also resets the delta baseline)
+    {"cmd":"addPermanent","permanent":{...}}
+    {"cmd":"removePermanent","id":"p2_1"}
+    {"cmd":"setLife","player":"p1","life":12}
+    {"cmd":"run"}                                  resolve everything, stopping at each player decision
+    {"cmd":"answer","accept":false}                USE_MAY_TRIGGER
+    {"cmd":"answer","order":[1,0]}                 ORDER_TRIGGERS (indices into the request's triggers)
+    {"cmd":"answer","choice":2}                    CHOOSE_TARGET (index into options; null: no target)
+    {"cmd":"quit"}
+
+  Every response has "ok"; failures add "error", everything else adds a "delta" object with only
+  the non-empty parts of changed / removed / life / cardsDrawn / pushed / popped. run and answer
+  also list the steps finished since the last response and then either the next "decision" (see
+  decision.h) or "done". An answer must carry exactly the field its decision's kind takes. While a
+  decision is pending, only answer, state, load and quit are taken.
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include "context.h"
+
+#include <iostream>
+
+using namespace std;
+
+// Serve commands until EOF or "quit" (syntax errors go to context's diagnostics)
+void runSession(istream &in, ostream &out, Context &context, bool lazyCards);
+
+#endif
@@ -0,0 +1,38 @@
+#include "step_sink.h"
+#include "json_writer.h"
+
+using namespace std;
+
+void TextStepSink::step(const ResolutionStep &step) {
+  // Same layout as the batch log: the step, then any triggers it put on the stack
+
+  out << "STEP " << ++count << ": " << step.description << '\n';
+
+  // Show any triggers that fired during this step
+  if (!step.newTriggers.empty()) {
+    out << "  >> TRIGGERS DETECTED (APNAP order):\n";
+
+    for (const auto &trigger : step.newTriggers) {
+      out << "     - " << trigger.sourceName << " [" << trigger.controller;
+      if (trigger.isActivePlayer) {
+        out << ", Active Player";
+      } else {
+        out << ", Non-Active Player";
+      }
+      out << "]\n";
+      out << "       \"" << trigger.text << "\"\n";
+    }
+  }
+  out << '\n';
+}
+
+void JsonLinesStepSink::step(const ResolutionStep &step) {
+  // One line per step; flushed so a reader on the other end of a pipe sees it immediately
+
+  JsonWriter json(256 + step.description.size());
+  writeStepJson(json, step);
+  string line = json.take();
+  line += '\n';
+  out.write(line.data(), static_cast<streamsize>(line.size()));
+  out.flush();
+}
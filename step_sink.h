@@ -0,0 +1,57 @@
+/*
+  Where resolution steps go as they complete. With RunOptions::steps set, Engine::run hands each
+  ResolutionStep to the sink the moment it's done instead of appending it to Output::steps, so a
+  long trigger cascade keeps memory flat and the first step reaches the client right away.
+
+    TextStepSink        The "STEP n: ..." log main prints
+    JsonLinesStepSink   One JSON object per step per line (--output-format jsonl), flushed per line
+    CollectingStepSink  Keeps every step in memory (what Output::steps does without a sink)
+*/
+
+#ifndef STEP_SINK_H
+#define STEP_SINK_H
+
+#include "types.h"
+
+#include <ostream>
+#include <vector>
+
+using namespace std;
+
+class StepSink {
+public:
+  virtual ~StepSink() = default;
+
+  // Called once per completed step, in resolution order
+  virtual void step(const ResolutionStep &step) = 0;
+};
+
+class TextStepSink : public StepSink {
+  ostream &out;
+  int count = 0;
+
+public:
+  explicit TextStepSink(ostream &out) : out(out) {}
+
+  void step(const ResolutionStep &step) override;
+
+  auto steps() const -> int { return count; }
+};
+
+class JsonLinesStepSink : public StepSink {
+  ostream &out;
+
+public:
+  explicit JsonLinesStepSink(ostream &out) : out(out) {}
+
+  void step(const ResolutionStep &step) override;
+};
+
+class CollectingStepSink : public StepSink {
+public:
+  vector<ResolutionStep> steps;
+
+  void step(const ResolutionStep &step) override { steps.push_back(step); }
+};
+
+#endif
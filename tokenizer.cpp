@@ -1,20 +1,13 @@
 #include "tokenizer.h"
+#include "mem_stats.h"
+#include <algorithm>
 #include <cctype>
+#include <cstring>
 #include <iostream>
-#include <regex>
 #include <unordered_map>
 
 using namespace std;
 
-static int g_lineNum = 1;
-static string g_filename;
-
-void syntaxError(string msg) { cerr << g_filename << ':' << g_lineNum << ' ' << msg << '\n'; }
-void setFilename(string s) {
-  g_filename = s;
-  g_lineNum = 1;
-}
-
 static auto stringToKeyword(const string &keywordStr, TokenType defaultType = STRING) -> TokenType {
   // Map strings to token types; static so we only build it once
 
@@ -59,6 +52,7 @@ static auto stringToKeyword(const string &keywordStr, TokenType defaultType = ST
       {"MILL", MILL},
       {"BOUNCE", BOUNCE},
       {"COUNTERSPELL", COUNTERSPELL},
+      {"DESTROY_ALL", DESTROY_ALL},
 
       {"NONE", NONE},
       {"ANY_TARGET", ANY_TARGET},
@@ -71,6 +65,12 @@ static auto stringToKeyword(const string &keywordStr, TokenType defaultType = ST
       {"SPELL", SPELL},
   };
 
+  // Keywords are true/false/null or all capitals; names, ids and rules text skip the hash
+  bool shouting = !keywordStr.empty() && keywordStr.find_first_not_of("ABCDEFGHIJKLMNOPQRSTUVWXYZ_") == string::npos;
+  if (!shouting && keywordStr != "true" && keywordStr != "false" && keywordStr != "null") {
+    return defaultType;
+  }
+
   auto iter = keywordMap.find(keywordStr);
 
   if (iter != keywordMap.end()) {
@@ -106,19 +106,32 @@ auto tokenTypeToString(TokenType tokenType) -> string {
   return "unknown token";
 }
 
-void Tokenizer::advance() {
-  // Advance one character and track line/column.
+Tokenizer::Tokenizer(string src, int firstLine) : input(std::move(src)), line(firstLine) {
+  // Index every token start up front; getNext just walks the list
 
-  if (pos < input.length()) {
-    if (input[pos] == '\n') {
-      line++;
-      g_lineNum++;
-      col = 1;
-    } else {
-      col++;
-    }
-    pos++;
+  MemPhaseScope phase(MemPhase::TOKENIZE);
+  index = buildStructuralIndex(input);
+}
+
+void Tokenizer::advanceTo(size_t target) {
+  // Move forward to target and track line/column over the skipped bytes.
+
+  target = min(target, input.length());
+  const char *begin = input.data() + pos;
+  const char *end = input.data() + target;
+  const char *lastNewline = nullptr;
+
+  for (const char *nl = begin; (nl = static_cast<const char *>(memchr(nl, '\n', end - nl))) != nullptr; nl++) {
+    line++;
+    lastNewline = nl;
+  }
+
+  if (lastNewline != nullptr) {
+    col = static_cast<int>(end - lastNewline);
+  } else {
+    col += static_cast<int>(target - pos);
   }
+  pos = target;
 }
 
 auto Tokenizer::current() const -> char {
@@ -130,109 +143,287 @@ auto Tokenizer::current() const -> char {
   return input[pos];
 }
 
-void Tokenizer::skipWhitespace() {
-  while (current() != '\0' && isspace(static_cast<unsigned char>(current())) != 0) {
-    advance();
+auto Tokenizer::seekNextStart() -> bool {
+  // Skip index entries already consumed by the previous token, then jump to the next one.
+
+  while (nextStart < index.starts.size() && index.starts[nextStart] < pos) {
+    nextStart++;
+  }
+  if (nextStart == index.starts.size()) {
+    advanceTo(input.length());
+    return false;
+  }
+  advanceTo(index.starts[nextStart++]);
+  return true;
+}
+
+static void appendUtf8(string &out, unsigned codePoint) {
+  // Encode a \uXXXX escape
+
+  if (codePoint < 0x80) {
+    out.push_back(static_cast<char>(codePoint));
+  } else if (codePoint < 0x800) {
+    out.push_back(static_cast<char>(0xC0 | (codePoint >> 6)));
+    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else if (codePoint < 0x10000) {
+    out.push_back(static_cast<char>(0xE0 | (codePoint >> 12)));
+    out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  } else {
+    out.push_back(static_cast<char>(0xF0 | (codePoint >> 18)));
+    out.push_back(static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F)));
+    out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+  }
+}
+
+static auto readHex4(const string &input, size_t at, unsigned &out) -> bool {
+  if (at + 4 > input.length()) {
+    return false;
+  }
+  out = 0;
+  for (size_t i = at; i < at + 4; i++) {
+    char hexChar = input[i];
+    unsigned digit = 0;
+    if (hexChar >= '0' && hexChar <= '9') {
+      digit = hexChar - '0';
+    } else if (hexChar >= 'a' && hexChar <= 'f') {
+      digit = hexChar - 'a' + 10;
+    } else if (hexChar >= 'A' && hexChar <= 'F') {
+      digit = hexChar - 'A' + 10;
+    } else {
+      return false;
+    }
+    out = (out << 4) | digit;
+  }
+  return true;
+}
+
+static auto endsScalar(const string &input, size_t at) -> bool {
+  // A number or keyword must be followed by whitespace, punctuation that can follow a value, or EOF
+
+  if (at >= input.length()) {
+    return true;
+  }
+  switch (input[at]) {
+  case ' ': case '\t': case '\n': case '\r': case ',': case '}': case ']': case ':': return true;
+  default: return false;
+  }
+}
+
+auto Tokenizer::readString(int startLine, int startCol) -> Token {
+  // Scan to the closing quote, copying plain runs in bulk and decoding escapes.
+
+  string value;
+  size_t scan = pos + 1;
+
+  while (scan < input.length()) {
+    size_t stop = input.find_first_of("\"\\", scan);
+    if (stop == string::npos) {
+      break;
+    }
+    value.append(input, scan, stop - scan);
+
+    if (input[stop] == '"') {
+      advanceTo(stop + 1);
+      TokenType keywordType = stringToKeyword(value, STRING);
+      return {keywordType, std::move(value), 0, startLine, startCol};
+    }
+
+    // Backslash escape
+    if (stop + 1 >= input.length()) {
+      break;
+    }
+    char esc = input[stop + 1];
+    scan = stop + 2;
+    switch (esc) {
+    case '"': value.push_back('"'); break;
+    case '\\': value.push_back('\\'); break;
+    case '/': value.push_back('/'); break;
+    case 'b': value.push_back('\b'); break;
+    case 'f': value.push_back('\f'); break;
+    case 'n': value.push_back('\n'); break;
+    case 'r': value.push_back('\r'); break;
+    case 't': value.push_back('\t'); break;
+    case 'u': {
+      unsigned codePoint = 0;
+      if (!readHex4(input, scan, codePoint)) {
+        advanceTo(scan);
+        return {ERROR_TOKEN, "Invalid \\u escape in string literal", 0, startLine, startCol};
+      }
+      scan += 4;
+
+      // Surrogate pair
+      unsigned low = 0;
+      if (codePoint >= 0xD800 && codePoint < 0xDC00 && input.compare(scan, 2, "\\u") == 0 &&
+          readHex4(input, scan + 2, low) && low >= 0xDC00 && low < 0xE000) {
+        codePoint = 0x10000 + ((codePoint - 0xD800) << 10) + (low - 0xDC00);
+        scan += 6;
+      }
+      appendUtf8(value, codePoint);
+      break;
+    }
+    default:
+      advanceTo(scan);
+      return {ERROR_TOKEN, "Invalid escape \\" + string(1, esc) + " in string literal", 0, startLine, startCol};
+    }
   }
+
+  advanceTo(input.length());
+  return {ERROR_TOKEN, "Unterminated string literal", 0, startLine, startCol};
 }
 
 auto Tokenizer::getNext() -> Token {
-  skipWhitespace();
+  if (peeked.has_value()) {
+    // Replay the token peekNext already scanned
+    Token tok = std::move(peeked->token);
+    pos = peeked->pos;
+    line = peeked->line;
+    col = peeked->col;
+    nextStart = peeked->nextStart;
+    peeked.reset();
+    return tok;
+  }
+
+  // Check for end of input
+  if (!seekNextStart()) {
+    return {END_OF_FILE, "EOF", 0, line, col};
+  }
 
   // Save position for error reporting
   int startLine = line;
   int startCol = col;
+  char currentChar = current();
 
-  // Check for end of input
-  if (current() == '\0') {
-    return {END_OF_FILE, "EOF", 0, startLine, startCol};
-  }
-
-  string remaining = input.substr(pos);
-
-  // JSON punctuation via regex (as proof of concept)
-  static const regex punctRe("^[\\{\\}\\[\\]:,]");
-  smatch pm;
-  if (regex_search(remaining, pm, punctRe)) {
-    char c = pm.str()[0];
-    pos += 1;
-    col += 1;
-    switch (c) {
-    case '{': return {LBRACE, "{", 0, startLine, startCol};
-    case '}': return {RBRACE, "}", 0, startLine, startCol};
-    case '[': return {LBRACKET, "[", 0, startLine, startCol};
-    case ']': return {RBRACKET, "]", 0, startLine, startCol};
-    case ':': return {COLON, ":", 0, startLine, startCol};
-    case ',': return {COMMA, ",", 0, startLine, startCol};
-    default: break;
-    }
+  // JSON punctuation
+  switch (currentChar) {
+  case '{': advanceTo(pos + 1); return {LBRACE, "{", 0, startLine, startCol};
+  case '}': advanceTo(pos + 1); return {RBRACE, "}", 0, startLine, startCol};
+  case '[': advanceTo(pos + 1); return {LBRACKET, "[", 0, startLine, startCol};
+  case ']': advanceTo(pos + 1); return {RBRACKET, "]", 0, startLine, startCol};
+  case ':': advanceTo(pos + 1); return {COLON, ":", 0, startLine, startCol};
+  case ',': advanceTo(pos + 1); return {COMMA, ",", 0, startLine, startCol};
+  default: break;
   }
 
-  char currentChar = current();
-
-  // String literal via regex
+  // String literal
   if (currentChar == '"') {
-    static const regex strRe("^\"([^\"]*)\"");
-    smatch m;
-    if (regex_search(remaining, m, strRe)) {
-      string value = m[1].str();
-      pos += m[0].length();
-      col += m[0].length();
-      TokenType keywordType = stringToKeyword(value, STRING);
-      return {keywordType, value, 0, startLine, startCol};
-    }
-    return {ERROR_TOKEN, "Unterminated string literal", 0, startLine, startCol};
+    return readString(startLine, startCol);
   }
 
-  // Number regex (kept small; nervous to regex everything)
+  // Number
   if (currentChar == '-' || isdigit(static_cast<unsigned char>(currentChar)) != 0) {
-    static const regex numRe("^-?\\d+");
-    smatch m;
-    string remaining = input.substr(pos);
-    if (regex_search(remaining, m, numRe)) {
-      string numStr = m.str();
-      pos += numStr.length();
-      col += numStr.length();
-      return {NUMBER, numStr, stoi(numStr), startLine, startCol};
+    size_t end = pos + (currentChar == '-' ? 1 : 0);
+    size_t digitsStart = end;
+    while (end < input.length() && isdigit(static_cast<unsigned char>(input[end])) != 0) {
+      end++;
     }
-    return {ERROR_TOKEN, "Unexpected character: " + string(1, currentChar), 0, startLine, startCol};
+    if (end == digitsStart) {
+      advanceTo(pos + 1);
+      return {ERROR_TOKEN, "Unexpected character: " + string(1, currentChar), 0, startLine, startCol};
+    }
+    if (!endsScalar(input, end)) {
+      advanceTo(end);
+      return {ERROR_TOKEN, "Unexpected character after number: " + string(1, input[end]), 0, startLine, startCol};
+    }
+    string numStr = input.substr(pos, end - pos);
+    advanceTo(end);
+    return {NUMBER, numStr, stoi(numStr), startLine, startCol};
   }
 
   // Bare keyword
   if (isalpha(static_cast<unsigned char>(currentChar)) != 0 || currentChar == '_') {
-    static const regex wordRe("^[A-Za-z_][A-Za-z0-9_]*");
-    smatch m;
-    if (regex_search(remaining, m, wordRe)) {
-      string word = m.str();
-      pos += word.length();
-      col += word.length();
-      TokenType keywordType = stringToKeyword(word, ERROR_TOKEN);
-      if (keywordType == ERROR_TOKEN) {
-        return {ERROR_TOKEN, "Unexpected keyword: " + word, 0, startLine, startCol};
-      }
-      return {keywordType, word, 0, startLine, startCol};
+    size_t end = pos + 1;
+    while (end < input.length() && (isalnum(static_cast<unsigned char>(input[end])) != 0 || input[end] == '_')) {
+      end++;
+    }
+    if (!endsScalar(input, end)) {
+      advanceTo(end);
+      return {ERROR_TOKEN, "Unexpected character after keyword: " + string(1, input[end]), 0, startLine, startCol};
+    }
+    string word = input.substr(pos, end - pos);
+    advanceTo(end);
+    TokenType keywordType = stringToKeyword(word, ERROR_TOKEN);
+    if (keywordType == ERROR_TOKEN) {
+      return {ERROR_TOKEN, "Unexpected keyword: " + word, 0, startLine, startCol};
     }
+    return {keywordType, word, 0, startLine, startCol};
   }
 
   // Unknown character
-  string err(1, current());
-  advance();
+  string err(1, currentChar);
+  advanceTo(pos + 1);
   return {ERROR_TOKEN, "Unexpected character: " + err, 0, startLine, startCol};
 }
 
-auto Tokenizer::peekNext() -> Token {
-  // Save current state
-  size_t oldPos = pos;
-  int oldLine = line;
-  int oldCol = col;
+auto Tokenizer::peekNext() -> const Token & {
+  // Scan the next token once and cache it; repeated peeks (and the following getNext) reuse it.
+
+  if (!peeked.has_value()) {
+    // Save current state
+    size_t oldPos = pos;
+    int oldLine = line;
+    int oldCol = col;
+    size_t oldNextStart = nextStart;
+
+    // Get the next token and remember where it left us
+    Token tok = getNext();
+    peeked = Lookahead{std::move(tok), pos, line, col, nextStart};
+
+    // Restore state
+    pos = oldPos;
+    line = oldLine;
+    col = oldCol;
+    nextStart = oldNextStart;
+  }
+
+  return peeked->token;
+}
+
+auto Tokenizer::peekByte() -> char {
+  // A pending peek leaves pos and nextStart before its token, so this sees the same token
 
-  // Get the next token
-  Token tok = getNext();
+  while (nextStart < index.starts.size() && index.starts[nextStart] < pos) {
+    nextStart++;
+  }
+  return nextStart < index.starts.size() ? input[index.starts[nextStart]] : '\0';
+}
+
+auto Tokenizer::skipValue() -> SourceSpan {
+  // Walk the structural index counting brackets; strings are a single index entry, so nothing
+  // inside them is looked at.
+
+  peeked.reset();                           // peekNext left us in front of the value
+  if (!seekNextStart()) {
+    return {pos, pos, line};
+  }
 
-  // Restore state
-  pos = oldPos;
-  line = oldLine;
-  col = oldCol;
+  SourceSpan span{pos, pos, line};
+  char open = current();
+  if (open != '{' && open != '[') {
+    // Scalar: let getNext consume it from the entry we just sought to
+    nextStart--;
+    getNext();
+    span.end = pos;
+    return span;
+  }
+
+  int depth = 0;
+  for (size_t i = nextStart - 1; i < index.starts.size(); i++) {
+    char c = input[index.starts[i]];
+    if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      nextStart = i + 1;
+      advanceTo(index.starts[i] + 1);
+      span.end = pos;
+      return span;
+    }
+  }
 
-  return tok;
+  // Unbalanced: swallow the rest and let the caller's expect() report it
+  nextStart = index.starts.size();
+  advanceTo(input.length());
+  span.end = pos;
+  return span;
 }
@@ -1,13 +1,14 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include "json_index.h"
+#include "types.h"
+
+#include <optional>
 #include <string>
 
 using namespace std;
 
-void syntaxError(string msg);
-void setFilename(string s);
-
 enum TokenType {
   // JSON tokens
   LBRACE,
@@ -65,6 +66,7 @@ enum TokenType {
   MILL,
   BOUNCE,
   COUNTERSPELL,
+  DESTROY_ALL,
 
   // Target-type
   NONE,
@@ -100,23 +102,47 @@ class Tokenizer {
   int line = 1;
   int col = 1;
 
-  // Move to next character, updating line/col tracking
-  void advance();
+  StructuralIndex index;                    // Token start offsets from the first pass
+  size_t nextStart = 0;                     // Next unread entry in index.starts
+
+  // Token returned by the last peekNext, plus where the tokenizer stands after it
+  struct Lookahead {
+    Token token;
+    size_t pos = 0;
+    int line = 1;
+    int col = 1;
+    size_t nextStart = 0;
+  };
+  optional<Lookahead> peeked;
+
+  // Move to an offset, updating line/col tracking for everything skipped
+  void advanceTo(size_t target);
 
   // Get current character (or '\0' if at end)
   auto current() const -> char;
 
-  // Skip whitespace characters
-  void skipWhitespace();
+  // Jump to the next indexed token start (false at end of input)
+  auto seekNextStart() -> bool;
+
+  // Read a quoted string starting at pos, decoding escapes
+  auto readString(int startLine, int startCol) -> Token;
 
 public:
-  explicit Tokenizer(string src) : input(src) { line = 1; col = 1; }
+  explicit Tokenizer(string src, int firstLine = 1);
 
   // Get and consume the next token
   auto getNext() -> Token;
 
-  // Look at the next token without consuming it
-  auto peekNext() -> Token;
+  // Look at the next token without consuming it (valid until the next getNext)
+  auto peekNext() -> const Token &;
+
+  // First byte of the next token, read off the index without scanning it ('\0' at the end)
+  auto peekByte() -> char;
+
+  // Step over the next value (object/array by bracket depth) without building tokens
+  auto skipValue() -> SourceSpan;
+
+  auto source() const -> const string & { return input; }
 
   // Get current position info (for error messages)
   auto currentLine() const -> int { return line; }
@@ -6,15 +6,14 @@
 #ifndef TYPES_H
 #define TYPES_H
 
+#include <cstdint>
+#include <memory>
 #include <string>
 #include <vector>
 #include <unordered_map>
 
 using namespace std;
 
-// Debug flag
-extern bool g_debug;
-
 using PlayerID = string;
 using ObjectID = string;
 
@@ -38,7 +37,9 @@ enum class EffectType {
   CREATE_TOKEN,
   SEARCH_LAND,
   MILL,
-  BOUNCE
+  BOUNCE,
+  DESTROY_ALL                               // Board wipe: every creature (target PERMANENT: every permanent),
+                                            // only those of Effect::cardType when it is set
 };
 
 enum class TargetType {
@@ -59,6 +60,10 @@ struct Effect {
   EffectType type = EffectType::DEAL_DAMAGE;
   int value = 0;
   TargetType target = TargetType::NONE;
+  string tokenName;                         // CREATE_TOKEN: card the tokens copy (empty = generic creature)
+  int tokenPower = 1;                       // CREATE_TOKEN: size of a generic token
+  int tokenToughness = 1;
+  string cardType;                          // DESTROY_ALL: only permanents with this type (upper case; empty = any)
 };
 
 // ----------------------------- Triggered Abilities ----------------------------- //
@@ -77,6 +82,8 @@ enum class TriggerEvent {
   BECOMES_TARGET
 };
 
+constexpr size_t kTriggerEventCount = static_cast<size_t>(TriggerEvent::BECOMES_TARGET) + 1;
+
 enum class TriggerScope {
   // If a trigger has a scope (when 'this creature' enters the battlefield)
   SELF,
@@ -113,12 +120,37 @@ struct PendingTrigger {
 
 // ----------------------------- Card/Type Templates ----------------------------- //
 
+// Keywords the engine checks, as bits so a permanent's whole set is one integer
+enum class Keyword : uint32_t {
+  INDESTRUCTIBLE = 1u << 0,
+  DEATHTOUCH = 1u << 1,
+  HEXPROOF = 1u << 2,
+  SHROUD = 1u << 3,
+  FLYING = 1u << 4,
+  REACH = 1u << 5,
+  TRAMPLE = 1u << 6,
+  LIFELINK = 1u << 7,
+  HASTE = 1u << 8,
+  VIGILANCE = 1u << 9,
+  DEFENDER = 1u << 10,
+  MENACE = 1u << 11,
+  FIRST_STRIKE = 1u << 12,
+  DOUBLE_STRIKE = 1u << 13
+};
+
+using KeywordSet = uint32_t;
+
+constexpr auto hasKeywordBit(KeywordSet set, Keyword keyword) -> bool {
+  return (set & static_cast<uint32_t>(keyword)) != 0;
+}
+
 struct CardDef {
   // Card blueprints
   string name;
   vector<string> types;
   vector<string> subtypes;
   vector<string> keywords;
+  KeywordSet keywordMask = 0;               // keywords as bits (filled in when the card is built)
   string rulesText;
 
   int power = 0;
@@ -130,6 +162,13 @@ struct CardDef {
   vector<TriggeredAbility> triggeredAbilities;
 };
 
+struct Characteristics {
+  // Effective values after the layers: printed card -> +1/+1 counters -> effect modifiers
+  int power = 0;
+  int toughness = 0;
+  KeywordSet keywords = 0;
+};
+
 struct Permanent {
   // A card on the battlefield
   ObjectID id;
@@ -141,6 +180,14 @@ struct Permanent {
   int powerModifier = 0;
   int toughnessModifier = 0;
   int counters = 0;
+
+  // Interchangeable tokens in identical state share one record; targeting one splits it off
+  bool isToken = false;
+  int count = 1;
+
+  // Cached result of Engine::characteristics; set dirty whenever counters or modifiers change
+  Characteristics effective;
+  bool characteristicsDirty = true;
 };
 
 struct StackItem {
@@ -168,23 +215,61 @@ struct Board {
   vector<Permanent> permanents;
 };
 
+struct Attack {
+  ObjectID attacker;
+  PlayerID defender;                        // Empty: the first opponent in id order
+};
+
+struct Block {
+  ObjectID blocker;
+  ObjectID attacker;                        // Blockers of one attacker take damage in listed order
+};
+
+struct Combat {
+  // Attacks and blocks to carry out once the stack is empty
+  vector<Attack> attacks;
+  vector<Block> blocks;
+};
+
 struct GameEvent {
   // Something that happened that might trigger abilities
   TriggerEvent type;
   ObjectID objectId;
   string cardName;
   PlayerID controller;
+  int count = 1;                            // How many identical tokens this happened to at once
+};
+
+struct SourceSpan {
+  // Byte range [begin, end) of a value in the source JSON
+  size_t begin = 0;
+  size_t end = 0;
+  int line = 1;                             // Line `begin` is on (for error messages)
 };
 
+struct DeferredCards {
+  // Card definitions a lazy parse skipped over; parsed from `source` the first time they're needed
+  shared_ptr<const string> source;
+  unordered_map<string, SourceSpan> spans;
+  string filename;                          // For syntax errors found when one is finally parsed
+};
+
+class CardDatabase;
+
 struct GameInput {
   // The complete input state
-  unordered_map<string, CardDef> cards;     // Card database
+  shared_ptr<const CardDatabase> cards;     // Card pool, shared read-only (see card_database.h)
   PlayerID activePlayer;                    // Whose turn it is
   PlayerID priorityPlayer;                  // Who can act right now
   string currentPhase;
 
   unordered_map<PlayerID, Board> boards;    // Each player's battlefield
   vector<StackItem> stack;                  // The stack to resolve
+
+  // Spells each player might respond with (rollout mode picks from these at random)
+  unordered_map<PlayerID, vector<StackItem>> responses;
+
+  Combat combat;                            // Declared after the stack resolves (see Engine::advance)
 };
 
 struct ResolutionStep {
@@ -194,6 +279,26 @@ struct ResolutionStep {
   vector<PendingTrigger> newTriggers;       // New triggers that fired
 };
 
+enum class StopReason {
+  // Why Engine::run returned
+  COMPLETED,                                // Stack resolved to empty
+  LOOP_DETECTED,                            // Same state kept repeating (see Output::loop)
+  STEP_LIMIT,
+  STACK_DEPTH_LIMIT,
+  DEADLINE,
+  CANCELLED
+};
+
+struct LoopReport {
+  // Set when the engine stops because the same state keeps coming back
+  bool detected = false;
+  int period = 0;                           // Steps per lap
+  int firstStep = 0;                        // Step (1-based) where the repeating state first appeared
+  unordered_map<PlayerID, int> lifeDelta;   // Life change per lap
+  unordered_map<PlayerID, int> cardsDrawnDelta;
+  int destroyedPerLap = 0;
+};
+
 struct Output {
   // Final result
   bool valid = true;
@@ -203,7 +308,13 @@ struct Output {
 
   unordered_map<PlayerID, int> finalLife;
   vector<ObjectID> destroyedPermanents;
+  vector<ObjectID> counteredSpells;         // Stack items removed by a counterspell
   unordered_map<PlayerID, int> cardsDrawn;
+
+  LoopReport loop;                          // Infinite loop the run was cut short on (if any)
+
+  StopReason stopReason = StopReason::COMPLETED;
+  int unresolvedItems = 0;                  // Stack items left when the run stopped early
 };
 
 #endif
@@ -0,0 +1,173 @@
+#include "whatif.h"
+#include "engine.h"
+#include "json_writer.h"
+#include "mem_stats.h"
+
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+
+auto describeTarget(const GameInput &input, const StackItem &spell) -> string {
+  if (!spell.targetPlayer.empty()) {
+    return spell.targetPlayer;
+  }
+  if (!spell.targetStackId.empty()) {
+    for (const auto &item : input.stack) {
+      if (item.id == spell.targetStackId) {
+        return item.sourceName + " (" + item.id + ")";
+      }
+    }
+    return spell.targetStackId;
+  }
+  for (const auto &[player, board] : input.boards) {
+    for (const auto &perm : board.permanents) {
+      if (perm.id == spell.targetId) {
+        return perm.cardName + " (" + perm.id + ")";
+      }
+    }
+  }
+  return spell.targetId;
+}
+
+void score(const GameInput &input, WhatIfOutcome &outcome) {
+  // Fill the ranking keys from the controller's point of view
+
+  const PlayerID &caster = outcome.spell.controller;
+
+  unordered_map<ObjectID, PlayerID> controllerOf;
+  for (const auto &[player, board] : input.boards) {
+    for (const auto &perm : board.permanents) {
+      controllerOf[perm.id] = perm.controller;
+    }
+  }
+  for (const auto &id : outcome.output.destroyedPermanents) {
+    auto it = controllerOf.find(id);
+    if (it != controllerOf.end()) {
+      outcome.permanentSwing += (it->second == caster) ? -1 : 1;
+    }
+  }
+
+  for (const auto &[player, board] : input.boards) {
+    auto life = outcome.output.finalLife.find(player);
+    if (life == outcome.output.finalLife.end()) {
+      continue;
+    }
+    int change = life->second - board.life;
+    outcome.lifeSwing += (player == caster) ? change : -change;
+  }
+}
+
+}
+
+auto evaluateTargets(const GameInput &input, const WhatIfOptions &options) -> vector<WhatIfOutcome> {
+  if (input.stack.empty() || input.stack.back().kind != "SPELL") {
+    throw runtime_error("what-if: the top of the stack must be a spell");
+  }
+  const StackItem &spell = input.stack.back();
+
+  // Each candidate starts from the same state; only the top spell's target differs
+  GameInput base = input;
+  base.responses.clear();
+
+  vector<StackItem> candidates = Engine(base).targetCandidates(spell);
+  if (candidates.empty()) {
+    throw runtime_error("what-if: " + spell.sourceName + " has no targets to choose from");
+  }
+
+  vector<WhatIfOutcome> outcomes(candidates.size());
+  atomic<size_t> next{0};
+
+  auto worker = [&]() {
+    MemPhaseScope phase(MemPhase::RESOLVE);
+    for (size_t i = next.fetch_add(1); i < candidates.size(); i = next.fetch_add(1)) {
+      GameInput state = base;
+      state.stack.back() = candidates[i];
+
+      RunOptions run;
+      run.maxSteps = options.maxSteps;
+      run.maxStackDepth = options.maxStackDepth;
+
+      WhatIfOutcome &outcome = outcomes[i];
+      outcome.spell = candidates[i];
+      outcome.target = describeTarget(input, candidates[i]);
+      outcome.output = Engine(std::move(state)).run(run);
+      score(input, outcome);
+    }
+  };
+
+  int threadCount = options.threads > 0 ? options.threads : static_cast<int>(thread::hardware_concurrency());
+  threadCount = max(1, min(threadCount, static_cast<int>(candidates.size())));
+
+  vector<thread> threads;
+  for (int t = 1; t < threadCount; t++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto &th : threads) {
+    th.join();
+  }
+
+  // Stable, so ties keep candidate order
+  stable_sort(outcomes.begin(), outcomes.end(), [](const WhatIfOutcome &a, const WhatIfOutcome &b) {
+    if (a.permanentSwing != b.permanentSwing) {
+      return a.permanentSwing > b.permanentSwing;
+    }
+    if (a.lifeSwing != b.lifeSwing) {
+      return a.lifeSwing > b.lifeSwing;
+    }
+    return a.output.steps.size() < b.output.steps.size();
+  });
+  return outcomes;
+}
+
+auto writeWhatIfJson(const vector<WhatIfOutcome> &outcomes) -> string {
+  JsonWriter json;
+
+  json.beginArray();
+  for (const auto &outcome : outcomes) {
+    json.beginObject();
+    json.key("target");
+    json.value(outcome.target);
+    json.key("spell");
+    writeStackItemJson(json, outcome.spell);
+    json.key("permanentSwing");
+    json.value(outcome.permanentSwing);
+    json.key("lifeSwing");
+    json.value(outcome.lifeSwing);
+    json.key("steps");
+    json.value(static_cast<int>(outcome.output.steps.size()));
+    json.key("stopReason");
+    json.value(stopReasonName(outcome.output.stopReason));
+
+    json.key("finalLife");
+    json.beginObject();
+    for (const auto &[player, life] : outcome.output.finalLife) {
+      json.key(player);
+      json.value(life);
+    }
+    json.endObject();
+
+    json.key("destroyedPermanents");
+    json.beginArray();
+    for (const auto &id : outcome.output.destroyedPermanents) {
+      json.value(id);
+    }
+    json.endArray();
+
+    json.key("counteredSpells");
+    json.beginArray();
+    for (const auto &id : outcome.output.counteredSpells) {
+      json.value(id);
+    }
+    json.endArray();
+    json.endObject();
+  }
+  json.endArray();
+  return json.take();
+}
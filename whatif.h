@@ -0,0 +1,44 @@
+/*
+  What-if mode (--what-if): "where should this Lightning Bolt go?" Takes the spell on top of the
+  stack, lists every legal choice for its card's spellTarget (hexproof / shroud respected, see
+  Engine::targetCandidates), resolves the whole stack once per choice on its own copy of the
+  state, in parallel, and ranks the results for the spell's controller.
+
+  Ranking, best first:
+    1. opponents' permanents destroyed minus the controller's own
+    2. life swing: life the opponents lost plus the controller's own life change
+    3. fewer steps, then candidate order (players and permanents by id)
+*/
+
+#ifndef WHATIF_H
+#define WHATIF_H
+
+#include "types.h"
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct WhatIfOptions {
+  int threads = 0;                          // 0: one per hardware thread
+  int maxSteps = 0;                         // Per-candidate budgets (0 means unlimited)
+  size_t maxStackDepth = 0;
+};
+
+struct WhatIfOutcome {
+  StackItem spell;                          // The top spell with this candidate's target filled in
+  string target;                            // Readable target ("Llanowar Elves (p2_1)", "p2", ...)
+  Output output;
+
+  int permanentSwing = 0;                   // Ranking keys (see above)
+  int lifeSwing = 0;
+};
+
+// Ranked best-first; throws runtime_error if the top of the stack isn't a spell with a choice
+auto evaluateTargets(const GameInput &input, const WhatIfOptions &options) -> vector<WhatIfOutcome>;
+
+// One JSON array (--what-if with --json)
+auto writeWhatIfJson(const vector<WhatIfOutcome> &outcomes) -> string;
+
+#endif
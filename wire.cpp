@@ -0,0 +1,649 @@
+#include "wire.h"
+#include "card_database.h"
+
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+
+constexpr string_view kInputMagic = "MTGI";
+constexpr string_view kOutputMagic = "MTGO";
+constexpr string_view kRunLogMagic = "MTGR";
+constexpr size_t kHeaderSize = 4 + 1 + 4;
+
+// ----------------------------- Writer ----------------------------- //
+
+class WireWriter {
+  string buf;
+
+public:
+  explicit WireWriter(string_view magic) {
+    buf.append(magic);
+    buf.push_back(static_cast<char>(kWireVersion));
+    buf.append(4, '\0');                    // Payload length, patched in finish()
+  }
+
+  void u8(uint8_t value) { buf.push_back(static_cast<char>(value)); }
+
+  void varint(uint64_t value) {
+    while (value >= 0x80) {
+      buf.push_back(static_cast<char>((value & 0x7F) | 0x80));
+      value >>= 7;
+    }
+    buf.push_back(static_cast<char>(value));
+  }
+
+  void svarint(int64_t value) {
+    // Zigzag so small negatives (damage, -1/-1 buffs) stay one byte
+    varint((static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+  }
+
+  void str(const string &value) {
+    varint(value.size());
+    buf.append(value);
+  }
+
+  void flag(bool value) { u8(value ? 1 : 0); }
+
+  template <typename E> void enumByte(E value) { u8(static_cast<uint8_t>(value)); }
+
+  void strings(const vector<string> &values) {
+    varint(values.size());
+    for (const auto &value : values) {
+      str(value);
+    }
+  }
+
+  auto finish() -> string {
+    auto payload = static_cast<uint32_t>(buf.size() - kHeaderSize);
+    for (int i = 0; i < 4; i++) {
+      buf[5 + i] = static_cast<char>((payload >> (8 * i)) & 0xFF);
+    }
+    return std::move(buf);
+  }
+};
+
+// ----------------------------- Reader ----------------------------- //
+
+class WireReader {
+  string_view data;
+  size_t pos = 0;
+
+  void need(size_t count) {
+    if (data.size() - pos < count) {
+      throw runtime_error("wire: truncated payload");
+    }
+  }
+
+public:
+  WireReader(string_view bytes, string_view magic) {
+    if (bytes.size() < kHeaderSize || bytes.substr(0, 4) != magic) {
+      throw runtime_error("wire: not a " + string(magic) + " frame");
+    }
+    if (static_cast<uint8_t>(bytes[4]) != kWireVersion) {
+      throw runtime_error("wire: unsupported version " + to_string(static_cast<uint8_t>(bytes[4])));
+    }
+
+    uint32_t payload = 0;
+    for (int i = 0; i < 4; i++) {
+      payload |= static_cast<uint32_t>(static_cast<uint8_t>(bytes[5 + i])) << (8 * i);
+    }
+    if (bytes.size() - kHeaderSize < payload) {
+      throw runtime_error("wire: frame shorter than its length prefix");
+    }
+    data = bytes.substr(kHeaderSize, payload);
+  }
+
+  auto u8() -> uint8_t {
+    need(1);
+    return static_cast<uint8_t>(data[pos++]);
+  }
+
+  auto varint() -> uint64_t {
+    uint64_t value = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t byte = u8();
+      value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if ((byte & 0x80) == 0) {
+        return value;
+      }
+    }
+    throw runtime_error("wire: varint too long");
+  }
+
+  auto svarint() -> int64_t {
+    uint64_t raw = varint();
+    return static_cast<int64_t>(raw >> 1) ^ -static_cast<int64_t>(raw & 1);
+  }
+
+  auto i32() -> int { return static_cast<int>(svarint()); }
+
+  auto count() -> size_t {
+    // Element counts can't exceed the remaining bytes (every element is at least one byte)
+    uint64_t value = varint();
+    if (value > data.size() - pos) {
+      throw runtime_error("wire: bad element count");
+    }
+    return static_cast<size_t>(value);
+  }
+
+  auto str() -> string {
+    size_t len = count();
+    string value(data.substr(pos, len));
+    pos += len;
+    return value;
+  }
+
+  auto flag() -> bool { return u8() != 0; }
+
+  template <typename E> auto enumByte(E last) -> E {
+    uint8_t value = u8();
+    if (value > static_cast<uint8_t>(last)) {
+      throw runtime_error("wire: enum value out of range");
+    }
+    return static_cast<E>(value);
+  }
+
+  void strings(vector<string> &out) {
+    size_t n = count();
+    out.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      out.push_back(str());
+    }
+  }
+
+  auto done() const -> bool { return pos == data.size(); }
+};
+
+// ----------------------------- Card Table ----------------------------- //
+
+void writeEffects(WireWriter &w, const vector<Effect> &effects) {
+  w.varint(effects.size());
+  for (const auto &eff : effects) {
+    w.enumByte(eff.type);
+    w.svarint(eff.value);
+    w.enumByte(eff.target);
+    w.str(eff.tokenName);
+    w.svarint(eff.tokenPower);
+    w.svarint(eff.tokenToughness);
+    w.str(eff.cardType);
+  }
+}
+
+void readEffects(WireReader &r, vector<Effect> &effects) {
+  size_t n = r.count();
+  for (size_t i = 0; i < n; i++) {
+    Effect eff;
+    eff.type = r.enumByte(EffectType::DESTROY_ALL);
+    eff.value = r.i32();
+    eff.target = r.enumByte(TargetType::SPELL);
+    eff.tokenName = r.str();
+    eff.tokenPower = r.i32();
+    eff.tokenToughness = r.i32();
+    eff.cardType = r.str();
+    effects.push_back(eff);
+  }
+}
+
+void writeCard(WireWriter &w, const CardDef &card) {
+  w.str(card.name);
+  w.strings(card.types);
+  w.strings(card.subtypes);
+  w.strings(card.keywords);
+  w.str(card.rulesText);
+  w.svarint(card.power);
+  w.svarint(card.toughness);
+  w.enumByte(card.spellTarget);
+  writeEffects(w, card.spellEffects);
+
+  w.varint(card.triggeredAbilities.size());
+  for (const auto &ability : card.triggeredAbilities) {
+    w.enumByte(ability.trigger.event);
+    w.enumByte(ability.trigger.scope);
+    writeEffects(w, ability.effects);
+    w.flag(ability.isMay);
+    w.str(ability.text);
+  }
+}
+
+auto readCard(WireReader &r) -> CardDef {
+  CardDef card;
+  card.name = r.str();
+  r.strings(card.types);
+  r.strings(card.subtypes);
+  r.strings(card.keywords);
+  card.keywordMask = keywordMask(card.keywords);
+  card.rulesText = r.str();
+  card.power = r.i32();
+  card.toughness = r.i32();
+  card.spellTarget = r.enumByte(TargetType::SPELL);
+  readEffects(r, card.spellEffects);
+
+  size_t abilities = r.count();
+  for (size_t i = 0; i < abilities; i++) {
+    TriggeredAbility ability;
+    ability.trigger.event = r.enumByte(TriggerEvent::BECOMES_TARGET);
+    ability.trigger.scope = r.enumByte(TriggerScope::ANY_PLAYER);
+    readEffects(r, ability.effects);
+    ability.isMay = r.flag();
+    ability.text = r.str();
+    card.triggeredAbilities.push_back(std::move(ability));
+  }
+  return card;
+}
+
+// Handle 0 means "not in the card table", followed by the raw name
+void writeCardRef(WireWriter &w, const unordered_map<string, size_t> &handles, const string &name) {
+  auto it = handles.find(name);
+  if (it != handles.end()) {
+    w.varint(it->second + 1);
+  } else {
+    w.varint(0);
+    w.str(name);
+  }
+}
+
+auto readCardRef(WireReader &r, const vector<string> &names) -> string {
+  uint64_t handle = r.varint();
+  if (handle == 0) {
+    return r.str();
+  }
+  if (handle > names.size()) {
+    throw runtime_error("wire: card handle out of range");
+  }
+  return names[handle - 1];
+}
+
+void writeStackItem(WireWriter &w, const unordered_map<string, size_t> &handles, const StackItem &item) {
+  w.str(item.id);
+  w.str(item.kind);
+  writeCardRef(w, handles, item.sourceName);
+  w.str(item.sourceId);
+  w.svarint(item.abilityIndex);
+  w.str(item.controller);
+  w.str(item.targetId);
+  w.str(item.targetPlayer);
+  w.str(item.targetStackId);
+}
+
+auto readStackItem(WireReader &r, const vector<string> &names) -> StackItem {
+  StackItem item;
+  item.id = r.str();
+  item.kind = r.str();
+  item.sourceName = readCardRef(r, names);
+  item.sourceId = r.str();
+  item.abilityIndex = r.i32();
+  item.controller = r.str();
+  item.targetId = r.str();
+  item.targetPlayer = r.str();
+  item.targetStackId = r.str();
+  return item;
+}
+
+// ----------------------------- Steps ----------------------------- //
+
+void writeStep(WireWriter &w, const ResolutionStep &step) {
+  w.str(step.description);
+
+  w.varint(step.triggeredEvents.size());
+  for (const auto &event : step.triggeredEvents) {
+    w.enumByte(event.type);
+    w.str(event.objectId);
+    w.str(event.cardName);
+    w.str(event.controller);
+    w.svarint(event.count);
+  }
+
+  w.varint(step.newTriggers.size());
+  for (const auto &trig : step.newTriggers) {
+    w.str(trig.sourceId);
+    w.str(trig.sourceName);
+    w.str(trig.controller);
+    w.svarint(trig.abilityIndex);
+    w.str(trig.text);
+    w.flag(trig.isActivePlayer);
+    w.svarint(trig.turnOrder);
+  }
+}
+
+auto readStep(WireReader &r) -> ResolutionStep {
+  ResolutionStep step;
+  step.description = r.str();
+
+  size_t events = r.count();
+  for (size_t i = 0; i < events; i++) {
+    GameEvent event;
+    event.type = r.enumByte(TriggerEvent::BECOMES_TARGET);
+    event.objectId = r.str();
+    event.cardName = r.str();
+    event.controller = r.str();
+    event.count = r.i32();
+    step.triggeredEvents.push_back(std::move(event));
+  }
+
+  size_t triggers = r.count();
+  for (size_t i = 0; i < triggers; i++) {
+    PendingTrigger trig;
+    trig.sourceId = r.str();
+    trig.sourceName = r.str();
+    trig.controller = r.str();
+    trig.abilityIndex = r.i32();
+    trig.text = r.str();
+    trig.isActivePlayer = r.flag();
+    trig.turnOrder = r.i32();
+    step.newTriggers.push_back(std::move(trig));
+  }
+  return step;
+}
+
+void writeCounts(WireWriter &w, const unordered_map<PlayerID, int> &counts) {
+  w.varint(counts.size());
+  for (const auto &[player, value] : counts) {
+    w.str(player);
+    w.svarint(value);
+  }
+}
+
+void readCounts(WireReader &r, unordered_map<PlayerID, int> &counts) {
+  size_t n = r.count();
+  for (size_t i = 0; i < n; i++) {
+    string player = r.str();
+    counts[player] = r.i32();
+  }
+}
+
+void writeLoop(WireWriter &w, const LoopReport &loop) {
+  w.flag(loop.detected);
+  if (!loop.detected) {
+    return;
+  }
+  w.svarint(loop.period);
+  w.svarint(loop.firstStep);
+  writeCounts(w, loop.lifeDelta);
+  writeCounts(w, loop.cardsDrawnDelta);
+  w.svarint(loop.destroyedPerLap);
+}
+
+auto readLoop(WireReader &r) -> LoopReport {
+  LoopReport loop;
+  loop.detected = r.flag();
+  if (!loop.detected) {
+    return loop;
+  }
+  loop.period = r.i32();
+  loop.firstStep = r.i32();
+  readCounts(r, loop.lifeDelta);
+  readCounts(r, loop.cardsDrawnDelta);
+  loop.destroyedPerLap = r.i32();
+  return loop;
+}
+
+}
+
+// ----------------------------- GameInput ----------------------------- //
+
+auto encodeGameInput(const GameInput &input) -> string {
+  WireWriter w(kInputMagic);
+
+  // Card table first so everything after can refer to cards by handle
+  unordered_map<string, size_t> handles;
+  vector<string> names = input.cards ? input.cards->names() : vector<string>{};
+  w.varint(names.size());
+  for (const auto &name : names) {
+    handles[name] = handles.size();
+    w.str(name);
+    writeCard(w, *input.cards->find(name));
+  }
+
+  w.str(input.activePlayer);
+  w.str(input.priorityPlayer);
+  w.str(input.currentPhase);
+
+  w.varint(input.boards.size());
+  for (const auto &[playerId, board] : input.boards) {
+    w.str(playerId);
+    w.svarint(board.life);
+    w.varint(board.permanents.size());
+    for (const auto &perm : board.permanents) {
+      w.str(perm.id);
+      writeCardRef(w, handles, perm.cardName);
+      w.str(perm.controller);
+      w.flag(perm.tapped);
+      w.svarint(perm.damage);
+      w.svarint(perm.powerModifier);
+      w.svarint(perm.toughnessModifier);
+      w.svarint(perm.counters);
+      w.flag(perm.isToken);
+      w.svarint(perm.count);
+    }
+  }
+
+  w.varint(input.stack.size());
+  for (const auto &item : input.stack) {
+    writeStackItem(w, handles, item);
+  }
+
+  w.varint(input.responses.size());
+  for (const auto &[player, pool] : input.responses) {
+    w.str(player);
+    w.varint(pool.size());
+    for (const auto &item : pool) {
+      writeStackItem(w, handles, item);
+    }
+  }
+
+  w.varint(input.combat.attacks.size());
+  for (const auto &attack : input.combat.attacks) {
+    w.str(attack.attacker);
+    w.str(attack.defender);
+  }
+  w.varint(input.combat.blocks.size());
+  for (const auto &block : input.combat.blocks) {
+    w.str(block.blocker);
+    w.str(block.attacker);
+  }
+
+  return w.finish();
+}
+
+auto decodeGameInput(string_view bytes) -> GameInput {
+  WireReader r(bytes, kInputMagic);
+  GameInput input;
+
+  size_t cardCount = r.count();
+  vector<string> names;
+  names.reserve(cardCount);
+  unordered_map<string, CardDef> cards;
+  for (size_t i = 0; i < cardCount; i++) {
+    names.push_back(r.str());
+    cards[names.back()] = readCard(r);
+  }
+  input.cards = make_shared<const CardDatabase>(std::move(cards));
+
+  input.activePlayer = r.str();
+  input.priorityPlayer = r.str();
+  input.currentPhase = r.str();
+
+  size_t boardCount = r.count();
+  for (size_t i = 0; i < boardCount; i++) {
+    Board board;
+    board.player = r.str();
+    board.life = r.i32();
+
+    size_t permCount = r.count();
+    for (size_t j = 0; j < permCount; j++) {
+      Permanent perm;
+      perm.id = r.str();
+      perm.cardName = readCardRef(r, names);
+      perm.controller = r.str();
+      perm.tapped = r.flag();
+      perm.damage = r.i32();
+      perm.powerModifier = r.i32();
+      perm.toughnessModifier = r.i32();
+      perm.counters = r.i32();
+      perm.isToken = r.flag();
+      perm.count = r.i32();
+      board.permanents.push_back(std::move(perm));
+    }
+    input.boards[board.player] = std::move(board);
+  }
+
+  size_t stackCount = r.count();
+  for (size_t i = 0; i < stackCount; i++) {
+    input.stack.push_back(readStackItem(r, names));
+  }
+
+  size_t responseCount = r.count();
+  for (size_t i = 0; i < responseCount; i++) {
+    vector<StackItem> &pool = input.responses[r.str()];
+    size_t poolSize = r.count();
+    for (size_t j = 0; j < poolSize; j++) {
+      pool.push_back(readStackItem(r, names));
+    }
+  }
+
+  size_t attackCount = r.count();
+  for (size_t i = 0; i < attackCount; i++) {
+    Attack attack;
+    attack.attacker = r.str();
+    attack.defender = r.str();
+    input.combat.attacks.push_back(std::move(attack));
+  }
+  size_t blockCount = r.count();
+  for (size_t i = 0; i < blockCount; i++) {
+    Block block;
+    block.blocker = r.str();
+    block.attacker = r.str();
+    input.combat.blocks.push_back(std::move(block));
+  }
+
+  if (!r.done()) {
+    throw runtime_error("wire: trailing bytes in GameInput frame");
+  }
+
+  // Same default as the JSON parser
+  if (input.priorityPlayer.empty()) {
+    input.priorityPlayer = input.activePlayer;
+  }
+  return input;
+}
+
+auto isWireGameInput(string_view bytes) -> bool {
+  return bytes.size() >= kHeaderSize && bytes.substr(0, 4) == kInputMagic;
+}
+
+// ----------------------------- Output ----------------------------- //
+
+auto encodeOutput(const Output &out) -> string {
+  WireWriter w(kOutputMagic);
+
+  w.flag(out.valid);
+  w.enumByte(out.stopReason);
+  w.svarint(out.unresolvedItems);
+  w.strings(out.errors);
+
+  w.varint(out.steps.size());
+  for (const auto &step : out.steps) {
+    writeStep(w, step);
+  }
+
+  w.varint(out.finalLife.size());
+  for (const auto &[player, life] : out.finalLife) {
+    w.str(player);
+    w.svarint(life);
+  }
+
+  w.strings(out.destroyedPermanents);
+  w.strings(out.counteredSpells);
+
+  w.varint(out.cardsDrawn.size());
+  for (const auto &[player, cards] : out.cardsDrawn) {
+    w.str(player);
+    w.svarint(cards);
+  }
+
+  writeLoop(w, out.loop);
+  return w.finish();
+}
+
+auto decodeOutput(string_view bytes) -> Output {
+  WireReader r(bytes, kOutputMagic);
+  Output out;
+
+  out.valid = r.flag();
+  out.stopReason = r.enumByte(StopReason::CANCELLED);
+  out.unresolvedItems = r.i32();
+  r.strings(out.errors);
+
+  size_t stepCount = r.count();
+  out.steps.reserve(stepCount);
+  for (size_t i = 0; i < stepCount; i++) {
+    out.steps.push_back(readStep(r));
+  }
+
+  size_t lifeCount = r.count();
+  for (size_t i = 0; i < lifeCount; i++) {
+    string player = r.str();
+    out.finalLife[player] = r.i32();
+  }
+
+  r.strings(out.destroyedPermanents);
+  r.strings(out.counteredSpells);
+
+  size_t drawnCount = r.count();
+  for (size_t i = 0; i < drawnCount; i++) {
+    string player = r.str();
+    out.cardsDrawn[player] = r.i32();
+  }
+
+  out.loop = readLoop(r);
+
+  if (!r.done()) {
+    throw runtime_error("wire: trailing bytes in Output frame");
+  }
+  return out;
+}
+
+// ----------------------------- Run Log ----------------------------- //
+
+auto encodeRunLog(const RunLog &log) -> string {
+  WireWriter w(kRunLogMagic);
+
+  w.str(log.input);
+  w.svarint(log.maxSteps);
+  w.varint(log.maxStackDepth);
+
+  // Resolved items name their card directly (the card table lives inside the input frame)
+  const unordered_map<string, size_t> noHandles;
+  w.varint(log.resolved.size());
+  for (const auto &item : log.resolved) {
+    writeStackItem(w, noHandles, item);
+  }
+
+  w.str(log.output);
+  return w.finish();
+}
+
+auto decodeRunLog(string_view bytes) -> RunLog {
+  WireReader r(bytes, kRunLogMagic);
+  RunLog log;
+
+  log.input = r.str();
+  log.maxSteps = r.i32();
+  log.maxStackDepth = static_cast<size_t>(r.varint());
+
+  const vector<string> noNames;
+  size_t itemCount = r.count();
+  log.resolved.reserve(itemCount);
+  for (size_t i = 0; i < itemCount; i++) {
+    log.resolved.push_back(readStackItem(r, noNames));
+  }
+
+  log.output = r.str();
+
+  if (!r.done()) {
+    throw runtime_error("wire: trailing bytes in run log frame");
+  }
+  return log;
+}
@@ -0,0 +1,49 @@
+/*
+  Compact binary encoding of GameInput and Output for service-to-service calls, so neither side
+  has to re-tokenize JSON or scrape the printed prose.
+
+  Every message is a frame:   magic (4 bytes) | version (1 byte) | payload length (u32 LE) | payload
+  Inside the payload integers are LEB128 varints (zigzag for signed), strings are length-prefixed,
+  and enums are single bytes. Permanents and stack items refer to cards by their handle (index into
+  the card table at the front of the GameInput payload) instead of repeating the card name.
+
+  A run log (--record / --replay) is one more frame that nests the GameInput and Output frames of
+  a run around the item resolved at each step.
+*/
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include "types.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Current frame version (bump when a payload layout changes)
+constexpr uint8_t kWireVersion = 9;
+
+auto encodeGameInput(const GameInput &input) -> string;
+auto decodeGameInput(string_view bytes) -> GameInput;
+
+auto encodeOutput(const Output &out) -> string;
+auto decodeOutput(string_view bytes) -> Output;
+
+struct RunLog {
+  // Everything needed to re-execute one run and check it resolved the same way
+  string input;                             // encodeGameInput frame
+  int maxSteps = 0;                         // Budgets the run had (deadline/cancel aren't replayable)
+  size_t maxStackDepth = 0;
+  vector<StackItem> resolved;               // Top of the stack at each step, in order
+  string output;                            // encodeOutput frame
+};
+
+auto encodeRunLog(const RunLog &log) -> string;
+auto decodeRunLog(string_view bytes) -> RunLog;
+
+// True if the bytes start with a GameInput frame header
+auto isWireGameInput(string_view bytes) -> bool;
+
+#endif